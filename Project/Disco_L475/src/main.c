@@ -14,6 +14,8 @@ LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 #define WIFI_PASS       "j1ms!aw3M" //"L10n5Br0nc05?"
 #define SERVER_IP       "172.17.11.168"  // Your laptop IP on hotspot
 #define SERVER_PORT     12345
+#define CAMERA_IP       "172.20.10.10"   // ESP32_EYE, gates its frames on presence
+#define CAMERA_PRESENCE_PORT 5001
 
 // Define GPIO pins
 // This may have to change depending on the board being used
@@ -25,8 +27,26 @@ LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 #define ECHO_TIMEOUT_US 25000
 #define MAX_RANGE_TIMEOUT_US 40000 // CHANGE THIS VALUE?
 
+static int presence_sock = -1;
+
 static void advertise_ultrasonic(uint16_t distance_cm) {
-    // Transmit the value via wifi
+    // Transmit the value via wifi to the camera as a presence reading
+    static struct sockaddr_in camera_addr;
+    char msg[8];
+    int len;
+
+    if (presence_sock < 0) {
+        presence_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (presence_sock < 0) {
+            return;
+        }
+        camera_addr.sin_family = AF_INET;
+        camera_addr.sin_port = htons(CAMERA_PRESENCE_PORT);
+        inet_pton(AF_INET, CAMERA_IP, &camera_addr.sin_addr);
+    }
+
+    len = snprintk(msg, sizeof(msg), "%u", distance_cm);
+    sendto(presence_sock, msg, len, 0, (struct sockaddr *)&camera_addr, sizeof(camera_addr));
 }
 
 static struct net_mgmt_event_callback wifi_cb;
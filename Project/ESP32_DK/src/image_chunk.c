@@ -0,0 +1,248 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/printk.h>
+
+#include "image_chunk.h"
+
+#define IMAGE_CHUNK_TOPIC  "image/chunk/"
+#define IMAGE_STATUS_TOPIC "image/nack/"
+
+#define STATUS_MAX_LEN (sizeof(struct image_status_hdr) + \
+                        IMAGE_STATUS_MAX_RANGES * sizeof(struct image_status_range))
+
+// One chunk is staged here at a time: header, then a slice of the frame
+static uint8_t chunk_buf[sizeof(struct image_chunk_hdr) + IMAGE_CHUNK_SIZE];
+static uint8_t status_buf[STATUS_MAX_LEN];
+static uint32_t next_image_id;
+
+void image_tx_init(struct image_tx *tx, struct mqtt_client *client, const char *client_id)
+{
+    memset(tx, 0, sizeof(*tx));
+    tx->client = client;
+    snprintf(tx->chunk_topic, sizeof(tx->chunk_topic), IMAGE_CHUNK_TOPIC "%s", client_id);
+    snprintf(tx->status_topic, sizeof(tx->status_topic), IMAGE_STATUS_TOPIC "%s", client_id);
+}
+
+const char *image_tx_status_topic(const struct image_tx *tx)
+{
+    return tx->status_topic;
+}
+
+int image_tx_start(struct image_tx *tx, const uint8_t *frame, uint32_t size)
+{
+    if (tx->active) {
+        return -EBUSY;
+    }
+    if (size == 0 || DIV_ROUND_UP(size, IMAGE_CHUNK_SIZE) > UINT16_MAX) {
+        return -EINVAL;
+    }
+
+    // Start from a different id after every reboot so the receiver never
+    // mistakes a new image for a finished one
+    if (next_image_id == 0) {
+        next_image_id = k_cycle_get_32() | 1;
+    }
+
+    tx->frame = frame;
+    tx->size = size;
+    tx->image_id = next_image_id++;
+    tx->image_crc = crc32_ieee(frame, size);
+    tx->total = DIV_ROUND_UP(size, IMAGE_CHUNK_SIZE);
+    tx->next = 0;
+    tx->resend_count = 0;
+    tx->resend_pos = 0;
+    tx->probes = 0;
+    tx->result = 0;
+    tx->active = true;
+    tx->last_activity = k_uptime_get();
+    return 0;
+}
+
+/*
+ * Stage and publish one chunk at QoS 0. Lost chunks are recovered through
+ * the receiver's NACKs rather than by the broker, so nothing is held for
+ * acknowledgement on the device.
+ */
+static int publish_chunk(struct image_tx *tx, uint16_t index, uint8_t flags)
+{
+    struct image_chunk_hdr hdr;
+    struct mqtt_publish_param param;
+    uint32_t offset = (uint32_t)index * IMAGE_CHUNK_SIZE;
+    uint32_t len = MIN(IMAGE_CHUNK_SIZE, tx->size - offset);
+    const uint8_t *data = tx->frame + offset;
+
+    hdr.version = IMAGE_CHUNK_VERSION;
+    hdr.flags = flags;
+    hdr.index = sys_cpu_to_le16(index);
+    hdr.total = sys_cpu_to_le16(tx->total);
+    hdr.chunk_size = sys_cpu_to_le16(IMAGE_CHUNK_SIZE);
+    hdr.image_id = sys_cpu_to_le32(tx->image_id);
+    hdr.image_size = sys_cpu_to_le32(tx->size);
+    hdr.image_crc = sys_cpu_to_le32(tx->image_crc);
+    hdr.chunk_crc = sys_cpu_to_le32(crc32_ieee(data, len));
+
+    memcpy(chunk_buf, &hdr, sizeof(hdr));
+    memcpy(chunk_buf + sizeof(hdr), data, len);
+
+    memset(&param, 0, sizeof(param));
+    param.message.topic.qos = MQTT_QOS_0_AT_MOST_ONCE;
+    param.message.topic.topic.utf8 = (uint8_t *)tx->chunk_topic;
+    param.message.topic.topic.size = strlen(tx->chunk_topic);
+    param.message.payload.data = chunk_buf;
+    param.message.payload.len = sizeof(hdr) + len;
+
+    return mqtt_publish(tx->client, &param);
+}
+
+// How the last transfer ended, reported once
+static int take_result(struct image_tx *tx)
+{
+    int result = tx->result;
+
+    tx->result = 0;
+    return result;
+}
+
+static int fail(struct image_tx *tx, int err)
+{
+    tx->active = false;
+    tx->result = err;
+    return take_result(tx);
+}
+
+int image_tx_poll(struct image_tx *tx)
+{
+    int64_t now = k_uptime_get();
+    int sent = 0;
+    int ret;
+
+    if (!tx->active) {
+        return take_result(tx);
+    }
+
+    while (sent < IMAGE_TX_BURST) {
+        uint16_t index;
+        uint8_t flags;
+
+        if (tx->resend_pos < tx->resend_count) {
+            struct image_status_range *range = &tx->resend[tx->resend_pos];
+
+            index = range->first++;
+            flags = IMAGE_CHUNK_RETRANSMIT;
+            if (--range->count == 0) {
+                tx->resend_pos++;
+            }
+        } else if (tx->next < tx->total) {
+            index = tx->next++;
+            flags = 0;
+        } else {
+            break;
+        }
+
+        ret = publish_chunk(tx, index, flags);
+        if (ret) {
+            printk("Failed to publish chunk %u: %d\n", index, ret);
+            return fail(tx, ret);
+        }
+        sent++;
+    }
+
+    if (sent) {
+        tx->last_activity = now;
+        return 0;
+    }
+
+    // Everything is out but the receiver is quiet: resend the last chunk,
+    // which makes it report what it is missing (or that it is done)
+    if (now - tx->last_activity >= IMAGE_TX_ACK_TIMEOUT_MS) {
+        if (tx->probes++ >= IMAGE_TX_MAX_PROBES) {
+            printk("Image %u not acknowledged\n", tx->image_id);
+            return fail(tx, -ETIMEDOUT);
+        }
+        ret = publish_chunk(tx, tx->total - 1, IMAGE_CHUNK_RETRANSMIT);
+        if (ret) {
+            return fail(tx, ret);
+        }
+        tx->last_activity = now;
+    }
+
+    return 0;
+}
+
+/*
+ * Queue the ranges from a NACK for resending, clipped to the image
+ */
+static void queue_resend(struct image_tx *tx, const uint8_t *ranges, uint8_t count)
+{
+    uint8_t n = 0;
+
+    for (uint8_t i = 0; i < count; i++) {
+        struct image_status_range range;
+
+        memcpy(&range, ranges + i * sizeof(range), sizeof(range));
+        range.first = sys_le16_to_cpu(range.first);
+        range.count = sys_le16_to_cpu(range.count);
+        if (range.first >= tx->total || range.count == 0) {
+            continue;
+        }
+        range.count = MIN(range.count, tx->total - range.first);
+        tx->resend[n++] = range;
+    }
+
+    tx->resend_count = n;
+    tx->resend_pos = 0;
+}
+
+bool image_tx_on_publish(struct image_tx *tx, const struct mqtt_publish_param *p)
+{
+    const struct mqtt_utf8 *topic = &p->message.topic.topic;
+    uint32_t len = p->message.payload.len;
+    struct image_status_hdr hdr;
+    uint8_t count;
+    int ret;
+
+    if (topic->size != strlen(tx->status_topic) ||
+        memcmp(topic->utf8, tx->status_topic, topic->size) != 0) {
+        return false;
+    }
+
+    // The payload must be consumed whatever it holds, or the MQTT stream
+    // loses its place
+    if (len > sizeof(status_buf)) {
+        while (len > 0) {
+            uint32_t part = MIN(len, sizeof(status_buf));
+
+            if (mqtt_readall_publish_payload(tx->client, status_buf, part) < 0) {
+                break;
+            }
+            len -= part;
+        }
+        return true;
+    }
+
+    ret = mqtt_readall_publish_payload(tx->client, status_buf, len);
+    if (ret < 0 || len < sizeof(hdr)) {
+        return true;
+    }
+
+    memcpy(&hdr, status_buf, sizeof(hdr));
+    if (!tx->active || sys_le32_to_cpu(hdr.image_id) != tx->image_id) {
+        return true;
+    }
+
+    if (hdr.status == IMAGE_STATUS_COMPLETE) {
+        tx->active = false;
+        tx->result = 1;
+        return true;
+    }
+
+    count = MIN(hdr.count, (len - sizeof(hdr)) / sizeof(struct image_status_range));
+    queue_resend(tx, status_buf + sizeof(hdr), count);
+    tx->probes = 0;
+    tx->last_activity = k_uptime_get();
+    return true;
+}
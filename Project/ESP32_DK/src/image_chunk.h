@@ -0,0 +1,121 @@
+/*
+ * Chunked image transfer over MQTT
+ *
+ * Chunks go out on image/chunk/<client id>, each a chunk header followed
+ * by up to IMAGE_CHUNK_SIZE bytes of the image. The receiver
+ * (Project/MQTT_Server/image_chunks.py) answers on image/nack/<client id>
+ * with the ranges of chunks it is missing, or IMAGE_STATUS_COMPLETE once
+ * the whole image passes its CRC. Only the missing chunks are sent again.
+ *
+ * Each chunk is staged in a buffer of IMAGE_CHUNK_SIZE bytes and published
+ * from there, so the image is read in place from the frame buffer and the
+ * MQTT tx buffer only ever holds the fixed header and topic. The frame
+ * buffer must stay valid until the transfer finishes.
+ *
+ * A transfer is driven from the thread that runs mqtt_input(), so it
+ * needs no locking.
+ */
+
+#ifndef IMAGE_CHUNK_H_
+#define IMAGE_CHUNK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+#include <zephyr/net/mqtt.h>
+
+#define IMAGE_CHUNK_VERSION 1
+#define IMAGE_CHUNK_SIZE    1024
+
+// Bits in image_chunk_hdr.flags
+#define IMAGE_CHUNK_RETRANSMIT 0x01 /* sent again after a NACK or as a probe */
+
+// Values of image_status_hdr.status
+#define IMAGE_STATUS_MISSING    0 /* followed by the missing ranges */
+#define IMAGE_STATUS_COMPLETE   1 /* image received and verified */
+#define IMAGE_STATUS_MAX_RANGES 16
+
+// Chunks published per image_tx_poll() call
+#define IMAGE_TX_BURST          8
+// Quiet time before the last chunk is resent to prompt a status
+#define IMAGE_TX_ACK_TIMEOUT_MS 2000
+#define IMAGE_TX_MAX_PROBES     5
+
+// All fields little endian
+struct image_chunk_hdr {
+    uint8_t version;
+    uint8_t flags;
+    uint16_t index;
+    uint16_t total;         /* chunks in the image */
+    uint16_t chunk_size;    /* size of every chunk but the last */
+    uint32_t image_id;
+    uint32_t image_size;
+    uint32_t image_crc;     /* CRC-32 (IEEE) of the whole image */
+    uint32_t chunk_crc;     /* CRC-32 (IEEE) of this chunk's data */
+} __packed;
+
+BUILD_ASSERT(sizeof(struct image_chunk_hdr) == 24, "chunk header must stay 24 bytes");
+
+struct image_status_hdr {
+    uint32_t image_id;
+    uint8_t status;
+    uint8_t count;          /* image_status_range entries that follow */
+} __packed;
+
+struct image_status_range {
+    uint16_t first;
+    uint16_t count;
+} __packed;
+
+struct image_tx {
+    struct mqtt_client *client;
+    const uint8_t *frame;
+    uint32_t size;
+    uint32_t image_id;
+    uint32_t image_crc;
+    uint16_t total;
+    uint16_t next;          /* next chunk not yet sent at all */
+
+    // Chunks the receiver asked for, sent before anything new
+    struct image_status_range resend[IMAGE_STATUS_MAX_RANGES];
+    uint8_t resend_count;
+    uint8_t resend_pos;
+
+    int64_t last_activity;
+    uint8_t probes;
+    bool active;
+    int result;             /* 1 once received, negative errno on failure; until polled */
+
+    char chunk_topic[64];
+    char status_topic[64];
+};
+
+/*
+ * Set up the topics for a client. Subscribe to image_tx_status_topic()
+ * before starting a transfer.
+ */
+void image_tx_init(struct image_tx *tx, struct mqtt_client *client, const char *client_id);
+
+const char *image_tx_status_topic(const struct image_tx *tx);
+
+/*
+ * Start sending an image from a frame buffer. Returns 0, -EBUSY while a
+ * transfer is in progress or -EINVAL for an empty or oversized image.
+ */
+int image_tx_start(struct image_tx *tx, const uint8_t *frame, uint32_t size);
+
+/*
+ * Publish the next burst of chunks, or a probe when the receiver has gone
+ * quiet. Returns 0 while the transfer is still going. Once it has ended,
+ * the next call returns 1 if the receiver has the image or a negative
+ * errno if it failed, and later calls return 0.
+ */
+int image_tx_poll(struct image_tx *tx);
+
+/*
+ * Call from the MQTT_EVT_PUBLISH handler. Returns true when the message
+ * was on the status topic, in which case its payload has been read.
+ */
+bool image_tx_on_publish(struct image_tx *tx, const struct mqtt_publish_param *p);
+
+#endif /* IMAGE_CHUNK_H_ */
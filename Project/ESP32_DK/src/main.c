@@ -10,250 +10,86 @@
 #include <zephyr/net/mqtt.h>
 #include <zephyr/net/net_event.h>
 #include <zephyr/net/net_mgmt.h>
-#include <zephyr/net/dns_resolve.h>
 #include <zephyr/net/net_core.h>
 #include <zephyr/net/net_if.h>
 
+#include "image_chunk.h"
+#include "mqtt_session.h"
+
 // WiFi settings
 #define WIFI_SSID "Super6"
 #define WIFI_PSK "L10n5Br0nc05?"// CONFIGURE
 #define HIVEMQ_HOSTNAME "broker.emqx.io"
 #define BROKER_IP "44.232.241.40"
 #define HIVEMQ_PORT 1883
-#define CLIENT_ID "m5stack-zephyr-client"
+#define CLIENT_ID "esp32-zephyr-client"
 #define MQTT_SUBSCRIBE_TOPIC "python/mqtt"
 #define HIVEMQ_USERNAME "emqx"
 #define HIVEMQ_PASSWORD "public"
 
-// Buffer sizes
-#define MQTT_CLIENT_RX_BUF_LEN 128
-#define MQTT_CLIENT_TX_BUF_LEN 128
-
-static struct mqtt_client client;
-static struct sockaddr_storage broker;
-static struct pollfd fds[1];
-static int nfds;
+// Longest received message that is printed
+#define MQTT_MESSAGE_MAX 128
 
-static uint8_t rx_buff[MQTT_CLIENT_RX_BUF_LEN];
-static uint8_t tx_buff[MQTT_CLIENT_TX_BUF_LEN];
+// Image sent in chunks once connected; stands in for a camera frame buffer
+static const uint8_t sample_image[] = {
+#include "sample.jpg.inc"
+};
+static struct image_tx image_tx;
 
 // Event callbacks
 static struct net_mgmt_event_callback wifi_cb;
 static struct net_mgmt_event_callback ipv4_cb;
 
 // Semaphores
-static K_SEM_DEFINE(sem_mqtt_connected, 0, 1);
-static K_SEM_DEFINE(dns_sem, 0, 1);
 static K_SEM_DEFINE(sem_wifi, 0, 1);
 static K_SEM_DEFINE(sem_ipv4, 0, 1);
 
-void dns_result_cb(enum dns_resolve_status status, struct dns_addrinfo *info, void *user_data) {
-	char hr_addr[NET_IPV4_ADDR_LEN];
-	char *hr_family;
-	void *addr;
-    printf("Resolving ...\n");
-	switch (status) {
-	case DNS_EAI_CANCELED:
-		printf("DNS query was canceled\n");
-		return;
-	case DNS_EAI_FAIL:
-		printf("DNS resolve failed\n");
-		return;
-	case DNS_EAI_NODATA:
-		printf("Cannot resolve address\n");
-		return;
-	case DNS_EAI_ALLDONE:
-		printf("DNS resolving finished\n");
-        k_sem_give(&dns_sem);
-		return;
-	case DNS_EAI_INPROGRESS:
-		break;
-	default:
-		printf("DNS resolving error (%d)\n", status);
-		return;
-	}
-
-	if (!info) {
-		return;
-	}
-
-	if (info->ai_family == AF_INET) {
-		hr_family = "IPv4";
-		addr = &net_sin(&info->ai_addr)->sin_addr;
-        struct sockaddr_in *broker_addr = (struct sockaddr_in *)&broker;
-        broker_addr->sin_family = AF_INET;
-        broker_addr->sin_port = htons(HIVEMQ_PORT);
-        memcpy(&broker_addr->sin_addr, &net_sin(&info->ai_addr)->sin_addr, sizeof(struct in_addr));
-        net_addr_ntop(AF_INET, &broker_addr->sin_addr, hr_addr, sizeof(hr_addr));
-        printf("Resolved %s to IPv4 address: %s\n", HIVEMQ_HOSTNAME, hr_addr);
-	} else if (info->ai_family == AF_INET6) {
-		hr_family = "IPv6";
-		addr = &net_sin6(&info->ai_addr)->sin6_addr;
-	} else {
-		printf("Invalid IP address family %d\n", info->ai_family);
-		return;
-	}
-
-	printf("%s %s address: %s\n", user_data ? (char *)user_data : "<null>",
-		hr_family, net_addr_ntop(info->ai_family, addr, hr_addr, sizeof(hr_addr)));
-}
+static struct mqtt_session session;
 
-static int resolve_dns(void)
+// Called for every message on a subscribed topic
+static void on_mqtt_publish(struct mqtt_session *s, const struct mqtt_publish_param *p)
 {
-    struct dns_resolve_context *dns_ctx = dns_resolve_get_default();
-    if (!dns_ctx) {
-        printk("No DNS context available\n");
-        return -1;
-    }
+    static uint8_t msg[MQTT_MESSAGE_MAX];
+    uint32_t len = p->message.payload.len;
+    uint32_t keep;
+    int ret;
 
-    printk("Resolving hostname: %s\n", HIVEMQ_HOSTNAME);
-    int ret = dns_get_addr_info(HIVEMQ_HOSTNAME, DNS_QUERY_TYPE_A, NULL, dns_result_cb, (void*)HIVEMQ_HOSTNAME, 10000);
-    if (ret) {
-        printk("Failed to start DNS query: %d\n", ret);
-        return ret;
+    // Status for the image being sent in chunks
+    if (image_tx_on_publish(&image_tx, p)) {
+        return;
     }
 
-    ret = k_sem_take(&dns_sem, K_SECONDS(10));
-    if (ret) {
-        printk("DNS resolve timeout\n");
-        return -2;
+    keep = MIN(len, sizeof(msg) - 1);
+    ret = mqtt_readall_publish_payload(mqtt_session_client(s), msg, keep);
+    if (ret < 0) {
+        printk("Failed to read MQTT payload: %d\n", ret);
+        return;
     }
-    return 0;
-}
-
-static void mqtt_evt_handler(struct mqtt_client *client, const struct mqtt_evt *evt)
-{
-    switch (evt->type) {
-    case MQTT_EVT_CONNACK:
-        if (evt->result == 0) {
-            printk("MQTT client connected\n");
-            k_sem_give(&sem_mqtt_connected);
-        } else {
-            printk("MQTT connect failed: %d\n", evt->result);
-        }
-        break;
-    case MQTT_EVT_DISCONNECT:
-        printk("MQTT client disconnected\n");
-        break;
-    case MQTT_EVT_PUBLISH:
-        {
-            const struct mqtt_publish_param *p = &evt->param.publish;
-            uint16_t len = p->message.payload.len;
-            if (len > sizeof(rx_buff) - 1) {
-                len = sizeof(rx_buff) - 1;
-            }
-            int ret = mqtt_read_publish_payload(client, rx_buff, len);
-            if (ret < 0) {
-                printk("Failed to read MQTT payload: %d\n", ret);
-                break;
-            }
-            rx_buff[len] = '\0';
-            printk("MQTT message received on topic %.*s: %s\n",
-                   p->message.topic.topic.size,
-                   p->message.topic.topic.utf8,
-                   rx_buff);
+    msg[keep] = '\0';
+    printk("MQTT message received on topic %.*s: %s\n",
+           p->message.topic.topic.size,
+           p->message.topic.topic.utf8,
+           msg);
+
+    // Discard the rest so the MQTT stream stays in step
+    for (len -= keep; len > 0; len -= keep) {
+        keep = MIN(len, sizeof(msg));
+        if (mqtt_readall_publish_payload(mqtt_session_client(s), msg, keep) < 0) {
+            return;
         }
-        break;
-    default:
-        printk("MQTT event: %d\n", evt->type);
-        break;
-    }
-}
-
-static int mqtt_connect_client(void)
-{
-    int ret = resolve_dns();
-    if (ret) {
-        return ret;
-    }
-    
-    mqtt_client_init(&client);
-
-    client.broker = &broker;
-    client.evt_cb = mqtt_evt_handler;
-
-    client.client_id.utf8 = (uint8_t *)CLIENT_ID;
-    client.client_id.size = strlen(CLIENT_ID);
-
-    client.protocol_version = MQTT_VERSION_3_1_1;
-
-    struct mqtt_sec_config *tls_config = NULL; // No TLS here, plain MQTT on port 1883
-
-    client.transport.type = MQTT_TRANSPORT_NON_SECURE;
-    client.rx_buf = rx_buff;
-    client.rx_buf_size = sizeof(rx_buff);
-    client.tx_buf = tx_buff;
-    client.tx_buf_size = sizeof(tx_buff);
-
-    
-    struct mqtt_utf8 username = {
-        .utf8 = (uint8_t *)HIVEMQ_USERNAME,
-        .size = strlen(HIVEMQ_USERNAME)
-    };
-    struct mqtt_utf8 password = {
-        .utf8 = (uint8_t *)HIVEMQ_PASSWORD,
-        .size = strlen(HIVEMQ_PASSWORD)
-    };
-
-    client.password = &password;
-	client.user_name = &username;
-
-
-    ret = mqtt_connect(&client);
-    if (ret) {
-        printk("MQTT connect failed: %d\n", ret);
-        return ret;
     }
-
-    return 0;
-}
-
-static int mqtt_subscribe_topic(const char *topic)
-{
-    struct mqtt_topic topics[1];
-    struct mqtt_subscription_list subscription;
-    topics[0].topic.utf8 = (uint8_t *)topic;
-    topics[0].topic.size = strlen(topic);
-    topics[0].qos = MQTT_QOS_1_AT_LEAST_ONCE;
-
-    subscription.list = topics;
-    subscription.list_count = 1;
-    subscription.message_id = 1;
-    printf("Subscribing to topic: %s\n", topic);
-    int ret = mqtt_subscribe(&client, &subscription);
-
-    if (ret) {
-        printk("Failed to subscribe to topic %s: %d\n", topic, ret);
-        return ret;
-    }
-
-    printk("Subscribed to topic %s\n", topic);
-    return 0;
-}
-
-static int mqtt_publish_message(const char *topic, const char *message)
-{
-    struct mqtt_publish_param param;
-
-    param.message.topic.qos = MQTT_QOS_1_AT_LEAST_ONCE;
-    param.message.topic.topic.utf8 = (uint8_t *)topic;
-    param.message.topic.topic.size = strlen(topic);
-    param.message.payload.data = (uint8_t *)message;
-    param.message.payload.len = strlen(message);
-    param.message_id = 1;
-    param.dup_flag = 0;
-    param.retain_flag = 0;
-
-    int ret = mqtt_publish(&client, &param);
-    if (ret) {
-        printk("Failed to publish message: %d\n", ret);
-        return ret;
-    }
-
-    printk("Published message: %s to topic: %s\n", message, topic);
-    return 0;
 }
 
+static const struct mqtt_session_config session_config = {
+    .hostname = HIVEMQ_HOSTNAME,
+    .fallback_ip = BROKER_IP,
+    .port = HIVEMQ_PORT,
+    .client_id = CLIENT_ID,
+    .username = HIVEMQ_USERNAME,
+    .password = HIVEMQ_PASSWORD,
+    .clean_session = false,
+    .on_publish = on_mqtt_publish,
+};
 // Called when the WiFi is connected
 static void on_wifi_connection_event(struct net_mgmt_event_callback *cb,
                                      uint32_t mgmt_event,
@@ -286,6 +122,8 @@ static void on_ipv4_obtained(struct net_mgmt_event_callback *cb,
     // Signal that the IP address has been obtained
     if (mgmt_event == NET_EVENT_IPV4_ADDR_ADD) {
         k_sem_give(&sem_ipv4);
+        // Reconnect straight away after a Wi-Fi blip
+        mqtt_session_network_changed(&session);
     }
 }
 
@@ -419,66 +257,43 @@ int main(void)
     // Wait to receive an IP address (blocking)
     wifi_wait_for_ip_addr();
 
-    ret = mqtt_connect_client();
+    // Connects in the loop below and reconnects whenever the link drops
+    mqtt_session_init(&session, &session_config);
+    image_tx_init(&image_tx, mqtt_session_client(&session), CLIENT_ID);
+    mqtt_session_subscribe(&session, image_tx_status_topic(&image_tx), MQTT_QOS_1_AT_LEAST_ONCE);
+
+    // Queued until the broker acknowledges it, across reconnects
+    ret = mqtt_session_publish(&session, MQTT_SUBSCRIBE_TOPIC, (const uint8_t *)"Hello from ESP",
+                               strlen("Hello from ESP"), MQTT_QOS_1_AT_LEAST_ONCE);
     if (ret < 0) {
-        printk("Failed to initialize and connect to MQTT broker, error: %d\n", ret);
-        return 1;
-    }
-    
-    if (client.transport.type == MQTT_TRANSPORT_NON_SECURE) {
-		fds[0].fd = client.transport.tcp.sock;
-	}
-    fds[0].events = ZSOCK_POLLIN;
-    nfds = 1;
-
-    // Poll for MQTT events until connected
-    while (k_sem_count_get(&sem_mqtt_connected) == 0) {
-        mqtt_input(&client);
-        mqtt_live(&client);
-        k_sleep(K_MSEC(100)); // Give some delay for CPU
-        printk("waiting");
+        printf("Failed to queue message, error: %d\n", ret);
     }
 
-    if (client.internal.state) {
-        //ret = mqtt_subscribe_topic(MQTT_SUBSCRIBE_TOPIC);
-        ret = mqtt_publish_message(MQTT_SUBSCRIBE_TOPIC, "Hello from ESP");
-        if (ret < 0) {
-            printf("Failed to subscribe to topic, error: %d\n", ret);
-            return 1;
-        }
+    // Send the sample image in chunks, listening for missing chunk reports
+    ret = image_tx_start(&image_tx, sample_image, sizeof(sample_image));
+    if (ret < 0) {
+        printk("Failed to start image transfer: %d\n", ret);
     } else {
-        printf("MQTT client not connected, cannot subscribe.\n");
+        printk("Sending %u byte image in %u chunks\n", image_tx.size, image_tx.total);
     }
 
     while (1) {
         /* Handle incoming MQTT events - received messages, etc. */
-        if (poll(fds, nfds, 10000) < 0) {
-            printf("Error in poll: %d\n", errno);
-            break;
-        }
-
-        if (fds[0].revents & POLLIN) {
-            ret = mqtt_input(&client);
-            if (ret != 0) {
-                printf("Error in mqtt_input: %d\n", ret);
-                break;
+        mqtt_session_process(&session, image_tx.active ? 10 : 1000);
+
+        // Keep chunks flowing while an image is in flight; a transfer
+        // simply pauses while the session reconnects. The completion
+        // status arrives in mqtt_session_process(), and the next poll
+        // reports it.
+        if (!image_tx.active || mqtt_session_connected(&session)) {
+            ret = image_tx_poll(&image_tx);
+            if (ret == 1) {
+                printk("Image %u delivered\n", image_tx.image_id);
+            } else if (ret < 0) {
+                printk("Image transfer failed: %d\n", ret);
             }
         }
-
-        if (fds[0].revents & POLLERR) {
-            printk("POLLERR\n");
-            break;
-        }
-
-        if (fds[0].revents & POLLHUP) {
-            printk("POLLHUP\n");
-            break;
-        }    
-
-        k_msleep(1000);
     }
 
-    mqtt_disconnect(&client);
-
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,57 @@
+/*
+ * Framed image streaming protocol for the TCP frame server
+ *
+ * Every frame on the wire is a fixed 32 byte header followed by
+ * payload_len bytes of image data. All header fields are little endian.
+ * The receiver (Project/PC/imagesocket.py) resynchronises by scanning for
+ * FRAME_MAGIC and checking hdr_crc, so a corrupt or partial frame costs
+ * one frame rather than the whole connection.
+ */
+
+#ifndef FRAME_PROTO_H_
+#define FRAME_PROTO_H_
+
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+#include <zephyr/sys/util.h>
+
+#define FRAME_MAGIC   "DPFR"
+#define FRAME_VERSION 1
+
+// Pixel formats carried in frame_header.pixfmt
+#define FRAME_PIXFMT_RGB565 1 /* RGB565, big endian, as captured */
+#define FRAME_PIXFMT_JPEG   2 /* Baseline JPEG */
+#define FRAME_PIXFMT_GESTURE 3 /* struct frame_gesture, classified on the device */
+
+// Bits in frame_header.flags
+#define FRAME_FLAG_CHANGED  BIT(0) /* scene changed since the reference frame */
+#define FRAME_FLAG_PRESENCE BIT(1) /* presence sensor reports someone in range */
+
+struct frame_header {
+	uint8_t magic[4];
+	uint8_t version;
+	uint8_t pixfmt;
+	uint8_t flags;
+	uint8_t hdr_len;	/* sizeof(struct frame_header) */
+	uint32_t seq;
+	uint32_t timestamp;	/* capture time, ms since boot */
+	uint16_t width;
+	uint16_t height;
+	uint32_t payload_len;
+	uint32_t payload_crc;	/* CRC-32 (IEEE) of the payload */
+	uint32_t hdr_crc;	/* CRC-32 (IEEE) of the preceding header bytes */
+} __packed;
+
+BUILD_ASSERT(sizeof(struct frame_header) == 32, "frame header must stay 32 bytes");
+
+/*
+ * Payload of a FRAME_PIXFMT_GESTURE message. The header's seq, timestamp,
+ * width and height are those of the camera frame that was classified.
+ */
+struct frame_gesture {
+	uint8_t label;		/* index into the training label map */
+	uint8_t confidence;	/* percent */
+	uint16_t infer_ms;	/* time the model took on the device */
+} __packed;
+
+#endif /* FRAME_PROTO_H_ */
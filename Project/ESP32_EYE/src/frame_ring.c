@@ -0,0 +1,114 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/drivers/video.h>
+
+#include "frame_ring.h"
+
+static struct frame frames[CONFIG_VIDEO_BUFFER_POOL_NUM_MAX];
+static size_t frame_count;
+static const struct device *video_dev;
+
+// Latest published frame, holds its own reference while it is the latest
+static struct frame *latest;
+static uint32_t next_seq = 1;
+
+K_MUTEX_DEFINE(ring_lock);
+K_CONDVAR_DEFINE(ring_cond);
+
+/*
+ * Attach the ring to the video device and its buffers
+ */
+void frame_ring_init(const struct device *video, struct video_buffer **bufs, size_t count)
+{
+	video_dev = video;
+	frame_count = MIN(count, ARRAY_SIZE(frames));
+
+	for (size_t i = 0; i < frame_count; i++) {
+		frames[i].vbuf = bufs[i];
+		atomic_set(&frames[i].refs, 0);
+	}
+}
+
+/*
+ * Find the ring slot that owns a dequeued buffer
+ */
+static struct frame *frame_lookup(struct video_buffer *vbuf)
+{
+	for (size_t i = 0; i < frame_count; i++) {
+		if (frames[i].vbuf == vbuf) {
+			return &frames[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Publish the latest frame and drop the ring's hold on the previous one
+ */
+struct frame *frame_ring_publish(struct video_buffer *vbuf, uint8_t flags)
+{
+	struct frame *frame = frame_lookup(vbuf);
+	struct frame *prev;
+
+	if (frame == NULL) {
+		printk("Frame ring: unknown video buffer %p\n", vbuf);
+		video_enqueue(video_dev, vbuf);
+		return NULL;
+	}
+
+	// One reference for the ring, one for the caller
+	atomic_set(&frame->refs, 2);
+	frame->timestamp = k_uptime_get_32();
+	frame->flags = flags;
+
+	k_mutex_lock(&ring_lock, K_FOREVER);
+	frame->seq = next_seq++;
+	prev = latest;
+	latest = frame;
+	k_condvar_broadcast(&ring_cond);
+	k_mutex_unlock(&ring_lock);
+
+	if (prev != NULL) {
+		frame_ring_put(prev);
+	}
+
+	return frame;
+}
+
+/*
+ * Check out the latest frame once it is newer than last_seq
+ */
+struct frame *frame_ring_get(uint32_t last_seq, k_timeout_t timeout)
+{
+	struct frame *frame = NULL;
+
+	k_mutex_lock(&ring_lock, K_FOREVER);
+	while (latest == NULL || latest->seq == last_seq) {
+		if (k_condvar_wait(&ring_cond, &ring_lock, timeout)) {
+			k_mutex_unlock(&ring_lock);
+			return NULL;
+		}
+	}
+
+	// The ring's own reference keeps refs above zero while we hold the lock
+	frame = latest;
+	atomic_inc(&frame->refs);
+	k_mutex_unlock(&ring_lock);
+
+	return frame;
+}
+
+/*
+ * Release a frame, handing the buffer back to the camera on the last put
+ */
+void frame_ring_put(struct frame *frame)
+{
+	if (atomic_dec(&frame->refs) != 1) {
+		return;
+	}
+
+	if (video_enqueue(video_dev, frame->vbuf)) {
+		printk("Frame ring: unable to requeue video buf\n");
+	}
+}
@@ -0,0 +1,49 @@
+/*
+ * Reference-counted frame ring shared by the camera and network threads
+ *
+ * The ring is built over the video buffers handed to the camera driver.
+ * A buffer is only given back to the driver with video_enqueue() once the
+ * last holder (camera, display or network) has released it, so nothing
+ * ever streams memory that the camera DMA is writing into.
+ */
+
+#ifndef FRAME_RING_H_
+#define FRAME_RING_H_
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/drivers/video.h>
+
+struct frame {
+	struct video_buffer *vbuf;
+	atomic_t refs;
+	uint32_t seq;
+	uint32_t timestamp;	/* k_uptime_get_32() when dequeued */
+	uint8_t flags;		/* FRAME_FLAG_* set by the camera thread */
+};
+
+/*
+ * Attach the ring to the video device and the buffers it was given.
+ * Must be called before the first frame is published.
+ */
+void frame_ring_init(const struct device *video, struct video_buffer **bufs, size_t count);
+
+/*
+ * Publish a freshly dequeued buffer as the latest frame.
+ * The returned frame holds a reference for the caller, which must be
+ * dropped with frame_ring_put() once the caller has finished with it.
+ */
+struct frame *frame_ring_publish(struct video_buffer *vbuf, uint8_t flags);
+
+/*
+ * Check out the latest frame if it is newer than last_seq, waiting up to
+ * timeout for one to arrive. Returns NULL on timeout.
+ */
+struct frame *frame_ring_get(uint32_t last_seq, k_timeout_t timeout);
+
+/*
+ * Drop a reference. The buffer is re-enqueued to the camera on the last put.
+ */
+void frame_ring_put(struct frame *frame);
+
+#endif /* FRAME_RING_H_ */
@@ -0,0 +1,108 @@
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+
+#include <tensorflow/lite/micro/micro_interpreter.h>
+#include <tensorflow/lite/micro/micro_mutable_op_resolver.h>
+#include <tensorflow/lite/schema/schema_generated.h>
+
+#include "gesture.h"
+#include "gesture_prep.h"
+
+// int8 TFLite model, generated from CONFIG_VIDEO_GESTURE_MODEL at build time
+static const uint8_t model_data[] __aligned(16) = {
+#include "gesture_model.inc"
+};
+
+// Tensor arena next to the video and JPEG buffers in PSRAM
+__attribute__ ((section (".ext_ram.bss"), aligned (16)))
+static uint8_t tensor_arena[CONFIG_VIDEO_GESTURE_ARENA_SIZE];
+
+// Same order as LABELS in gesture_recognition/inference.py
+static const char *const labels[] = {"0", "1", "2", "3", "4", "5", "phone"};
+
+static tflite::MicroInterpreter *interpreter;
+static TfLiteTensor *input;
+static TfLiteTensor *output;
+
+// Quantised model input for each 8 bit colour value
+static int8_t quant[256];
+
+int gesture_init(void)
+{
+	const tflite::Model *model = tflite::GetModel(model_data);
+
+	if (model->version() != TFLITE_SCHEMA_VERSION) {
+		printk("Gesture: model schema %u, expected %d\n", model->version(),
+		       TFLITE_SCHEMA_VERSION);
+		return -EINVAL;
+	}
+
+	// Operators a Keras MobileNetV2 with a dense head converts to
+	static tflite::MicroMutableOpResolver<9> resolver;
+	resolver.AddConv2D();
+	resolver.AddDepthwiseConv2D();
+	resolver.AddAdd();
+	resolver.AddPad();
+	resolver.AddMean();
+	resolver.AddFullyConnected();
+	resolver.AddSoftmax();
+	resolver.AddReshape();
+	resolver.AddQuantize();
+
+	static tflite::MicroInterpreter static_interpreter(model, resolver, tensor_arena,
+							    sizeof(tensor_arena));
+	interpreter = &static_interpreter;
+
+	if (interpreter->AllocateTensors() != kTfLiteOk) {
+		printk("Gesture: tensor arena of %zu bytes is too small\n", sizeof(tensor_arena));
+		return -ENOMEM;
+	}
+
+	input = interpreter->input(0);
+	output = interpreter->output(0);
+	if (input->type != kTfLiteInt8 || output->type != kTfLiteInt8 ||
+	    input->dims->size != 4 || input->dims->data[3] != 3) {
+		printk("Gesture: expected an int8 model with an RGB input\n");
+		return -EINVAL;
+	}
+
+	gesture_quant_table(quant, input->params.scale, input->params.zero_point);
+
+	printk("Gesture: %dx%d model, %zu of %zu arena bytes used\n", input->dims->data[2],
+	       input->dims->data[1], interpreter->arena_used_bytes(), sizeof(tensor_arena));
+
+	return 0;
+}
+
+int gesture_classify(const uint8_t *rgb565, uint16_t width, uint16_t height,
+		     struct gesture_result *result)
+{
+	uint32_t start = k_uptime_get_32();
+
+	if (interpreter == NULL) {
+		return -ENODEV;
+	}
+
+	gesture_fill_input(quant, rgb565, width, height, input->data.int8, input->dims->data[2],
+			   input->dims->data[1]);
+
+	if (interpreter->Invoke() != kTfLiteOk) {
+		printk("Gesture: inference failed\n");
+		return -EIO;
+	}
+
+	int classes = MIN(output->dims->data[output->dims->size - 1], (int)ARRAY_SIZE(labels));
+
+	gesture_pick(output->data.int8, classes, output->params.scale, output->params.zero_point,
+		     &result->label, &result->confidence);
+	result->infer_ms = k_uptime_get_32() - start;
+
+	return 0;
+}
+
+const char *gesture_label(uint8_t label)
+{
+	return label < ARRAY_SIZE(labels) ? labels[label] : "?";
+}
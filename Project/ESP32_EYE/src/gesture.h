@@ -0,0 +1,45 @@
+/*
+ * On-device gesture classification with TensorFlow Lite Micro
+ *
+ * Runs the int8 export of the gesture model (gesture_recognition/quantize.py)
+ * directly on camera frames. The model is built into the image and the
+ * tensor arena is a static PSRAM buffer, so no heap is used.
+ */
+
+#ifndef GESTURE_H_
+#define GESTURE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct gesture_result {
+	uint8_t label;		/* index into the training label map */
+	uint8_t confidence;	/* percent */
+	uint16_t infer_ms;
+};
+
+/*
+ * Load the model and allocate its tensors. Returns 0 or a negative errno.
+ */
+int gesture_init(void);
+
+/*
+ * Classify a big endian RGB565 frame, scaling it to the model input.
+ * Returns 0 or a negative errno.
+ */
+int gesture_classify(const uint8_t *rgb565, uint16_t width, uint16_t height,
+		     struct gesture_result *result);
+
+/*
+ * Name of a label index, as the training folders are named
+ */
+const char *gesture_label(uint8_t label);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GESTURE_H_ */
@@ -0,0 +1,55 @@
+/*
+ * Model input and output handling for on-device gesture classification
+ */
+
+#include <math.h>
+
+#include "gesture_prep.h"
+
+void gesture_quant_table(int8_t table[256], float scale, int zero_point)
+{
+	for (int v = 0; v < 256; v++) {
+		int q = (int)lroundf(v / 255.0f / scale) + zero_point;
+
+		table[v] = q < -128 ? -128 : (q > 127 ? 127 : q);
+	}
+}
+
+void gesture_fill_input(const int8_t table[256], const uint8_t *rgb565, uint16_t width,
+			uint16_t height, int8_t *dst, int in_w, int in_h)
+{
+	for (int y = 0; y < in_h; y++) {
+		const uint8_t *row = &rgb565[(y * height / in_h) * width * 2];
+
+		for (int x = 0; x < in_w; x++) {
+			const uint8_t *p = &row[(x * width / in_w) * 2];
+			uint16_t v = (p[0] << 8) | p[1];
+			uint8_t r = (v >> 8) & 0xF8;
+			uint8_t g = (v >> 3) & 0xFC;
+			uint8_t b = (v << 3) & 0xF8;
+
+			// Replicate the top bits into the bottom ones, as the PC does
+			*dst++ = table[r | (r >> 5)];
+			*dst++ = table[g | (g >> 6)];
+			*dst++ = table[b | (b >> 5)];
+		}
+	}
+}
+
+void gesture_pick(const int8_t *scores, int classes, float scale, int zero_point,
+		  uint8_t *label, uint8_t *confidence)
+{
+	int best = 0;
+	int percent;
+
+	// Quantisation keeps the order, so compare the raw int8 scores
+	for (int i = 1; i < classes; i++) {
+		if (scores[i] > scores[best]) {
+			best = i;
+		}
+	}
+
+	percent = (int)lroundf((scores[best] - zero_point) * scale * 100.0f);
+	*label = best;
+	*confidence = percent < 0 ? 0 : (percent > 100 ? 100 : percent);
+}
@@ -0,0 +1,44 @@
+/*
+ * Model input and output handling for on-device gesture classification
+ *
+ * Turns a camera frame into the int8 model input the same way the PC
+ * pipeline (gesture_recognition/prep_img.py) turns it into a float batch,
+ * and turns the int8 scores back into a label and confidence. Free of
+ * Zephyr and TensorFlow Lite Micro dependencies, so both ends can be
+ * checked on a host against golden data from the PC pipeline.
+ */
+
+#ifndef GESTURE_PREP_H_
+#define GESTURE_PREP_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Build the table mapping an 8 bit colour value, scaled to [0, 1] as in
+ * training, to the model's int8 input with the given quantisation
+ */
+void gesture_quant_table(int8_t table[256], float scale, int zero_point);
+
+/*
+ * Nearest neighbour scale of a big endian RGB565 frame into an in_w x in_h
+ * RGB input tensor, picking the same source pixels as the PC decoder
+ */
+void gesture_fill_input(const int8_t table[256], const uint8_t *rgb565, uint16_t width,
+			uint16_t height, int8_t *dst, int in_w, int in_h);
+
+/*
+ * Best class of the int8 scores, the first one on a tie, and its
+ * dequantised probability in percent
+ */
+void gesture_pick(const int8_t *scores, int classes, float scale, int zero_point,
+		  uint8_t *label, uint8_t *confidence);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GESTURE_PREP_H_ */
@@ -0,0 +1,470 @@
+/*
+ * Baseline JPEG encoder for RGB565 camera frames
+ *
+ * Float AAN forward DCT (as in libjpeg's jfdctflt.c) with the DCT output
+ * scaling folded into the quantisation divisors, 2x2 chroma subsampling
+ * and the example Huffman tables from Annex K of the JPEG standard.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "jpeg_enc.h"
+
+// Zig-zag position -> natural (row major) coefficient index
+static const uint8_t zigzag[64] = {
+	0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// Annex K quantisation tables, natural order
+static const uint8_t std_lum_qt[64] = {
+	16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,
+	14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+	18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,
+	49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+};
+
+static const uint8_t std_chr_qt[64] = {
+	17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+	24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+// Annex K Huffman tables: code counts per length, then symbols
+static const uint8_t dc_lum_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t dc_chr_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t dc_vals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t ac_lum_bits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t ac_lum_vals[162] = {
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61,
+	0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52,
+	0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25,
+	0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+	0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64,
+	0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83,
+	0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99,
+	0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+	0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3,
+	0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8,
+	0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+};
+
+static const uint8_t ac_chr_bits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t ac_chr_vals[162] = {
+	0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61,
+	0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33,
+	0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18,
+	0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+	0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63,
+	0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a,
+	0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+	0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+	0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca,
+	0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7,
+	0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+};
+
+// AAN DCT output scale factors
+static const float aan_scale[8] = {
+	1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+	1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+};
+
+struct huff_table {
+	uint16_t code[256];
+	uint8_t size[256];
+};
+
+static struct huff_table dc_lum, dc_chr, ac_lum, ac_chr;
+static bool huff_ready;
+
+struct jpeg_writer {
+	uint8_t *out;
+	size_t size;
+	size_t len;
+	uint32_t bitbuf;
+	int bitcnt;
+	bool overflow;
+};
+
+/*
+ * Expand code counts and symbols into per-symbol codes (Annex C)
+ */
+static void huff_build(struct huff_table *t, const uint8_t bits[16], const uint8_t *vals)
+{
+	uint16_t code = 0;
+	int k = 0;
+
+	for (int len = 1; len <= 16; len++) {
+		for (int i = 0; i < bits[len - 1]; i++) {
+			t->code[vals[k]] = code++;
+			t->size[vals[k]] = len;
+			k++;
+		}
+		code <<= 1;
+	}
+}
+
+static void put_byte(struct jpeg_writer *w, uint8_t b)
+{
+	if (w->len >= w->size) {
+		w->overflow = true;
+		return;
+	}
+	w->out[w->len++] = b;
+}
+
+static void put_be16(struct jpeg_writer *w, uint16_t v)
+{
+	put_byte(w, v >> 8);
+	put_byte(w, v & 0xFF);
+}
+
+static void put_bytes(struct jpeg_writer *w, const uint8_t *data, size_t len)
+{
+	if (w->len + len > w->size) {
+		w->overflow = true;
+		return;
+	}
+	memcpy(&w->out[w->len], data, len);
+	w->len += len;
+}
+
+/*
+ * Append up to 16 bits to the entropy coded segment, stuffing 0xFF bytes
+ */
+static void put_bits(struct jpeg_writer *w, uint32_t bits, int count)
+{
+	w->bitbuf = (w->bitbuf << count) | (bits & ((1U << count) - 1));
+	w->bitcnt += count;
+
+	while (w->bitcnt >= 8) {
+		uint8_t b = (w->bitbuf >> (w->bitcnt - 8)) & 0xFF;
+
+		put_byte(w, b);
+		if (b == 0xFF) {
+			put_byte(w, 0x00);
+		}
+		w->bitcnt -= 8;
+	}
+}
+
+static void flush_bits(struct jpeg_writer *w)
+{
+	// Pad the final byte with 1 bits
+	if (w->bitcnt > 0) {
+		put_bits(w, 0x7F, 8 - w->bitcnt);
+	}
+}
+
+static void put_dht(struct jpeg_writer *w, uint8_t class_id, const uint8_t bits[16],
+		    const uint8_t *vals)
+{
+	size_t count = 0;
+
+	for (int i = 0; i < 16; i++) {
+		count += bits[i];
+	}
+
+	put_be16(w, 0xFFC4);
+	put_be16(w, 2 + 1 + 16 + count);
+	put_byte(w, class_id);
+	put_bytes(w, bits, 16);
+	put_bytes(w, vals, count);
+}
+
+static void put_headers(struct jpeg_writer *w, uint16_t width, uint16_t height,
+			const uint8_t qt_lum[64], const uint8_t qt_chr[64])
+{
+	static const uint8_t jfif[] = {
+		0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00,
+		0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+	};
+
+	// SOI and JFIF APP0
+	put_be16(w, 0xFFD8);
+	put_bytes(w, jfif, sizeof(jfif));
+
+	// DQT, tables are stored in zig-zag order
+	put_be16(w, 0xFFDB);
+	put_be16(w, 2 + 2 * 65);
+	put_byte(w, 0x00);
+	for (int i = 0; i < 64; i++) {
+		put_byte(w, qt_lum[zigzag[i]]);
+	}
+	put_byte(w, 0x01);
+	for (int i = 0; i < 64; i++) {
+		put_byte(w, qt_chr[zigzag[i]]);
+	}
+
+	// SOF0: Y sampled 2x2, Cb and Cr 1x1
+	put_be16(w, 0xFFC0);
+	put_be16(w, 2 + 6 + 3 * 3);
+	put_byte(w, 8);
+	put_be16(w, height);
+	put_be16(w, width);
+	put_byte(w, 3);
+	put_byte(w, 1);
+	put_byte(w, 0x22);
+	put_byte(w, 0);
+	put_byte(w, 2);
+	put_byte(w, 0x11);
+	put_byte(w, 1);
+	put_byte(w, 3);
+	put_byte(w, 0x11);
+	put_byte(w, 1);
+
+	put_dht(w, 0x00, dc_lum_bits, dc_vals);
+	put_dht(w, 0x10, ac_lum_bits, ac_lum_vals);
+	put_dht(w, 0x01, dc_chr_bits, dc_vals);
+	put_dht(w, 0x11, ac_chr_bits, ac_chr_vals);
+
+	// SOS
+	put_be16(w, 0xFFDA);
+	put_be16(w, 2 + 1 + 3 * 2 + 3);
+	put_byte(w, 3);
+	put_byte(w, 1);
+	put_byte(w, 0x00);
+	put_byte(w, 2);
+	put_byte(w, 0x11);
+	put_byte(w, 3);
+	put_byte(w, 0x11);
+	put_byte(w, 0);
+	put_byte(w, 63);
+	put_byte(w, 0);
+}
+
+/*
+ * Scale the Annex K table for the requested quality (IJG formula)
+ */
+static void scale_qt(const uint8_t *base, int quality, uint8_t *qt, float *divisors)
+{
+	int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+	for (int i = 0; i < 64; i++) {
+		int q = (base[i] * scale + 50) / 100;
+
+		q = q < 1 ? 1 : (q > 255 ? 255 : q);
+		qt[i] = q;
+		divisors[i] = 1.0f / (q * aan_scale[i / 8] * aan_scale[i % 8] * 8.0f);
+	}
+}
+
+/*
+ * In-place float AAN forward DCT, output scaled by aan_scale
+ */
+static void fdct(float *d)
+{
+	float tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+	float tmp10, tmp11, tmp12, tmp13;
+	float z1, z2, z3, z4, z5, z11, z13;
+
+	for (int pass = 0; pass < 2; pass++) {
+		// First pass works on rows, second on columns
+		int step = pass == 0 ? 1 : 8;
+		int next = pass == 0 ? 8 : 1;
+
+		for (int i = 0; i < 8; i++) {
+			float *p = &d[i * next];
+
+			tmp0 = p[0 * step] + p[7 * step];
+			tmp7 = p[0 * step] - p[7 * step];
+			tmp1 = p[1 * step] + p[6 * step];
+			tmp6 = p[1 * step] - p[6 * step];
+			tmp2 = p[2 * step] + p[5 * step];
+			tmp5 = p[2 * step] - p[5 * step];
+			tmp3 = p[3 * step] + p[4 * step];
+			tmp4 = p[3 * step] - p[4 * step];
+
+			// Even part
+			tmp10 = tmp0 + tmp3;
+			tmp13 = tmp0 - tmp3;
+			tmp11 = tmp1 + tmp2;
+			tmp12 = tmp1 - tmp2;
+
+			p[0 * step] = tmp10 + tmp11;
+			p[4 * step] = tmp10 - tmp11;
+
+			z1 = (tmp12 + tmp13) * 0.707106781f;
+			p[2 * step] = tmp13 + z1;
+			p[6 * step] = tmp13 - z1;
+
+			// Odd part
+			tmp10 = tmp4 + tmp5;
+			tmp11 = tmp5 + tmp6;
+			tmp12 = tmp6 + tmp7;
+
+			z5 = (tmp10 - tmp12) * 0.382683433f;
+			z2 = 0.541196100f * tmp10 + z5;
+			z4 = 1.306562965f * tmp12 + z5;
+			z3 = tmp11 * 0.707106781f;
+
+			z11 = tmp7 + z3;
+			z13 = tmp7 - z3;
+
+			p[5 * step] = z13 + z2;
+			p[3 * step] = z13 - z2;
+			p[1 * step] = z11 + z4;
+			p[7 * step] = z11 - z4;
+		}
+	}
+}
+
+static int bit_length(int v)
+{
+	int n = 0;
+
+	v = v < 0 ? -v : v;
+	while (v) {
+		n++;
+		v >>= 1;
+	}
+
+	return n;
+}
+
+/*
+ * Transform, quantise and entropy code one 8x8 block
+ */
+static void encode_block(struct jpeg_writer *w, float *blk, const float *divisors, int *dc,
+			 const struct huff_table *dc_tab, const struct huff_table *ac_tab)
+{
+	int coef[64];
+	int diff, nbits, run = 0;
+
+	fdct(blk);
+
+	for (int i = 0; i < 64; i++) {
+		int k = zigzag[i];
+		float v = blk[k] * divisors[k];
+
+		coef[i] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
+	}
+
+	// DC is coded as the difference from the previous block of this component
+	diff = coef[0] - *dc;
+	*dc = coef[0];
+	nbits = bit_length(diff);
+	put_bits(w, dc_tab->code[nbits], dc_tab->size[nbits]);
+	if (nbits) {
+		put_bits(w, diff < 0 ? diff - 1 : diff, nbits);
+	}
+
+	for (int i = 1; i < 64; i++) {
+		int v = coef[i];
+
+		if (v == 0) {
+			run++;
+			continue;
+		}
+
+		// ZRL for every full run of 16 zeros
+		while (run >= 16) {
+			put_bits(w, ac_tab->code[0xF0], ac_tab->size[0xF0]);
+			run -= 16;
+		}
+
+		nbits = bit_length(v);
+		put_bits(w, ac_tab->code[(run << 4) | nbits], ac_tab->size[(run << 4) | nbits]);
+		put_bits(w, v < 0 ? v - 1 : v, nbits);
+		run = 0;
+	}
+
+	// EOB when the block ends in zeros
+	if (run) {
+		put_bits(w, ac_tab->code[0x00], ac_tab->size[0x00]);
+	}
+}
+
+/*
+ * Read one pixel as level shifted YCbCr, clamping to the image edge
+ */
+static inline void load_pixel(const uint8_t *src, uint16_t width, uint16_t height,
+			      int x, int y, float *yy, float *cb, float *cr)
+{
+	const uint8_t *p;
+	uint16_t v;
+	float r, g, b;
+
+	x = x < width ? x : width - 1;
+	y = y < height ? y : height - 1;
+	p = &src[(y * width + x) * 2];
+	v = (p[0] << 8) | p[1];
+
+	r = ((v >> 11) & 0x1F) * (255.0f / 31.0f);
+	g = ((v >> 5) & 0x3F) * (255.0f / 63.0f);
+	b = (v & 0x1F) * (255.0f / 31.0f);
+
+	*yy = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+	*cb = -0.168736f * r - 0.331264f * g + 0.5f * b;
+	*cr = 0.5f * r - 0.418688f * g - 0.081312f * b;
+}
+
+int jpeg_encode_rgb565(const uint8_t *src, uint16_t width, uint16_t height,
+		       int quality, uint8_t *out, size_t out_size)
+{
+	struct jpeg_writer w = {
+		.out = out,
+		.size = out_size,
+	};
+	uint8_t qt_lum[64], qt_chr[64];
+	float div_lum[64], div_chr[64];
+	float ybuf[4][64], cbbuf[64], crbuf[64];
+	int dc_y = 0, dc_cb = 0, dc_cr = 0;
+
+	if (!huff_ready) {
+		huff_build(&dc_lum, dc_lum_bits, dc_vals);
+		huff_build(&dc_chr, dc_chr_bits, dc_vals);
+		huff_build(&ac_lum, ac_lum_bits, ac_lum_vals);
+		huff_build(&ac_chr, ac_chr_bits, ac_chr_vals);
+		huff_ready = true;
+	}
+
+	quality = quality < 1 ? 1 : (quality > 100 ? 100 : quality);
+	scale_qt(std_lum_qt, quality, qt_lum, div_lum);
+	scale_qt(std_chr_qt, quality, qt_chr, div_chr);
+
+	put_headers(&w, width, height, qt_lum, qt_chr);
+
+	// One MCU is a 16x16 pixel area: four Y blocks, one Cb and one Cr
+	for (int my = 0; my < height; my += 16) {
+		for (int mx = 0; mx < width; mx += 16) {
+			memset(cbbuf, 0, sizeof(cbbuf));
+			memset(crbuf, 0, sizeof(crbuf));
+
+			for (int y = 0; y < 16; y++) {
+				for (int x = 0; x < 16; x++) {
+					float yy, cb, cr;
+					int blk = (y / 8) * 2 + (x / 8);
+					int c = (y / 2) * 8 + (x / 2);
+
+					load_pixel(src, width, height, mx + x, my + y, &yy, &cb, &cr);
+					ybuf[blk][(y % 8) * 8 + (x % 8)] = yy;
+					cbbuf[c] += cb * 0.25f;
+					crbuf[c] += cr * 0.25f;
+				}
+			}
+
+			for (int i = 0; i < 4; i++) {
+				encode_block(&w, ybuf[i], div_lum, &dc_y, &dc_lum, &ac_lum);
+			}
+			encode_block(&w, cbbuf, div_chr, &dc_cb, &dc_chr, &ac_chr);
+			encode_block(&w, crbuf, div_chr, &dc_cr, &dc_chr, &ac_chr);
+
+			if (w.overflow) {
+				return -ENOMEM;
+			}
+		}
+	}
+
+	flush_bits(&w);
+	put_be16(&w, 0xFFD9);
+
+	return w.overflow ? -ENOMEM : (int)w.len;
+}
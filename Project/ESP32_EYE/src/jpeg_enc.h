@@ -0,0 +1,24 @@
+/*
+ * Baseline JPEG encoder for RGB565 camera frames
+ *
+ * Encodes 4:2:0 baseline JPEG with the standard Huffman tables straight
+ * from the camera buffer into a caller supplied output arena. No heap is
+ * used, so the arena can live in PSRAM next to the video buffers.
+ */
+
+#ifndef JPEG_ENC_H_
+#define JPEG_ENC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Encode a big endian RGB565 image of width x height pixels.
+ * quality is 1 (smallest) to 100 (best).
+ * Returns the number of bytes written to out, or -ENOMEM if the encoded
+ * image does not fit in out_size bytes.
+ */
+int jpeg_encode_rgb565(const uint8_t *src, uint16_t width, uint16_t height,
+		       int quality, uint8_t *out, size_t out_size);
+
+#endif /* JPEG_ENC_H_ */
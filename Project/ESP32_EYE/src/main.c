@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/video.h>
@@ -6,12 +7,38 @@
 #include <zephyr/drivers/display.h>
 #include <zephyr/net/dhcpv4_server.h>
 #include <zephyr/net/net_ip.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/zvfs/eventfd.h>
+
+#include "frame_ring.h"
+#include "frame_proto.h"
+#include "jpeg_enc.h"
+#include "motion.h"
+#include "gesture.h"
 
 #define VIDEO_DEV_SW "VIDEO_SW_GENERATOR"
 #define MY_PORT 5000
-#define MAX_CLIENT_QUEUE 1
+#define MAX_CLIENTS 4
+#define MAX_CLIENT_QUEUE MAX_CLIENTS
+
+// Distinct frames the server may hold while leaving the camera one buffer to
+// fill and one as the latest frame
+#define TX_SLOTS MAX(CONFIG_VIDEO_BUFFER_POOL_NUM_MAX - 2, 1)
+
+// How often per-client throughput is printed
+#define STATS_INTERVAL_MS 5000
+// Back off after a failed poll
+#define POLL_RETRY_MS 5
 
 #define STACKSIZE 4096
+#ifdef CONFIG_VIDEO_GESTURE
+// TFLite Micro kernels run on the camera thread's stack
+#define CAMERA_STACKSIZE 8192
+#else
+#define CAMERA_STACKSIZE STACKSIZE
+#endif
+#define PRESENCE_STACKSIZE 2048
 
 // WiFi settings
 #define WIFI_SSID "Zoe"
@@ -30,15 +57,68 @@ static struct net_mgmt_event_callback cb;
 struct video_buffer *buffers[CONFIG_VIDEO_BUFFER_POOL_NUM_MAX];
 struct video_buffer *vbuf = &(struct video_buffer){};
 
-// Define variables to be sent to client
+// Size of a full frame sent to the client
 #define BUFFER_SIZE (CONFIG_VIDEO_FRAME_WIDTH * CONFIG_VIDEO_FRAME_HEIGHT * 2)
-// __attribute__ ((section (".ext_ram.bss"))) uint8_t frame_copy[BUFFER_SIZE]; // Store in PSRAM
-__attribute__ ((section (".ext_ram.bss"))) uint8_t *frame_copy;
-static size_t frame_size = 0;
 
-// Polling signal for image data transmission
-struct k_poll_signal tx_signal;
-K_FIFO_DEFINE(tx_fifo);
+// Stream geometry advertised in each frame header
+static uint16_t frame_width, frame_height;
+
+#ifdef CONFIG_VIDEO_JPEG
+// Encoder output, one per frame the server can hold
+__attribute__ ((section (".ext_ram.bss")))
+static uint8_t jpeg_arena[TX_SLOTS][CONFIG_VIDEO_JPEG_ARENA_SIZE];
+#endif
+
+// A frame prepared for sending, shared by every client streaming it
+struct tx_frame {
+	struct frame *frame;	/* camera frame still referenced, if any */
+	struct frame_header hdr;
+	const uint8_t *payload;
+	size_t len;
+	uint32_t seq;
+	int users;
+};
+
+struct client {
+	int sock;
+	struct sockaddr_in addr;
+	struct tx_frame *tx;	/* frame being sent, NULL while idle */
+	size_t sent;		/* bytes of header and payload sent so far */
+	uint32_t last_seq;
+	uint32_t last_gesture;	/* seq of the last gesture result sent */
+	// Counters since the last stats report
+	uint32_t frames;
+	uint32_t dropped;
+	uint32_t bytes;
+};
+
+static struct tx_frame tx_frames[TX_SLOTS];
+static struct client clients[MAX_CLIENTS];
+
+// Polled with the sockets, so the network thread sleeps until a frame or
+// result it can send is ready. Only signalled while a client is idle.
+static int wake_fd = -1;
+static atomic_t wake_wanted;
+
+#ifdef CONFIG_VIDEO_JPEG
+// Slots move from the network thread to the encoder thread while free, and
+// back once they hold an encoded frame
+K_MSGQ_DEFINE(tx_free_q, sizeof(struct tx_frame *), TX_SLOTS, 4);
+K_MSGQ_DEFINE(tx_ready_q, sizeof(struct tx_frame *), TX_SLOTS, 4);
+// Given by the network thread while a client is waiting for a frame
+K_SEM_DEFINE(encode_request, 0, 1);
+#endif
+
+#ifdef CONFIG_VIDEO_GESTURE
+// Newest result from the camera thread, and the frame it was made from
+static struct k_spinlock gesture_lock;
+static struct frame_gesture gesture_latest;
+static uint32_t gesture_seq, gesture_timestamp;
+
+// Result being sent, rebuilt from gesture_latest once no client is using it
+static struct tx_frame gesture_tx;
+static struct frame_gesture gesture_payload;
+#endif
 
 /*
  * WiFi callback function
@@ -137,27 +217,443 @@ static inline void video_display_frame(const struct device *const display_dev,
 }
 
 /*
- * Send READY message and image data to client
+ * Wake the network thread. The count stays set until it is read, so a wake
+ * that comes before the thread polls is not lost.
+ */
+static void network_wake(void)
+{
+	if (wake_fd >= 0 && atomic_get(&wake_wanted)) {
+		zvfs_eventfd_write(wake_fd, 1);
+	}
+}
+
+/*
+ * Fill in the frame header for a prepared frame
+ */
+static void tx_frame_header(struct tx_frame *tx, uint32_t timestamp, uint8_t pixfmt,
+			    uint8_t flags)
+{
+	struct frame_header *hdr = &tx->hdr;
+
+	*hdr = (struct frame_header) {
+		.magic = FRAME_MAGIC,
+		.version = FRAME_VERSION,
+		.pixfmt = pixfmt,
+		.flags = flags,
+		.hdr_len = sizeof(struct frame_header),
+		.seq = sys_cpu_to_le32(tx->seq),
+		.timestamp = sys_cpu_to_le32(timestamp),
+		.width = sys_cpu_to_le16(frame_width),
+		.height = sys_cpu_to_le16(frame_height),
+		.payload_len = sys_cpu_to_le32(tx->len),
+		.payload_crc = sys_cpu_to_le32(crc32_ieee(tx->payload, tx->len)),
+	};
+
+	hdr->hdr_crc = sys_cpu_to_le32(crc32_ieee((const uint8_t *)hdr,
+						  offsetof(struct frame_header, hdr_crc)));
+}
+
+/*
+ * Prepare a checked out camera frame for sending in a free slot, compressing
+ * it first when JPEG is enabled; that runs on the encoder thread. Returns
+ * false if the frame had to be dropped.
+ */
+static bool tx_frame_prepare(struct tx_frame *tx, struct frame *frame)
+{
+	tx->seq = frame->seq;
+
+#ifdef CONFIG_VIDEO_JPEG
+	uint8_t *arena = jpeg_arena[tx - tx_frames];
+	int ret = jpeg_encode_rgb565(frame->vbuf->buffer, frame_width, frame_height,
+				     CONFIG_VIDEO_JPEG_QUALITY, arena, sizeof(jpeg_arena[0]));
+	uint32_t timestamp = frame->timestamp;
+	uint8_t flags = frame->flags;
+
+	// The camera can have the buffer back before the slow part, the send
+	frame_ring_put(frame);
+	tx->frame = NULL;
+
+	if (ret < 0) {
+		printk("JPEG: frame %u does not fit in %zu bytes\n", tx->seq, sizeof(jpeg_arena[0]));
+		return false;
+	}
+
+	tx->payload = arena;
+	tx->len = ret;
+	tx_frame_header(tx, timestamp, FRAME_PIXFMT_JPEG, flags);
+#else
+	// Buffer goes back to the camera once the last client has sent it
+	tx->frame = frame;
+	tx->payload = frame->vbuf->buffer;
+	tx->len = frame->vbuf->bytesused;
+	tx_frame_header(tx, frame->timestamp, FRAME_PIXFMT_RGB565, frame->flags);
+#endif
+
+	return true;
+}
+
+static void tx_frame_release(struct tx_frame *tx)
+{
+	if (--tx->users > 0) {
+		return;
+	}
+
+	if (tx->frame != NULL) {
+		frame_ring_put(tx->frame);
+		tx->frame = NULL;
+	}
+
+#ifdef CONFIG_VIDEO_JPEG
+	// The slot's arena can take the next encoded frame
+	if (tx >= tx_frames && tx < &tx_frames[TX_SLOTS]) {
+		k_msgq_put(&tx_free_q, &tx, K_NO_WAIT);
+	}
+#endif
+}
+
+/*
+ * Start streaming a prepared frame to an idle client
+ */
+static void client_attach(struct client *c, struct tx_frame *tx)
+{
+	// Frames skipped since the last one sent are dropped for this client
+	if (c->last_seq && tx->seq > c->last_seq + 1) {
+		c->dropped += tx->seq - c->last_seq - 1;
+	}
+
+	c->tx = tx;
+	c->sent = 0;
+	c->last_seq = tx->seq;
+	tx->users++;
+}
+
+/*
+ * Decide whether a new frame is worth sending. With motion suppression
+ * unchanged frames are skipped, apart from a periodic keepalive.
+ */
+static bool frame_wanted(const struct frame *frame)
+{
+#ifdef CONFIG_VIDEO_MOTION_SUPPRESS
+	static uint32_t last_sent;
+
+	if (!(frame->flags & (FRAME_FLAG_CHANGED | FRAME_FLAG_PRESENCE)) &&
+	    k_uptime_get_32() - last_sent < CONFIG_VIDEO_MOTION_KEEPALIVE_MS) {
+		return false;
+	}
+	last_sent = k_uptime_get_32();
+#endif
+
+	return true;
+}
+
+#ifdef CONFIG_VIDEO_GESTURE
+/*
+ * Hand the newest gesture result to idle clients that have not had it yet.
+ * Results are a few bytes, so they go out ahead of any frame.
  */
-static ssize_t sendall(int sock, const void *buf, size_t len)
+static void assign_gesture(void)
 {
-	zsock_send(sock, "READY", 5, 0);
-	while (len) {
-		ssize_t out_len = zsock_send(sock, buf, len, 0);
-		if (out_len < 0) {
-			return out_len;
+	k_spinlock_key_t key;
+	uint32_t timestamp = 0;
+	bool fresh;
+
+	if (gesture_tx.users == 0) {
+		key = k_spin_lock(&gesture_lock);
+		fresh = gesture_seq != gesture_tx.seq;
+		if (fresh) {
+			gesture_payload = gesture_latest;
+			gesture_tx.seq = gesture_seq;
+			timestamp = gesture_timestamp;
+		}
+		k_spin_unlock(&gesture_lock, key);
+
+		if (fresh) {
+			gesture_tx.payload = (const uint8_t *)&gesture_payload;
+			gesture_tx.len = sizeof(gesture_payload);
+			tx_frame_header(&gesture_tx, timestamp, FRAME_PIXFMT_GESTURE, 0);
+		}
+	}
+
+	if (gesture_tx.seq == 0) {
+		return;
+	}
+
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		struct client *c = &clients[i];
+
+		if (c->sock < 0 || c->tx != NULL || c->last_gesture == gesture_tx.seq) {
+			continue;
+		}
+		c->tx = &gesture_tx;
+		c->sent = 0;
+		c->last_gesture = gesture_tx.seq;
+		gesture_tx.users++;
+	}
+}
+#endif
+
+/*
+ * Give every idle client the newest frame. Without JPEG a new one is pulled
+ * from the ring if a client is waiting and the server has a slot free to
+ * hold it; with JPEG the encoder thread is asked for one instead.
+ */
+static void assign_frames(void)
+{
+	struct tx_frame *newest = NULL;
+	bool idle = false, waiting = false;
+
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		if (clients[i].sock >= 0 && clients[i].tx == NULL) {
+			idle = true;
+		}
+	}
+	// Set before looking for new frames, so one that arrives meanwhile
+	// still wakes the next poll
+	atomic_set(&wake_wanted, idle);
+	if (!idle) {
+		return;
+	}
+
+#ifdef CONFIG_VIDEO_GESTURE
+	assign_gesture();
+#endif
+#ifdef CONFIG_VIDEO_GESTURE_ONLY
+	// Idle clients are only ever waiting for the next result
+	return;
+#endif
+
+	for (int i = 0; i < TX_SLOTS; i++) {
+		struct tx_frame *tx = &tx_frames[i];
+
+		if (tx->users > 0 && (newest == NULL || tx->seq > newest->seq)) {
+			newest = tx;
+		}
+	}
+
+#ifdef CONFIG_VIDEO_JPEG
+	// Encoded frame no client has taken yet, if any
+	static struct tx_frame *ready;
+	struct tx_frame *tx;
+
+	// Only the newest encoded frame is worth sending
+	while (k_msgq_get(&tx_ready_q, &tx, K_NO_WAIT) == 0) {
+		if (ready != NULL) {
+			k_msgq_put(&tx_free_q, &ready, K_NO_WAIT);
+		}
+		ready = tx;
+	}
+	if (ready != NULL) {
+		newest = ready;
+	}
+#else
+	// Sequence number of the last frame taken from the ring
+	static uint32_t ring_seq;
+	struct tx_frame *free_tx = NULL;
+	struct frame *frame;
+
+	for (int i = 0; i < TX_SLOTS; i++) {
+		if (tx_frames[i].users == 0) {
+			free_tx = &tx_frames[i];
+		}
+	}
+
+	if (free_tx != NULL) {
+		frame = frame_ring_get(ring_seq, K_NO_WAIT);
+		if (frame != NULL) {
+			ring_seq = frame->seq;
+			if (!frame_wanted(frame)) {
+				frame_ring_put(frame);
+			} else if (tx_frame_prepare(free_tx, frame)) {
+				newest = free_tx;
+			}
+		}
+	}
+#endif
+
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		struct client *c = &clients[i];
+
+		if (c->sock < 0 || c->tx != NULL) {
+			continue;
 		}
-		buf = (const char *)buf + out_len;
-		len -= out_len;
+		if (newest != NULL && newest->seq > c->last_seq) {
+			client_attach(c, newest);
+		} else {
+			waiting = true;
+		}
+	}
+
+#ifdef CONFIG_VIDEO_JPEG
+	// Once in use the slot is freed by its last client
+	if (ready != NULL && ready->users > 0) {
+		ready = NULL;
+	}
+	if (waiting) {
+		k_sem_give(&encode_request);
+	}
+#else
+	ARG_UNUSED(waiting);
+#endif
+}
+
+static void client_close(struct client *c)
+{
+	char ip[NET_IPV4_ADDR_LEN];
+
+	net_addr_ntop(AF_INET, &c->addr.sin_addr, ip, sizeof(ip));
+	printk("TCP: Client %s disconnected\n", ip);
+
+	if (c->tx != NULL) {
+		tx_frame_release(c->tx);
+		c->tx = NULL;
+	}
+	zsock_close(c->sock);
+	c->sock = -1;
+}
+
+/*
+ * Send as much of the client's current frame as the socket will take
+ * without blocking. Returns a negative errno if the client has gone.
+ */
+static int client_send(struct client *c)
+{
+	struct tx_frame *tx = c->tx;
+	size_t hdr_len = sizeof(tx->hdr);
+	struct iovec iov[2];
+	struct msghdr msg = {
+		.msg_iov = iov,
+	};
+	ssize_t out_len;
+
+	// Resume after whatever part of the header and payload already went out
+	if (c->sent < hdr_len) {
+		iov[0].iov_base = (uint8_t *)&tx->hdr + c->sent;
+		iov[0].iov_len = hdr_len - c->sent;
+		iov[1].iov_base = (void *)tx->payload;
+		iov[1].iov_len = tx->len;
+		msg.msg_iovlen = 2;
+	} else {
+		iov[0].iov_base = (void *)(tx->payload + (c->sent - hdr_len));
+		iov[0].iov_len = tx->len - (c->sent - hdr_len);
+		msg.msg_iovlen = 1;
+	}
+
+	out_len = zsock_sendmsg(c->sock, &msg, ZSOCK_MSG_DONTWAIT);
+	if (out_len < 0) {
+		return errno == EAGAIN ? 0 : -errno;
+	}
+
+	c->sent += out_len;
+	c->bytes += out_len;
+
+	if (c->sent == hdr_len + tx->len) {
+		c->frames++;
+		c->tx = NULL;
+		tx_frame_release(tx);
 	}
 
 	return 0;
 }
 
+static void client_accept(int sock)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	char ip[NET_IPV4_ADDR_LEN];
+	int fd;
+
+	fd = zsock_accept(sock, (struct sockaddr *)&addr, &addr_len);
+	if (fd < 0) {
+		printk("Failed to accept: %d\n", errno);
+		return;
+	}
+
+	net_addr_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		struct client *c = &clients[i];
+
+		if (c->sock < 0) {
+			*c = (struct client) {
+				.sock = fd,
+				.addr = addr,
+			};
+			printk("TCP: Accepted connection from %s\n", ip);
+			return;
+		}
+	}
+
+	printk("TCP: Rejecting %s, already serving %d clients\n", ip, MAX_CLIENTS);
+	zsock_close(fd);
+}
+
+static void print_client_stats(uint32_t elapsed_ms)
+{
+	char ip[NET_IPV4_ADDR_LEN];
+
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		struct client *c = &clients[i];
+
+		if (c->sock < 0) {
+			continue;
+		}
+
+		net_addr_ntop(AF_INET, &c->addr.sin_addr, ip, sizeof(ip));
+		printk("TCP: %s %u.%u fps, %u kB/s, %u dropped\n", ip,
+		       c->frames * 1000 / elapsed_ms, (c->frames * 10000 / elapsed_ms) % 10,
+		       c->bytes / elapsed_ms, c->dropped);
+
+		c->frames = 0;
+		c->dropped = 0;
+		c->bytes = 0;
+	}
+}
+
+#ifdef CONFIG_VIDEO_GESTURE
+/*
+ * Classify a frame if the last classification was long enough ago, and
+ * hand the result to the network thread
+ */
+static void gesture_run(const struct frame *frame, uint16_t width, uint16_t height)
+{
+	static uint32_t last_run;
+	struct gesture_result res;
+	k_spinlock_key_t key;
+
+	if (k_uptime_get_32() - last_run < CONFIG_VIDEO_GESTURE_INTERVAL_MS) {
+		return;
+	}
+#ifdef CONFIG_VIDEO_MOTION_GATE
+	// An unchanged scene holds the same gesture as last time
+	if (!(frame->flags & (FRAME_FLAG_CHANGED | FRAME_FLAG_PRESENCE))) {
+		return;
+	}
+#endif
+	last_run = k_uptime_get_32();
+
+	if (gesture_classify(frame->vbuf->buffer, width, height, &res)) {
+		return;
+	}
+
+	key = k_spin_lock(&gesture_lock);
+	gesture_latest = (struct frame_gesture) {
+		.label = res.label,
+		.confidence = res.confidence,
+		.infer_ms = sys_cpu_to_le16(res.infer_ms),
+	};
+	gesture_seq = frame->seq;
+	gesture_timestamp = frame->timestamp;
+	k_spin_unlock(&gesture_lock, key);
+
+	network_wake();
+}
+#endif
+
 /*
  * Set up the camera and LCD screen
  * Continually stream camera data to LCD screen
- * Populate frame_copy and frame_size when polling signal raised
+ * Publish every frame to the frame ring for the network thread
+ * Optionally classify gestures on the device
  */
 void camera_thread(void)
 {
@@ -168,12 +664,8 @@ void camera_thread(void)
 	struct video_frmival_enum fie;
 	enum video_buf_type type = VIDEO_BUF_TYPE_OUTPUT;
 	size_t bsize;
-
-	// Initialise polling signal
-	struct k_poll_event events[1] = {
-		K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &tx_signal)
-	};
-	int signaled, result;
+	struct frame *frame;
+	uint8_t flags;
 
 	// Initialise the camera 
 	const struct device *const video = DEVICE_DT_GET(DT_CHOSEN(zephyr_camera));
@@ -213,6 +705,8 @@ void camera_thread(void)
 		printk("Unable to set format\n");
 		return;
 	}
+	frame_width = fmt.width;
+	frame_height = fmt.height;
 
 	// Frame rate
 	if (!video_get_frmival(video, &frmival)) {
@@ -268,6 +762,14 @@ void camera_thread(void)
 		buffers[i]->type = type;
 		video_enqueue(video, buffers[i]);
 	}
+	frame_ring_init(video, buffers, ARRAY_SIZE(buffers));
+
+#ifdef CONFIG_VIDEO_GESTURE
+	// Carry on streaming without results if the model does not load
+	if (gesture_init()) {
+		printk("Gesture: on-device classification disabled\n");
+	}
+#endif
 
 	// Start the video stream
 	if (video_stream_start(video, type)) {
@@ -280,46 +782,102 @@ void camera_thread(void)
 
 	while (1) {
 		// Dequeue image buffers
-		k_poll(events, 1, K_NO_WAIT);
-		k_poll_signal_check(&tx_signal, &signaled, &result);
 		ret = video_dequeue(video, &vbuf, K_SECONDS(20));
 		if (ret) {
 			printk("Unable to dequeue video buf\n");
 			return;
 		}
 
-		// Re-populate frame_copy and frame_size when polling signal raised
-		if (signaled && (result == 0x01)) {
-			k_poll_signal_reset(&tx_signal);
-		 	events[0].state = K_POLL_STATE_NOT_READY;
-			// memcpy(frame_copy, vbuf->buffer, vbuf->bytesused);
-			// frame_size = vbuf->bytesused;
-			frame_copy = vbuf->buffer;
-			frame_size = vbuf->bytesused;
+		// Tag frames where the scene changed or someone is in range
+		flags = FRAME_FLAG_CHANGED;
+#ifdef CONFIG_VIDEO_MOTION_GATE
+		flags = motion_detect(vbuf->buffer, fmt.width, fmt.height) ? FRAME_FLAG_CHANGED : 0;
+		if (motion_presence_active()) {
+			flags |= FRAME_FLAG_PRESENCE;
+		}
+#endif
+
+		// Hand the frame to the network thread, keeping a reference for the LCD
+		frame = frame_ring_publish(vbuf, flags);
+		if (frame == NULL) {
+			continue;
 		}
+#ifndef CONFIG_VIDEO_JPEG
+		// With JPEG the encoder thread takes it and wakes the network thread
+		network_wake();
+#endif
 
 		// Display image on LCD
 		video_display_frame(display_dev, vbuf, fmt);
 
-		// Enqeue image buffers
-		ret = video_enqueue(video, vbuf);
-		if (ret) {
-			printk("Unable to requeue video buf\n");
-			return;
+#ifdef CONFIG_VIDEO_GESTURE
+		gesture_run(frame, fmt.width, fmt.height);
+#endif
+
+		// Buffer is re-enqueued once the network thread has also released it
+		frame_ring_put(frame);
+	}
+}
+
+#ifdef CONFIG_VIDEO_JPEG
+/*
+ * Compress frames for the network thread, so a slow encode never holds up
+ * clients that are still being sent an earlier frame. A frame is encoded
+ * when the network thread asks for one, into a slot it has freed.
+ */
+void encoder_thread(void)
+{
+	// Sequence number of the last frame taken from the ring
+	uint32_t ring_seq = 0;
+	struct tx_frame *tx;
+	struct frame *frame;
+
+	for (int i = 0; i < TX_SLOTS; i++) {
+		tx = &tx_frames[i];
+		k_msgq_put(&tx_free_q, &tx, K_NO_WAIT);
+	}
+
+	while (1) {
+		k_sem_take(&encode_request, K_FOREVER);
+		k_msgq_get(&tx_free_q, &tx, K_FOREVER);
+
+		while (1) {
+			frame = frame_ring_get(ring_seq, K_FOREVER);
+			ring_seq = frame->seq;
+			if (frame_wanted(frame)) {
+				break;
+			}
+			frame_ring_put(frame);
+		}
+
+		if (tx_frame_prepare(tx, frame)) {
+			k_msgq_put(&tx_ready_q, &tx, K_NO_WAIT);
+			network_wake();
+		} else {
+			k_msgq_put(&tx_free_q, &tx, K_NO_WAIT);
 		}
 	}
 }
+#endif
 
 /*
  * Set up the TCP socket
- * Accept client connections
- * Stream image data to client 
+ * Accept up to MAX_CLIENTS client connections
+ * Stream the newest frame to each client as fast as it can take them
  */
 void network_thread(void)
 {
-	static struct sockaddr_in addr, client_addr;
-	socklen_t client_addr_len = sizeof(client_addr);
-	static int ret, sock, client;
+	static struct sockaddr_in addr;
+	static struct zsock_pollfd fds[2 + MAX_CLIENTS];
+	static struct client *fd_client[2 + MAX_CLIENTS];
+	static int ret, sock;
+	uint32_t stats_start;
+	zvfs_eventfd_t wakes;
+	int nfds;
+
+	for (int i = 0; i < MAX_CLIENTS; i++) {
+		clients[i].sock = -1;
+	}
 
 	// Prepare network
 	(void)memset(&addr, 0, sizeof(addr));
@@ -347,37 +905,120 @@ void network_thread(void)
 		return;
 	}
 
+	wake_fd = zvfs_eventfd(0, ZVFS_EFD_NONBLOCK);
+	if (wake_fd < 0) {
+		printk("Failed to create wake eventfd: %d\n", errno);
+		zsock_close(sock);
+		return;
+	}
+
+	printk("TCP: Waiting for clients...\n");
+	stats_start = k_uptime_get_32();
+
 	while (1) {
-		// Accept client connections 
-		printk("TCP: Waiting for client...\n");
+		// Hand out new frames, then wait for sockets that can make progress
+		// or a new frame
+		assign_frames();
 
-		client = zsock_accept(sock, (struct sockaddr *)&client_addr, &client_addr_len);
-		if (client < 0) {
-			printk("Failed to accept: %d\n", errno);
-			return;
+		fds[0].fd = sock;
+		fds[0].events = ZSOCK_POLLIN;
+		fds[1].fd = wake_fd;
+		fds[1].events = ZSOCK_POLLIN;
+		nfds = 2;
+		for (int i = 0; i < MAX_CLIENTS; i++) {
+			if (clients[i].sock < 0) {
+				continue;
+			}
+			// Idle clients are polled for input only to notice them hanging up
+			fds[nfds].fd = clients[i].sock;
+			fds[nfds].events = clients[i].tx ? ZSOCK_POLLOUT : ZSOCK_POLLIN;
+			fd_client[nfds] = &clients[i];
+			nfds++;
 		}
 
-		printk("TCP: Accepted connection\n");
+		ret = zsock_poll(fds, nfds, STATS_INTERVAL_MS);
+		if (ret < 0) {
+			printk("TCP: poll failed: %d\n", errno);
+			k_msleep(POLL_RETRY_MS);
+			continue;
+		}
 
-		while (1) {
-			// Send image data to client
-			ret = sendall(client, frame_copy, frame_size);
-			if (ret && ret != -EAGAIN) {
-				printk("\nTCP: Client disconnected %d\n", ret);
-				zsock_close(client);
-				break;
+		if (fds[1].revents & ZSOCK_POLLIN) {
+			zvfs_eventfd_read(wake_fd, &wakes);
+		}
+
+		for (int i = 2; i < nfds; i++) {
+			struct client *c = fd_client[i];
+			short revents = fds[i].revents;
+
+			if (revents & (ZSOCK_POLLERR | ZSOCK_POLLHUP | ZSOCK_POLLNVAL)) {
+				client_close(c);
+			} else if (revents & ZSOCK_POLLIN) {
+				uint8_t discard[16];
+
+				// Clients never send anything, so readable means closed
+				if (zsock_recv(c->sock, discard, sizeof(discard), ZSOCK_MSG_DONTWAIT) <= 0) {
+					client_close(c);
+				}
+			} else if (revents & ZSOCK_POLLOUT) {
+				ret = client_send(c);
+				if (ret) {
+					client_close(c);
+				}
 			}
-			// Re-populate frame_copy and frame size in camera thread
-			k_poll_signal_raise(&tx_signal, 0x01);
-		} 
+		}
+
+		if (fds[0].revents & ZSOCK_POLLIN) {
+			client_accept(sock);
+		}
+
+		if (k_uptime_get_32() - stats_start >= STATS_INTERVAL_MS) {
+			print_client_stats(k_uptime_get_32() - stats_start);
+			stats_start = k_uptime_get_32();
+		}
 	}
 }
 
-int main(void) {
-	// Initialise polling signal for data transmission
-	k_poll_signal_init(&tx_signal);
-	k_poll_signal_raise(&tx_signal, 0x01);
+#ifdef CONFIG_VIDEO_MOTION_GATE
+/*
+ * Receive presence readings (distance in cm as text) from the Disco_L475
+ * ultrasonic node and open the motion gate when someone is in range
+ */
+void presence_thread(void)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(CONFIG_VIDEO_MOTION_PRESENCE_PORT),
+	};
+	char buf[16];
+	int sock, len;
 
+	sock = zsock_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		printk("Failed to create UDP socket: %d\n", errno);
+		return;
+	}
+
+	if (zsock_bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		printk("Failed to bind UDP socket: %d\n", errno);
+		zsock_close(sock);
+		return;
+	}
+
+	while (1) {
+		len = zsock_recv(sock, buf, sizeof(buf) - 1, 0);
+		if (len <= 0) {
+			continue;
+		}
+		buf[len] = '\0';
+		motion_presence(strtoul(buf, NULL, 10));
+	}
+}
+
+K_THREAD_DEFINE(presence_id, PRESENCE_STACKSIZE, presence_thread, NULL, NULL, NULL, 5, 0, 0);
+#endif
+
+int main(void) {
 	// Initialise WiFi connection 
 	net_mgmt_init_event_callback(&cb, wifi_event_handler, NET_EVENT_WIFI_MASK);
 	net_mgmt_add_event_callback(&cb);
@@ -386,5 +1027,9 @@ int main(void) {
 }
 
 // Define camera and network (TCP) threads
- K_THREAD_DEFINE(camera_id, STACKSIZE, camera_thread, NULL, NULL, NULL, 1, 0, 0);
- K_THREAD_DEFINE(network_id, STACKSIZE, network_thread, NULL, NULL, NULL, 3, 0, 0);
\ No newline at end of file
+ K_THREAD_DEFINE(camera_id, CAMERA_STACKSIZE, camera_thread, NULL, NULL, NULL, 1, 0, 0);
+ K_THREAD_DEFINE(network_id, STACKSIZE, network_thread, NULL, NULL, NULL, 3, 0, 0);
+#ifdef CONFIG_VIDEO_JPEG
+// Below the network thread, so sending carries on while a frame is encoded
+ K_THREAD_DEFINE(encoder_id, STACKSIZE, encoder_thread, NULL, NULL, NULL, 4, 0, 0);
+#endif
\ No newline at end of file
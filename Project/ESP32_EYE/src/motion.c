@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include "motion.h"
+
+#define BLOCK CONFIG_VIDEO_MOTION_BLOCK_SIZE
+#define MAX_BLOCKS_X DIV_ROUND_UP(CONFIG_VIDEO_FRAME_WIDTH, BLOCK)
+#define MAX_BLOCKS_Y DIV_ROUND_UP(CONFIG_VIDEO_FRAME_HEIGHT, BLOCK)
+
+// Luminance of each block in the region of interest, for the reference
+// frame and the frame being checked
+static uint8_t reference[MAX_BLOCKS_Y * MAX_BLOCKS_X];
+static uint8_t current[MAX_BLOCKS_Y * MAX_BLOCKS_X];
+static bool have_reference;
+
+// Uptime (ms) until which a presence reading keeps frames flowing
+static atomic_t presence_until;
+
+/*
+ * Integer BT.601 luma of a big endian RGB565 pixel
+ */
+static inline uint8_t luma(const uint8_t *p)
+{
+	uint16_t v = (p[0] << 8) | p[1];
+	uint32_t r = (v >> 8) & 0xF8;
+	uint32_t g = (v >> 3) & 0xFC;
+	uint32_t b = (v << 3) & 0xF8;
+
+	return (77 * r + 150 * g + 29 * b) >> 8;
+}
+
+/*
+ * Average of the four corner pixels of a block, a cheap downsample that
+ * keeps sensor noise from tripping the detector
+ */
+static uint8_t block_luma(const uint8_t *rgb565, uint16_t width, int x0, int y0, int x1, int y1)
+{
+	const uint8_t *row0 = &rgb565[y0 * width * 2];
+	const uint8_t *row1 = &rgb565[y1 * width * 2];
+
+	return (luma(&row0[x0 * 2]) + luma(&row0[x1 * 2]) +
+		luma(&row1[x0 * 2]) + luma(&row1[x1 * 2])) / 4;
+}
+
+bool motion_detect(const uint8_t *rgb565, uint16_t width, uint16_t height)
+{
+	int roi_x = MIN(CONFIG_VIDEO_MOTION_ROI_X, width - 1);
+	int roi_y = MIN(CONFIG_VIDEO_MOTION_ROI_Y, height - 1);
+	int roi_w = CONFIG_VIDEO_MOTION_ROI_WIDTH ? CONFIG_VIDEO_MOTION_ROI_WIDTH : width;
+	int roi_h = CONFIG_VIDEO_MOTION_ROI_HEIGHT ? CONFIG_VIDEO_MOTION_ROI_HEIGHT : height;
+	int blocks = 0, changed = 0;
+	bool moved;
+
+	roi_w = MIN(roi_w, width - roi_x);
+	roi_h = MIN(roi_h, height - roi_y);
+
+	for (int y = roi_y; y < roi_y + roi_h; y += BLOCK) {
+		int y1 = MIN(y + BLOCK, roi_y + roi_h) - 1;
+
+		for (int x = roi_x; x < roi_x + roi_w; x += BLOCK) {
+			int x1 = MIN(x + BLOCK, roi_x + roi_w) - 1;
+			uint8_t lum;
+
+			if (blocks >= ARRAY_SIZE(current)) {
+				break;
+			}
+
+			lum = block_luma(rgb565, width, x, y, x1, y1);
+			if (abs(lum - reference[blocks]) > CONFIG_VIDEO_MOTION_PIXEL_THRESHOLD) {
+				changed++;
+			}
+			current[blocks++] = lum;
+		}
+	}
+
+	// Changed if enough of the region moved (threshold is in tenths of a percent)
+	moved = !have_reference || changed * 1000 >= blocks * CONFIG_VIDEO_MOTION_AREA_PERMILLE;
+
+	// Slow drift accumulates against a fixed reference until it counts as a change
+	if (moved) {
+		memcpy(reference, current, blocks);
+		have_reference = true;
+	}
+
+	return moved;
+}
+
+void motion_presence(uint32_t distance_cm)
+{
+	if (distance_cm > 0 && distance_cm <= CONFIG_VIDEO_MOTION_PRESENCE_CM) {
+		atomic_set(&presence_until, k_uptime_get_32() + CONFIG_VIDEO_MOTION_PRESENCE_HOLD_MS);
+	}
+}
+
+bool motion_presence_active(void)
+{
+	// Signed difference so the comparison survives uptime wrapping
+	return (int32_t)((uint32_t)atomic_get(&presence_until) - k_uptime_get_32()) > 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * Cheap change detector used to gate frame transmission
+ *
+ * Each frame is reduced to a grid of block luminance values inside the
+ * configured region of interest and compared with a reference grid. A frame
+ * counts as changed when enough blocks differ from the reference by more
+ * than the pixel threshold; the reference then moves to the new frame.
+ */
+
+#ifndef MOTION_H_
+#define MOTION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Compare a big endian RGB565 frame against the reference.
+ * Returns true if the region of interest has changed.
+ */
+bool motion_detect(const uint8_t *rgb565, uint16_t width, uint16_t height);
+
+/*
+ * Report a presence reading (e.g. the Disco_L475 ultrasonic distance).
+ * Frames are treated as wanted for a while after something comes in range.
+ */
+void motion_presence(uint32_t distance_cm);
+
+/*
+ * True while a recent presence reading is still holding the gate open
+ */
+bool motion_presence_active(void);
+
+#endif /* MOTION_H_ */
@@ -0,0 +1,84 @@
+import argparse
+import os
+import struct
+import sys
+
+import numpy as np
+
+# The PC pipeline is the reference for what the model should see
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                '..', '..', 'gesture_recognition'))
+from prep_img import Preprocessor
+
+################################################
+# Golden data for tests/gesture_host.c, written
+# by the PC pipeline: int8 model inputs from
+# RGB565 frames, and the label and confidence
+# for int8 model outputs. Little endian records:
+#   'I' u16 width, u16 height, u16 in_w,
+#       u16 in_h, f32 scale, i32 zero point,
+#       the big endian RGB565 frame, then the
+#       in_h x in_w x 3 int8 input
+#   'O' u8 classes, f32 scale, i32 zero point,
+#       the int8 scores, u8 label, u8 percent
+################################################
+INPUT_RECORD = struct.Struct('<cHHHHfi')
+OUTPUT_RECORD = struct.Struct('<cBfi')
+
+# (frame size, model input size, input scale, input zero point); the first
+# is the camera and the quantiser's usual input parameters
+INPUT_CASES = [
+    ((240, 240), (224, 224), 1.0 / 255.0, -128),
+    ((240, 240), (96, 96), 1.0 / 128.0, 0),
+    ((37, 23), (50, 40), 1.0 / 255.0, -128),
+]
+
+# Softmax output parameters as the converter exports them
+OUTPUT_SCALE = 1.0 / 256.0
+OUTPUT_ZERO_POINT = -128
+CLASSES = 7
+
+def quantise(x, scale, zero_point):
+    # Round half away from zero, as TFLite does; x is never negative
+    q = np.floor(x / np.float32(scale) + np.float32(0.5)).astype(np.int32) + zero_point
+    return np.clip(q, -128, 127).astype(np.int8)
+
+def input_record(rng, size, in_size, scale, zero_point):
+    width, height = size
+    frame = rng.integers(0, 65536, width * height, dtype=np.uint16).astype('>u2').tobytes()
+    prep = Preprocessor(target_size=in_size)
+    prep.load_rgb565(0, frame, width, height)
+    expected = quantise(prep.batch[0], scale, zero_point)
+    return (INPUT_RECORD.pack(b'I', width, height, in_size[0], in_size[1], scale, zero_point)
+            + frame + expected.tobytes())
+
+def output_record(scores):
+    probs = (scores.astype(np.float32) - OUTPUT_ZERO_POINT) * np.float32(OUTPUT_SCALE)
+    label = int(np.argmax(probs))
+    percent = int(np.clip(np.floor(probs[label] * 100 + 0.5), 0, 100))
+    return (OUTPUT_RECORD.pack(b'O', len(scores), OUTPUT_SCALE, OUTPUT_ZERO_POINT)
+            + scores.astype(np.int8).tobytes() + bytes([label, percent]))
+
+def main():
+    parser = argparse.ArgumentParser(description="Write golden data for the gesture host test")
+    parser.add_argument('output')
+    args = parser.parse_args()
+
+    rng = np.random.default_rng(0)
+    records = [input_record(rng, *case) for case in INPUT_CASES]
+
+    scores = [rng.integers(-128, 128, CLASSES) for _ in range(32)]
+    scores += [
+        np.full(CLASSES, -128),                         # nothing scores
+        np.array([-128, 127, -128, -128, -128, -128, -128]),
+        np.array([0, 5, 5, -3, 5, 0, 0]),               # tie goes to the first
+        np.array([-128, -128, -128, -128, -128, -128, 127]),
+    ]
+    records += [output_record(s) for s in scores]
+
+    with open(args.output, 'wb') as f:
+        f.write(b''.join(records))
+    print(f"Wrote {len(INPUT_CASES)} input and {len(scores)} output cases to {args.output}")
+
+if __name__ == "__main__":
+    main()
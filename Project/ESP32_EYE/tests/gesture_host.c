@@ -0,0 +1,181 @@
+/*
+ * Golden output test for on-device gesture classification
+ *
+ * Runs the device's model input and output handling (gesture_prep.c) over
+ * golden data written by the PC pipeline (gesture_golden.py): the int8
+ * input tensor built from RGB565 frames must match the PC's quantised
+ * batch byte for byte, and the label and confidence read from int8 scores
+ * must match the PC's reading of the same scores. Together with the
+ * interpreter, which is TensorFlow Lite Micro's own, this is everything
+ * that decides whether the device and the PC classify a frame alike.
+ *
+ *   gesture_host GOLDEN
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gesture_prep.h"
+
+static int failures;
+
+#define CHECK(cond)                                                          \
+	do {                                                                 \
+		if (!(cond)) {                                               \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);  \
+			failures++;                                          \
+		}                                                            \
+	} while (0)
+
+static const uint8_t *pos, *end;
+
+static int take(void *out, size_t len)
+{
+	if ((size_t)(end - pos) < len) {
+		return -1;
+	}
+	memcpy(out, pos, len);
+	pos += len;
+	return 0;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static float get_float(const uint8_t *p)
+{
+	uint32_t bits = get32(p);
+	float f;
+
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static int check_input(void)
+{
+	uint8_t hdr[16];
+	uint16_t width, height;
+	int in_w, in_h, zero_point;
+	size_t frame_len, input_len;
+	uint8_t *frame;
+	int8_t *expected, *actual;
+	int8_t table[256];
+	float scale;
+	size_t wrong = 0;
+
+	if (take(hdr, sizeof(hdr))) {
+		return -1;
+	}
+	width = get16(&hdr[0]);
+	height = get16(&hdr[2]);
+	in_w = get16(&hdr[4]);
+	in_h = get16(&hdr[6]);
+	scale = get_float(&hdr[8]);
+	zero_point = (int32_t)get32(&hdr[12]);
+
+	frame_len = (size_t)width * height * 2;
+	input_len = (size_t)in_w * in_h * 3;
+	frame = malloc(frame_len);
+	expected = malloc(input_len);
+	actual = malloc(input_len);
+	if (take(frame, frame_len) || take(expected, input_len)) {
+		free(frame);
+		free(expected);
+		free(actual);
+		return -1;
+	}
+
+	gesture_quant_table(table, scale, zero_point);
+	gesture_fill_input(table, frame, width, height, actual, in_w, in_h);
+	for (size_t i = 0; i < input_len; i++) {
+		if (actual[i] != expected[i]) {
+			if (wrong++ == 0) {
+				printf("first difference at pixel %zu channel %zu: %d, PC %d\n",
+				       i / 3, i % 3, actual[i], expected[i]);
+			}
+		}
+	}
+	printf("%ux%u to %dx%d, scale %g zero point %d: %zu of %zu values differ\n", width,
+	       height, in_w, in_h, scale, zero_point, wrong, input_len);
+	CHECK(wrong == 0);
+
+	free(frame);
+	free(expected);
+	free(actual);
+	return 0;
+}
+
+static int check_output(int *cases)
+{
+	uint8_t hdr[9];
+	int8_t scores[256];
+	uint8_t golden[2];
+	uint8_t label, confidence;
+	int classes;
+
+	if (take(hdr, sizeof(hdr))) {
+		return -1;
+	}
+	classes = hdr[0];
+	if (take(scores, classes) || take(golden, sizeof(golden))) {
+		return -1;
+	}
+
+	gesture_pick(scores, classes, get_float(&hdr[1]), (int32_t)get32(&hdr[5]), &label,
+		     &confidence);
+	if (label != golden[0] || confidence != golden[1]) {
+		printf("case %d: label %u at %u%%, PC %u at %u%%\n", *cases, label, confidence,
+		       golden[0], golden[1]);
+	}
+	CHECK(label == golden[0]);
+	CHECK(confidence == golden[1]);
+	(*cases)++;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+	static uint8_t data[1 << 20];
+	size_t len;
+	int inputs = 0, outputs = 0;
+
+	if (argc != 2 || (f = fopen(argv[1], "rb")) == NULL) {
+		printf("usage: gesture_host GOLDEN (written by gesture_golden.py)\n");
+		return EXIT_FAILURE;
+	}
+	len = fread(data, 1, sizeof(data), f);
+	fclose(f);
+
+	pos = data;
+	end = data + len;
+	while (pos < end) {
+		char type = (char)*pos++;
+		int ret;
+
+		if (type == 'I') {
+			ret = check_input();
+			inputs++;
+		} else if (type == 'O') {
+			ret = check_output(&outputs);
+		} else {
+			ret = -1;
+		}
+		if (ret) {
+			printf("FAIL: golden data corrupt at byte %zu\n", (size_t)(pos - data));
+			return EXIT_FAILURE;
+		}
+	}
+
+	CHECK(inputs > 0 && outputs > 0);
+	printf("%d input and %d output cases, %d failures\n", inputs, outputs, failures);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
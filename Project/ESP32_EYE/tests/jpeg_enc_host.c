@@ -0,0 +1,246 @@
+/*
+ * Host test for the JPEG encoder
+ *
+ * Encodes synthetic RGB565 frames, a camera sized one and one whose sides
+ * are not a multiple of the 16 pixel MCU, decodes them again with libjpeg
+ * as the reference decoder and checks the size and PSNR against bounds
+ * for each quality. The bounds sit just outside what libjpeg's own 4:2:0
+ * encoder gets on the same frames; the hard coloured edges cost PSNR in
+ * the subsampled chroma, so they are lower than for camera images. Also
+ * checks that a higher quality is larger and closer to the source, and
+ * that an arena too small for the image gives -ENOMEM without writing
+ * past its end.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+#include "jpeg_enc.h"
+
+#define ARENA_SIZE 65536
+
+static int failures;
+
+#define CHECK(cond)                                                          \
+	do {                                                                 \
+		if (!(cond)) {                                               \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);  \
+			failures++;                                          \
+		}                                                            \
+	} while (0)
+
+static uint8_t arena[ARENA_SIZE + 16];
+
+/*
+ * A frame with something of everything a camera sees: smooth gradients,
+ * a hard edged disc, thin bars and some fine texture. Stored big endian,
+ * as the camera delivers it.
+ */
+static uint8_t *make_frame(int width, int height)
+{
+	uint8_t *frame = malloc(width * height * 2);
+	uint32_t rng = 1;
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int dx = x - width / 2, dy = y - height / 2;
+			int r = x * 31 / width;
+			int g = y * 63 / height;
+			int b = (x + y) * 31 / (width + height);
+			uint16_t v;
+
+			if (dx * dx + dy * dy < (width * height) / 16) {
+				r = 28;
+				g = 12;
+				b = 6;
+			}
+			if (y > height * 3 / 4 && (x / 3) % 2 == 0) {
+				r = g = b = 0;
+			}
+			rng = rng * 1103515245u + 12345u;
+			g = g + (int)((rng >> 16) % 3) - 1;
+			g = g < 0 ? 0 : g > 63 ? 63 : g;
+
+			v = (uint16_t)(r << 11 | g << 5 | b);
+			frame[(y * width + x) * 2] = v >> 8;
+			frame[(y * width + x) * 2 + 1] = v & 0xFF;
+		}
+	}
+	return frame;
+}
+
+struct decode_error {
+	struct jpeg_error_mgr mgr;
+	jmp_buf jump;
+};
+
+static void decode_error_exit(j_common_ptr cinfo)
+{
+	struct decode_error *err = (struct decode_error *)cinfo->err;
+	char msg[JMSG_LENGTH_MAX];
+
+	cinfo->err->format_message(cinfo, msg);
+	printf("libjpeg: %s\n", msg);
+	longjmp(err->jump, 1);
+}
+
+/*
+ * Decode to packed RGB888 with libjpeg. Returns NULL if the data is not a
+ * JPEG of the expected size.
+ */
+static uint8_t *decode(const uint8_t *data, size_t len, int width, int height)
+{
+	struct jpeg_decompress_struct cinfo;
+	struct decode_error err;
+	uint8_t *volatile rgb = NULL;
+
+	cinfo.err = jpeg_std_error(&err.mgr);
+	err.mgr.error_exit = decode_error_exit;
+	if (setjmp(err.jump)) {
+		jpeg_destroy_decompress(&cinfo);
+		free(rgb);
+		return NULL;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, (unsigned char *)data, len);
+	jpeg_read_header(&cinfo, TRUE);
+	cinfo.out_color_space = JCS_RGB;
+	jpeg_start_decompress(&cinfo);
+	if ((int)cinfo.output_width != width || (int)cinfo.output_height != height ||
+	    cinfo.output_components != 3) {
+		printf("decoded %ux%u x%d, expected %dx%d x3\n", cinfo.output_width,
+		       cinfo.output_height, cinfo.output_components, width, height);
+		jpeg_destroy_decompress(&cinfo);
+		return NULL;
+	}
+
+	rgb = malloc(width * height * 3);
+	while (cinfo.output_scanline < cinfo.output_height) {
+		JSAMPROW row = rgb + cinfo.output_scanline * width * 3;
+
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	return rgb;
+}
+
+// PSNR of the decoded image against the source expanded to 8 bits
+static double psnr(const uint8_t *frame, const uint8_t *rgb, int width, int height)
+{
+	double sse = 0.0;
+
+	for (int i = 0; i < width * height; i++) {
+		uint16_t v = (frame[i * 2] << 8) | frame[i * 2 + 1];
+		double ref[3] = {
+			((v >> 11) & 0x1F) * 255.0 / 31.0,
+			((v >> 5) & 0x3F) * 255.0 / 63.0,
+			(v & 0x1F) * 255.0 / 31.0,
+		};
+
+		for (int c = 0; c < 3; c++) {
+			double d = ref[c] - rgb[i * 3 + c];
+
+			sse += d * d;
+		}
+	}
+	if (sse == 0.0) {
+		return INFINITY;
+	}
+	return 10.0 * log10(255.0 * 255.0 / (sse / (width * height * 3.0)));
+}
+
+/*
+ * Encode at a quality and check it decodes to at least min_psnr dB in at
+ * most max_len bytes. Returns the encoded size, or -1.
+ */
+static int check_quality(const uint8_t *frame, int width, int height, int quality,
+			 int max_len, double min_psnr, double *out_psnr)
+{
+	int len = jpeg_encode_rgb565(frame, width, height, quality, arena, ARENA_SIZE);
+	uint8_t *rgb;
+	double bpp, db;
+
+	CHECK(len > 0);
+	if (len <= 0) {
+		return -1;
+	}
+	CHECK(arena[0] == 0xFF && arena[1] == 0xD8);
+	CHECK(arena[len - 2] == 0xFF && arena[len - 1] == 0xD9);
+
+	rgb = decode(arena, len, width, height);
+	CHECK(rgb != NULL);
+	if (rgb == NULL) {
+		return -1;
+	}
+
+	bpp = len * 8.0 / (width * height);
+	db = psnr(frame, rgb, width, height);
+	printf("%dx%d q%d: %d bytes, %.2f bpp, PSNR %.1f dB\n", width, height, quality, len,
+	       bpp, db);
+	CHECK(len <= max_len);
+	CHECK(db >= min_psnr);
+
+	free(rgb);
+	*out_psnr = db;
+	return len;
+}
+
+struct bounds {
+	int max_len;
+	double min_psnr;
+};
+
+// Quality 60, the default, and 90
+static void test_frame(int width, int height, struct bounds q60, struct bounds q90)
+{
+	uint8_t *frame = make_frame(width, height);
+	double db_low = 0.0, db_high = 0.0;
+	int low, high;
+
+	low = check_quality(frame, width, height, 60, q60.max_len, q60.min_psnr, &db_low);
+	high = check_quality(frame, width, height, 90, q90.max_len, q90.min_psnr, &db_high);
+	if (low > 0 && high > 0) {
+		CHECK(high > low);
+		CHECK(db_high > db_low);
+	}
+	free(frame);
+}
+
+static void test_arena_too_small(void)
+{
+	uint8_t *frame = make_frame(240, 240);
+	size_t small = 512;
+	int len;
+
+	memset(arena, 0xA5, sizeof(arena));
+	len = jpeg_encode_rgb565(frame, 240, 240, 60, arena, small);
+	CHECK(len == -ENOMEM);
+	for (size_t i = small; i < small + 16; i++) {
+		CHECK(arena[i] == 0xA5);
+	}
+	free(frame);
+}
+
+int main(void)
+{
+	// libjpeg: 6407 bytes 29.6 dB and 13247 bytes 30.9 dB
+	test_frame(240, 240, (struct bounds){7500, 28.5}, (struct bounds){15000, 30.0});
+	// libjpeg: 883 bytes 23.3 dB and 1171 bytes 26.1 dB
+	test_frame(37, 23, (struct bounds){1100, 22.5}, (struct bounds){1450, 25.0});
+	test_arena_too_small();
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("All JPEG encoder checks passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,268 @@
+import struct
+import threading
+import time
+import zlib
+
+################################################
+# Chunked image transfer over MQTT, so devices
+# with small MQTT buffers can send images.
+#
+# Data on image/chunk/<sender>: a header, then
+# up to chunk_size bytes of the image. All
+# values are little endian; CRCs are CRC-32 IEEE.
+#   u8  version
+#   u8  flags       (CHUNK_RETRANSMIT)
+#   u16 index
+#   u16 total       chunks in the image
+#   u16 chunk_size  size of every chunk but the last
+#   u32 image_id
+#   u32 image_size
+#   u32 image_crc
+#   u32 chunk_crc   of this chunk's data
+#
+# Status back on image/nack/<sender>:
+#   u32 image_id
+#   u8  status      (STATUS_MISSING or STATUS_COMPLETE)
+#   u8  count
+#   count x (u16 first, u16 count) missing ranges
+#
+# The receiver asks for missing chunks when a
+# transfer goes quiet, and the sender resends
+# only those. Layout must match
+# ESP32_DK/src/image_chunk.h.
+################################################
+CHUNK_VERSION = 1
+CHUNK_HEADER = struct.Struct('<BBHHHIIII')
+CHUNK_RETRANSMIT = 0x01
+DEFAULT_CHUNK_SIZE = 1024
+
+STATUS_HEADER = struct.Struct('<IBB')
+STATUS_RANGE = struct.Struct('<HH')
+STATUS_MISSING = 0
+STATUS_COMPLETE = 1
+MAX_RANGES = 16
+
+CHUNK_TOPIC = 'image/chunk/'
+STATUS_TOPIC = 'image/nack/'
+
+def pack_chunk(image, image_id, image_crc, index, chunk_size, flags=0):
+    total = (len(image) + chunk_size - 1) // chunk_size
+    data = image[index * chunk_size:(index + 1) * chunk_size]
+    header = CHUNK_HEADER.pack(CHUNK_VERSION, flags, index, total, chunk_size,
+                               image_id, len(image), image_crc, zlib.crc32(data))
+    return header + data
+
+def pack_status(image_id, status, ranges=()):
+    ranges = list(ranges)[:MAX_RANGES]
+    return (STATUS_HEADER.pack(image_id, status, len(ranges))
+            + b''.join(STATUS_RANGE.pack(first, count) for first, count in ranges))
+
+def unpack_status(payload):
+    image_id, status, count = STATUS_HEADER.unpack_from(payload)
+    ranges = [STATUS_RANGE.unpack_from(payload, STATUS_HEADER.size + i * STATUS_RANGE.size)
+              for i in range(count)]
+    return image_id, status, ranges
+
+################################################
+# One image being reassembled. Chunks are
+# written straight into a buffer of the final
+# size, in whatever order they arrive.
+################################################
+class Transfer:
+    def __init__(self, image_id, total, chunk_size, image_size, image_crc):
+        self.image_id = image_id
+        self.total = total
+        self.chunk_size = chunk_size
+        self.image_size = image_size
+        self.image_crc = image_crc
+        self.buffer = bytearray(image_size)
+        self.received = bytearray(total)
+        self.remaining = total
+        self.last_activity = time.monotonic()
+        self.nacks = 0
+
+    def matches(self, total, chunk_size, image_size, image_crc):
+        return (self.total, self.chunk_size, self.image_size, self.image_crc) == \
+               (total, chunk_size, image_size, image_crc)
+
+    def missing_ranges(self):
+        ranges = []
+        i = 0
+        while i < self.total and len(ranges) < MAX_RANGES:
+            if self.received[i]:
+                i += 1
+                continue
+            first = i
+            while i < self.total and not self.received[i]:
+                i += 1
+            ranges.append((first, i - first))
+        return ranges
+
+################################################
+# Reassembles chunked images from any number of
+# senders. feed() takes each chunk message;
+# poll() should be called periodically to ask
+# for missing chunks and expire dead transfers.
+# send_status(sender, payload) publishes a
+# status message and on_image(sender, image)
+# receives each verified image.
+################################################
+class Reassembler:
+    def __init__(self, send_status, on_image, nack_after=0.5, max_nacks=5,
+                 max_image_size=4 * 1024 * 1024, max_transfers=16):
+        self.send_status = send_status
+        self.on_image = on_image
+        self.nack_after = nack_after
+        self.max_nacks = max_nacks
+        self.max_image_size = max_image_size
+        self.max_transfers = max_transfers
+        self._lock = threading.Lock()
+        self._transfers = {}
+        # Recently completed transfers, so late duplicates are acknowledged
+        # instead of starting a new transfer
+        self._completed = {}
+        self.stats = {'images': 0, 'chunks': 0, 'duplicates': 0, 'bad_chunks': 0,
+                      'nacks': 0, 'expired': 0, 'bad_images': 0}
+
+    def feed(self, sender, payload):
+        if len(payload) < CHUNK_HEADER.size:
+            self.stats['bad_chunks'] += 1
+            return
+        (version, flags, index, total, chunk_size, image_id,
+         image_size, image_crc, chunk_crc) = CHUNK_HEADER.unpack_from(payload)
+        data = memoryview(payload)[CHUNK_HEADER.size:]
+        expected = min(chunk_size, image_size - index * chunk_size) if chunk_size else -1
+        if (version != CHUNK_VERSION or index >= total or image_size > self.max_image_size
+                or total != (image_size + chunk_size - 1) // max(chunk_size, 1)
+                or len(data) != expected or zlib.crc32(data) != chunk_crc):
+            # A damaged chunk is dropped and asked for again later
+            self.stats['bad_chunks'] += 1
+            return
+
+        key = (sender, image_id)
+        image = None
+        with self._lock:
+            if key in self._completed:
+                self.stats['duplicates'] += 1
+                complete = True
+            else:
+                complete = False
+                transfer = self._transfers.get(key)
+                if transfer is None or not transfer.matches(total, chunk_size, image_size, image_crc):
+                    if len(self._transfers) >= self.max_transfers:
+                        oldest = min(self._transfers, key=lambda k: self._transfers[k].last_activity)
+                        del self._transfers[oldest]
+                        self.stats['expired'] += 1
+                    transfer = Transfer(image_id, total, chunk_size, image_size, image_crc)
+                    self._transfers[key] = transfer
+                transfer.last_activity = time.monotonic()
+                if transfer.received[index]:
+                    self.stats['duplicates'] += 1
+                else:
+                    offset = index * chunk_size
+                    transfer.buffer[offset:offset + len(data)] = data
+                    transfer.received[index] = 1
+                    transfer.remaining -= 1
+                    self.stats['chunks'] += 1
+                if transfer.remaining == 0:
+                    del self._transfers[key]
+                    image = bytes(transfer.buffer)
+                    if zlib.crc32(image) != image_crc:
+                        self.stats['bad_images'] += 1
+                        return
+                    self._completed[key] = time.monotonic()
+                    self.stats['images'] += 1
+                    complete = True
+
+        if image is not None:
+            self.on_image(sender, image)
+        if complete:
+            self.send_status(sender, pack_status(image_id, STATUS_COMPLETE))
+
+    def poll(self):
+        now = time.monotonic()
+        nacks = []
+        with self._lock:
+            for key, transfer in list(self._transfers.items()):
+                if now - transfer.last_activity < self.nack_after:
+                    continue
+                if transfer.nacks >= self.max_nacks:
+                    del self._transfers[key]
+                    self.stats['expired'] += 1
+                    continue
+                transfer.nacks += 1
+                transfer.last_activity = now
+                nacks.append((key[0], pack_status(transfer.image_id, STATUS_MISSING,
+                                                  transfer.missing_ranges())))
+            for key, done in list(self._completed.items()):
+                if now - done > 60.0:
+                    del self._completed[key]
+        for sender, payload in nacks:
+            self.stats['nacks'] += 1
+            self.send_status(sender, payload)
+
+################################################
+# Sends images as chunks and resends what the
+# receiver reports missing. If nothing comes
+# back, the last chunk is resent as a probe so
+# the receiver reports its state. Status is kept
+# per image, so several sends can be in flight
+# from different threads.
+################################################
+class ChunkSender:
+    def __init__(self, publish, sender, chunk_size=DEFAULT_CHUNK_SIZE, ack_timeout=2.0,
+                 max_probes=5):
+        self.publish = publish
+        self.topic = CHUNK_TOPIC + sender
+        self.chunk_size = chunk_size
+        self.ack_timeout = ack_timeout
+        self.max_probes = max_probes
+        self._cond = threading.Condition()
+        self._status = {}
+        self.resent = 0
+
+    # Pass every message received on the status topic here
+    def on_status(self, payload):
+        status = unpack_status(payload)
+        with self._cond:
+            pending = self._status.get(status[0])
+            if pending is not None:
+                pending.append(status)
+                self._cond.notify_all()
+
+    def send(self, image, image_id):
+        with self._cond:
+            self._status[image_id] = []
+        try:
+            return self._send(image, image_id)
+        finally:
+            with self._cond:
+                del self._status[image_id]
+
+    def _send(self, image, image_id):
+        image_crc = zlib.crc32(image)
+        total = (len(image) + self.chunk_size - 1) // self.chunk_size
+        for index in range(total):
+            self.publish(self.topic, pack_chunk(image, image_id, image_crc, index, self.chunk_size))
+
+        probes = 0
+        while True:
+            with self._cond:
+                self._cond.wait_for(lambda: self._status[image_id], timeout=self.ack_timeout)
+                status, self._status[image_id] = self._status[image_id], []
+            resend = []
+            for _, code, ranges in status:
+                if code == STATUS_COMPLETE:
+                    return True
+                for first, count in ranges:
+                    resend.extend(range(first, min(first + count, total)))
+            if not status:
+                probes += 1
+                if probes > self.max_probes:
+                    return False
+                resend = [total - 1]
+            with self._cond:
+                self.resent += len(resend)
+            for index in resend:
+                self.publish(self.topic, pack_chunk(image, image_id, image_crc, index,
+                                                    self.chunk_size, CHUNK_RETRANSMIT))
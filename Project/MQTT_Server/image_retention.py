@@ -0,0 +1,209 @@
+import argparse
+import json
+import os
+import threading
+import time
+
+from image_store import ImageStore, SEGMENT_SIZE
+
+STATE_NAME = 'retention.json'
+
+################################################
+# Background retention for an ImageStore. Each
+# pass, in order:
+#   - drops index records older than max_age
+#   - thins records older than downsample_after
+#     to every keep_every-th one (each stretch of
+#     time is thinned once only)
+#   - drops the oldest records until the unique
+#     images left fit in max_bytes
+#   - deletes images no record refers to anymore
+#   - packs images not seen for pack_after into
+#     segment files, pack_batch at a time
+#   - compacts segments that are mostly dead
+# Ingest only waits for the short index swap.
+################################################
+class RetentionEngine:
+    def __init__(self, store, max_age=None, max_bytes=None, downsample_after=None, keep_every=1,
+                 pack_after=None, pack_batch=1000, segment_size=SEGMENT_SIZE,
+                 compact_threshold=0.5, interval=60.0):
+        self.store = store
+        self.max_age = max_age
+        self.max_bytes = max_bytes
+        self.downsample_after = downsample_after
+        self.keep_every = keep_every
+        self.pack_after = pack_after
+        self.pack_batch = pack_batch
+        self.segment_size = segment_size
+        self.compact_threshold = compact_threshold
+        self.interval = interval
+        self.state_path = os.path.join(store.root, STATE_NAME)
+        self._stop = threading.Event()
+        self._thread = None
+
+    def _load_state(self):
+        if os.path.exists(self.state_path):
+            with open(self.state_path) as f:
+                return json.load(f)
+        return {'downsampled_until': 0.0}
+
+    def _save_state(self, state):
+        tmp = self.state_path + '.tmp'
+        with open(tmp, 'w') as f:
+            json.dump(state, f)
+        os.replace(tmp, self.state_path)
+
+    ################################################
+    # Decide which of the index records to keep
+    ################################################
+    def _select(self, entries, now, state):
+        keep = [True] * len(entries)
+
+        if self.max_age is not None:
+            cutoff = now - self.max_age
+            for i, e in enumerate(entries):
+                if e.timestamp >= cutoff:
+                    break
+                keep[i] = False
+
+        if self.downsample_after is not None and self.keep_every > 1:
+            start = state['downsampled_until']
+            end = now - self.downsample_after
+            n = 0
+            for i, e in enumerate(entries):
+                if e.timestamp >= end:
+                    break
+                if e.timestamp >= start and keep[i]:
+                    keep[i] = n % self.keep_every == 0
+                    n += 1
+            state['downsampled_until'] = max(start, end)
+
+        if self.max_bytes is not None:
+            refs = {}
+            for i, e in enumerate(entries):
+                if keep[i]:
+                    refs[e.hash] = refs.get(e.hash, 0) + 1
+            sizes = {e.hash: e.size for e in entries}
+            total = sum(sizes[h] for h in refs)
+            for i, e in enumerate(entries):
+                if total <= self.max_bytes:
+                    break
+                if not keep[i]:
+                    continue
+                keep[i] = False
+                refs[e.hash] -= 1
+                if refs[e.hash] == 0:
+                    total -= e.size
+
+        return keep
+
+    ################################################
+    # One retention pass; returns a summary dict
+    ################################################
+    def run_once(self):
+        now = time.time()
+        state = self._load_state()
+        report = {'records_removed': 0, 'objects_removed': 0, 'bytes_freed': 0,
+                  'objects_packed': 0, 'bytes_packed': 0, 'segment_bytes_freed': 0}
+
+        # Anything referenced from here on is safe from deletion this pass
+        self.store.take_referenced()
+        entries = self.store.query()
+        keep = self._select(entries, now, state)
+        kept = [e for e, k in zip(entries, keep) if k]
+
+        if len(kept) < len(entries):
+            tail = self.store.rewrite_index(keep)
+            kept.extend(tail)
+            live = {e.hash for e in kept}
+            dead = {e.hash for e, k in zip(entries, keep) if not k} - live
+            removed, freed = self.store.remove_objects(dead)
+            report['records_removed'] = len(entries) - sum(keep)
+            report['objects_removed'] = removed
+            report['bytes_freed'] = freed
+        self._save_state(state)
+
+        if self.pack_after is not None:
+            last_seen = {}
+            for e in kept:
+                last_seen[e.hash] = e.timestamp
+            cold = [h for h, t in last_seen.items()
+                    if t < now - self.pack_after and not self.store.is_packed(h)]
+            packed, packed_bytes = self.store.pack(cold[:self.pack_batch], self.segment_size)
+            report['objects_packed'] = packed
+            report['bytes_packed'] = packed_bytes
+
+        report['segment_bytes_freed'] = self.store.compact_segments(self.compact_threshold,
+                                                                    self.segment_size)
+        return report
+
+    @staticmethod
+    def describe(report):
+        reclaimed = report['bytes_freed'] + report['segment_bytes_freed']
+        return (f"Retention: removed {report['records_removed']} records and "
+                f"{report['objects_removed']} images, reclaimed {reclaimed / 1e6:.1f} MB "
+                f"({report['segment_bytes_freed'] / 1e6:.1f} MB from segments), "
+                f"packed {report['objects_packed']} images ({report['bytes_packed'] / 1e6:.1f} MB)")
+
+    def _run(self):
+        while not self._stop.wait(self.interval):
+            try:
+                report = self.run_once()
+            except OSError as e:
+                print(f"Retention pass failed: {e}")
+                continue
+            if any(report.values()):
+                print(self.describe(report))
+
+    def start(self):
+        self._thread = threading.Thread(target=self._run, daemon=True)
+        self._thread.start()
+
+    def stop(self):
+        self._stop.set()
+        if self._thread is not None:
+            self._thread.join()
+
+################################################
+# Command line options shared with the store and
+# forward script. Every policy is off unless its
+# option is given.
+################################################
+def add_retention_arguments(parser):
+    parser.add_argument('--max-age-days', type=float, help="delete images older than this")
+    parser.add_argument('--max-gb', type=float, help="delete the oldest images beyond this size")
+    parser.add_argument('--downsample-after-days', type=float,
+                        help="thin images older than this to every --keep-every-th one")
+    parser.add_argument('--keep-every', type=int, default=1)
+    parser.add_argument('--pack-after-hours', type=float,
+                        help="pack images untouched for this long into segment files")
+
+def retention_from_args(store, args, interval=60.0):
+    if (args.max_age_days is None and args.max_gb is None and args.pack_after_hours is None
+            and (args.downsample_after_days is None or args.keep_every <= 1)):
+        return None
+    day = 24 * 3600
+    return RetentionEngine(
+        store,
+        max_age=None if args.max_age_days is None else args.max_age_days * day,
+        max_bytes=None if args.max_gb is None else int(args.max_gb * 1e9),
+        downsample_after=None if args.downsample_after_days is None else args.downsample_after_days * day,
+        keep_every=args.keep_every,
+        pack_after=None if args.pack_after_hours is None else args.pack_after_hours * 3600,
+        interval=interval)
+
+def main():
+    parser = argparse.ArgumentParser(description="Apply retention to the stored images")
+    parser.add_argument('--root', default='stored_images')
+    add_retention_arguments(parser)
+    args = parser.parse_args()
+
+    store = ImageStore(args.root)
+    engine = retention_from_args(store, args)
+    if engine is None:
+        parser.error("no retention policy given")
+    print(engine.describe(engine.run_once()))
+    store.close()
+
+if __name__ == "__main__":
+    main()
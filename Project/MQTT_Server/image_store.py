@@ -0,0 +1,488 @@
+import argparse
+import bisect
+import hashlib
+import heapq
+import mmap
+import os
+import struct
+import tempfile
+import threading
+import time
+from collections import namedtuple
+
+# One fixed size index record per stored image:
+# arrival time, payload size, SHA-256 and source (e.g. the MQTT topic)
+INDEX_RECORD = struct.Struct('<dI32s20s')
+INDEX_NAME = 'index.bin'
+OBJECTS_DIR = 'objects'
+
+# Cold objects are packed into large append-only segment files. The catalog
+# records where each packed object lives: hash, segment number, offset and
+# size, with size 0 marking an object removed from its segment.
+SEGMENTS_DIR = 'segments'
+CATALOG_NAME = 'catalog.bin'
+CATALOG_RECORD = struct.Struct('<32sIQI')
+SEGMENT_SIZE = 64 * 1024 * 1024
+
+IndexEntry = namedtuple('IndexEntry', ['timestamp', 'size', 'hash', 'source'])
+SegmentRef = namedtuple('SegmentRef', ['segment', 'offset', 'size'])
+
+def object_extension(data):
+    return '.jpg' if data[:2] == b'\xff\xd8' else '.bin'
+
+# Trim a record torn by a crash mid append
+def _trim_torn(path, record_size):
+    with open(path, 'ab') as f:
+        size = f.tell()
+        if size % record_size:
+            f.truncate(size - size % record_size)
+
+################################################
+# Timestamps of the index records, so bisect can
+# search the memory mapped file directly
+################################################
+class _Timestamps:
+    def __init__(self, buf):
+        self.buf = buf
+
+    def __len__(self):
+        return len(self.buf) // INDEX_RECORD.size
+
+    def __getitem__(self, i):
+        return struct.unpack_from('<d', self.buf, i * INDEX_RECORD.size)[0]
+
+################################################
+# Content addressed image store. Each payload is
+# written once under its SHA-256, sharded two
+# levels deep (objects/ab/cd/abcd...jpg) through
+# a temporary file and an atomic rename, and
+# every arrival is appended to a binary index in
+# time order.
+################################################
+class ImageStore:
+    def __init__(self, root='stored_images', fsync=False):
+        self.root = root
+        self.fsync = fsync
+        self.index_path = os.path.join(root, INDEX_NAME)
+        self.catalog_path = os.path.join(root, CATALOG_NAME)
+        self._lock = threading.Lock()
+        self._pack_lock = threading.Lock()
+        self._last_timestamp = 0.0
+        # Hashes written or deduplicated since the last take_referenced()
+        self._referenced = set()
+        os.makedirs(os.path.join(root, OBJECTS_DIR), exist_ok=True)
+        os.makedirs(os.path.join(root, SEGMENTS_DIR), exist_ok=True)
+
+        _trim_torn(self.index_path, INDEX_RECORD.size)
+        entries = self._entries()
+        if entries:
+            self._last_timestamp = entries[-1].timestamp
+
+        _trim_torn(self.catalog_path, CATALOG_RECORD.size)
+        self._packed = {}
+        with open(self.catalog_path, 'rb') as f:
+            data = f.read()
+        for digest, segment, offset, size in CATALOG_RECORD.iter_unpack(data):
+            if size:
+                self._packed[digest.hex()] = SegmentRef(segment, offset, size)
+            else:
+                self._packed.pop(digest.hex(), None)
+
+        self._index = open(self.index_path, 'ab')
+        self._catalog = open(self.catalog_path, 'ab')
+
+    def object_path(self, digest, ext='.jpg'):
+        return os.path.join(self.root, OBJECTS_DIR, digest[:2], digest[2:4], digest + ext)
+
+    def segment_path(self, segment):
+        return os.path.join(self.root, SEGMENTS_DIR, f"seg-{segment:06d}.pack")
+
+    # Path of a loose (unpacked) object, or None
+    def find(self, digest):
+        for ext in ('.jpg', '.bin'):
+            path = self.object_path(digest, ext)
+            if os.path.exists(path):
+                return path
+        return None
+
+    def _locate(self, digest):
+        ref = self._packed.get(digest)
+        return self.segment_path(ref.segment) if ref else self.find(digest)
+
+    ################################################
+    # Write the payload unless identical content is
+    # already stored; returns the object path and
+    # whether it was a duplicate
+    ################################################
+    def write_object(self, data, digest=None, fsync=None):
+        fsync = self.fsync if fsync is None else fsync
+        digest = digest or hashlib.sha256(data).hexdigest()
+        path = self.object_path(digest, object_extension(data))
+
+        # Checked under the lock so remove_objects() cannot delete the
+        # object between this check and the caller indexing it
+        with self._lock:
+            self._referenced.add(digest)
+            existing = self._locate(digest)
+        if existing is not None:
+            return existing, True
+
+        shard = os.path.dirname(path)
+        os.makedirs(shard, exist_ok=True)
+        fd, tmp = tempfile.mkstemp(dir=shard, prefix='.tmp-')
+        try:
+            with os.fdopen(fd, 'wb') as f:
+                f.write(data)
+                if fsync:
+                    f.flush()
+                    os.fsync(f.fileno())
+            os.replace(tmp, path)
+        except BaseException:
+            os.unlink(tmp)
+            raise
+        return path, False
+
+    ################################################
+    # Append index records for new arrivals;
+    # timestamps are kept non decreasing so the
+    # index stays sorted across clock steps
+    ################################################
+    def append_index(self, records, fsync=None):
+        fsync = self.fsync if fsync is None else fsync
+        with self._lock:
+            for timestamp, size, digest, source in records:
+                timestamp = max(timestamp, self._last_timestamp)
+                self._last_timestamp = timestamp
+                self._index.write(INDEX_RECORD.pack(timestamp, size, bytes.fromhex(digest),
+                                                    source.encode()[:20]))
+            self._index.flush()
+            if fsync:
+                os.fsync(self._index.fileno())
+
+    ################################################
+    # Merge records with their own, older times
+    # into the index at their sorted position. The
+    # index is rewritten from the first position
+    # they land at, so this is for imports, not
+    # for ingest; and like any positional rewrite
+    # it must not run alongside a retention pass.
+    ################################################
+    def insert_index(self, records):
+        records = sorted(records, key=lambda r: r[0])
+        if not records:
+            return
+        size = INDEX_RECORD.size
+        tmp = self.index_path + '.tmp'
+        with self._lock:
+            self._index.flush()
+            with open(self.index_path, 'rb') as src:
+                data = src.read()
+            pos = bisect.bisect_right(_Timestamps(data), records[0][0])
+            old = [data[i:i + size] for i in range(pos * size, len(data), size)]
+            new = [INDEX_RECORD.pack(timestamp, length, bytes.fromhex(digest), source.encode()[:20])
+                   for timestamp, length, digest, source in records]
+            # Existing records stay ahead of new ones with the same time
+            merged = heapq.merge(old, new, key=lambda r: struct.unpack_from('<d', r)[0])
+
+            with open(tmp, 'wb') as dst:
+                dst.write(data[:pos * size])
+                dst.writelines(merged)
+                dst.flush()
+                os.fsync(dst.fileno())
+            self._index.close()
+            os.replace(tmp, self.index_path)
+            self._index = open(self.index_path, 'ab')
+            self._last_timestamp = max(self._last_timestamp, records[-1][0])
+
+    ################################################
+    # Store one payload; returns (hash, path,
+    # duplicate)
+    ################################################
+    def put(self, data, source='', timestamp=None):
+        digest = hashlib.sha256(data).hexdigest()
+        path, duplicate = self.write_object(data, digest)
+        self.append_index([(timestamp or time.time(), len(data), digest, source)])
+        return digest, path, duplicate
+
+    def get(self, digest):
+        ref = self._packed.get(digest)
+        if ref is not None:
+            with open(self.segment_path(ref.segment), 'rb') as f:
+                f.seek(ref.offset)
+                return f.read(ref.size)
+        path = self.find(digest)
+        if path is None:
+            raise KeyError(digest)
+        with open(path, 'rb') as f:
+            return f.read()
+
+    def is_packed(self, digest):
+        return digest in self._packed
+
+    def _entries(self, start=None, end=None):
+        if os.path.getsize(self.index_path) == 0:
+            return []
+        with open(self.index_path, 'rb') as f, \
+                mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as buf:
+            times = _Timestamps(buf)
+            lo = 0 if start is None else bisect.bisect_left(times, start)
+            hi = len(times) if end is None else bisect.bisect_left(times, end)
+            entries = []
+            for i in range(lo, hi):
+                timestamp, size, digest, source = INDEX_RECORD.unpack_from(buf, i * INDEX_RECORD.size)
+                entries.append(IndexEntry(timestamp, size, digest.hex(),
+                                          source.rstrip(b'\0').decode(errors='replace')))
+            return entries
+
+    ################################################
+    # Index entries with start <= timestamp < end,
+    # found by binary search over the index file
+    ################################################
+    def query(self, start=None, end=None):
+        with self._lock:
+            self._index.flush()
+            return self._entries(start, end)
+
+    ################################################
+    # Maintenance for the retention engine
+    ################################################
+
+    # Hashes written or deduplicated since the previous call
+    def take_referenced(self):
+        with self._lock:
+            referenced, self._referenced = self._referenced, set()
+        return referenced
+
+    ################################################
+    # Rewrite the index keeping record i of the
+    # first len(keep) records where keep[i] is set.
+    # Records appended since are carried over as
+    # they are and returned.
+    ################################################
+    def rewrite_index(self, keep):
+        size = INDEX_RECORD.size
+        tmp = self.index_path + '.tmp'
+        with open(self.index_path, 'rb') as src, open(tmp, 'wb') as dst:
+            prefix = src.read(len(keep) * size)
+            view = memoryview(prefix)
+            for i, kept in enumerate(keep):
+                if kept:
+                    dst.write(view[i * size:(i + 1) * size])
+
+            # Ingest only waits for the tail copy and the swap
+            with self._lock:
+                self._index.flush()
+                tail = src.read()
+                dst.write(tail)
+                dst.flush()
+                os.fsync(dst.fileno())
+                self._index.close()
+                os.replace(tmp, self.index_path)
+                self._index = open(self.index_path, 'ab')
+
+        return [IndexEntry(t, n, d.hex(), src_.rstrip(b'\0').decode(errors='replace'))
+                for t, n, d, src_ in INDEX_RECORD.iter_unpack(tail)]
+
+    ################################################
+    # Delete objects the index no longer refers to,
+    # skipping any referenced again since the last
+    # take_referenced(). Loose files free their
+    # space now, packed ones when their segment is
+    # compacted. Returns (removed, bytes freed).
+    ################################################
+    def remove_objects(self, digests, chunk=256):
+        with self._pack_lock:
+            return self._remove_objects(list(digests), chunk)
+
+    def _remove_objects(self, digests, chunk):
+        removed = freed = 0
+        tombstones = []
+        for start in range(0, len(digests), chunk):
+            with self._lock:
+                for digest in digests[start:start + chunk]:
+                    if digest in self._referenced:
+                        continue
+                    if self._packed.pop(digest, None) is not None:
+                        tombstones.append(CATALOG_RECORD.pack(bytes.fromhex(digest), 0, 0, 0))
+                        removed += 1
+                        continue
+                    path = self.find(digest)
+                    if path is not None:
+                        freed += os.path.getsize(path)
+                        os.remove(path)
+                        removed += 1
+        if tombstones:
+            self._catalog.write(b''.join(tombstones))
+            self._catalog.flush()
+        return removed, freed
+
+    def _current_segment(self):
+        names = sorted(os.listdir(os.path.join(self.root, SEGMENTS_DIR)))
+        numbers = [int(n[4:10]) for n in names if n.startswith('seg-') and n.endswith('.pack')]
+        return max(numbers, default=0)
+
+    ################################################
+    # Append (digest, data) pairs to the open
+    # segment, starting a new one once it reaches
+    # segment_size, and catalog them
+    ################################################
+    def _append_segment(self, objects, segment_size):
+        segment = self._current_segment() or 1
+        path = self.segment_path(segment)
+        refs = []
+        f = open(path, 'ab')
+        try:
+            for digest, data in objects:
+                if f.tell() >= segment_size:
+                    f.flush()
+                    os.fsync(f.fileno())
+                    f.close()
+                    segment += 1
+                    path = self.segment_path(segment)
+                    f = open(path, 'ab')
+                refs.append((digest, SegmentRef(segment, f.tell(), len(data))))
+                f.write(data)
+            f.flush()
+            os.fsync(f.fileno())
+        finally:
+            f.close()
+
+        # Catalog only once the data is on disk
+        self._catalog.write(b''.join(CATALOG_RECORD.pack(bytes.fromhex(d), *ref) for d, ref in refs))
+        self._catalog.flush()
+        os.fsync(self._catalog.fileno())
+        with self._lock:
+            self._packed.update(refs)
+
+    ################################################
+    # Move loose objects into segment files.
+    # Returns (objects packed, bytes packed).
+    ################################################
+    def pack(self, digests, segment_size=SEGMENT_SIZE):
+        with self._pack_lock:
+            objects = []
+            for digest in digests:
+                path = self.find(digest)
+                if path is not None and digest not in self._packed:
+                    with open(path, 'rb') as f:
+                        objects.append((digest, f.read()))
+            if not objects:
+                return 0, 0
+            self._append_segment(objects, segment_size)
+
+            # Readers find the packed copy from now on
+            for digest, _ in objects:
+                path = self.find(digest)
+                if path is not None:
+                    os.remove(path)
+            return len(objects), sum(len(data) for _, data in objects)
+
+    ################################################
+    # Rewrite segments where less than threshold of
+    # the file is still live, copying live objects
+    # into the open segment. Returns bytes freed.
+    ################################################
+    def compact_segments(self, threshold=0.5, segment_size=SEGMENT_SIZE):
+        with self._pack_lock:
+            current = self._current_segment()
+            live = {}
+            for digest, ref in list(self._packed.items()):
+                live.setdefault(ref.segment, []).append((digest, ref))
+
+            freed = 0
+            for segment in range(1, current):
+                path = self.segment_path(segment)
+                if not os.path.exists(path):
+                    continue
+                size = os.path.getsize(path)
+                refs = live.get(segment, [])
+                live_bytes = sum(ref.size for _, ref in refs)
+                if live_bytes >= size * threshold:
+                    continue
+
+                objects = []
+                with open(path, 'rb') as f:
+                    for digest, ref in refs:
+                        f.seek(ref.offset)
+                        objects.append((digest, f.read(ref.size)))
+                if objects:
+                    self._append_segment(objects, segment_size)
+                os.remove(path)
+                freed += size - live_bytes
+
+            if freed:
+                self._rewrite_catalog()
+            return freed
+
+    # Drop tombstones and superseded records from the catalog
+    def _rewrite_catalog(self):
+        tmp = self.catalog_path + '.tmp'
+        with self._lock:
+            packed = list(self._packed.items())
+        with open(tmp, 'wb') as f:
+            f.write(b''.join(CATALOG_RECORD.pack(bytes.fromhex(d), *ref) for d, ref in packed))
+            f.flush()
+            os.fsync(f.fileno())
+        self._catalog.close()
+        os.replace(tmp, self.catalog_path)
+        self._catalog = open(self.catalog_path, 'ab')
+
+    ################################################
+    # Move images saved by the old flat naming
+    # (image_YYYYMMDD-HHMMSS.jpg) into the store,
+    # indexed at their capture time
+    ################################################
+    def import_legacy(self):
+        legacy = []
+        for name in os.listdir(self.root):
+            if not (name.startswith('image_') and name.endswith('.jpg')):
+                continue
+            path = os.path.join(self.root, name)
+            try:
+                timestamp = time.mktime(time.strptime(name[6:-4], "%Y%m%d-%H%M%S"))
+            except ValueError:
+                timestamp = os.path.getmtime(path)
+            legacy.append((timestamp, path))
+        legacy.sort()
+
+        records = []
+        for timestamp, path in legacy:
+            with open(path, 'rb') as f:
+                data = f.read()
+            digest = hashlib.sha256(data).hexdigest()
+            self.write_object(data, digest)
+            records.append((timestamp, len(data), digest, 'legacy'))
+        self.insert_index(records)
+
+        # Only once the index refers to the stored copies
+        for _, path in legacy:
+            os.remove(path)
+        return len(legacy)
+
+    def close(self):
+        self._index.close()
+        self._catalog.close()
+
+def main():
+    parser = argparse.ArgumentParser(description="Query the stored image index")
+    parser.add_argument('--root', default='stored_images')
+    parser.add_argument('--since', type=float, help="seconds ago")
+    parser.add_argument('--until', type=float, help="seconds ago")
+    parser.add_argument('--import-legacy', action='store_true',
+                        help="move flat image_*.jpg files into the store first")
+    args = parser.parse_args()
+
+    now = time.time()
+    store = ImageStore(args.root)
+    if args.import_legacy:
+        print(f"Imported {store.import_legacy()} legacy images")
+    entries = store.query(None if args.since is None else now - args.since,
+                          None if args.until is None else now - args.until)
+    for e in entries:
+        stamp = time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(e.timestamp))
+        print(f"{stamp} {e.source:20} {e.size:8} {e.hash}")
+    print(f"{len(entries)} images, {len({e.hash for e in entries})} unique")
+    store.close()
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,145 @@
+import hashlib
+import queue
+import threading
+import time
+
+import numpy as np
+
+# When data reaches the disk:
+#   never  - left to the OS
+#   batch  - the index is fsynced once per batch
+#   always - every image and the index of every batch are fsynced
+FSYNC_POLICIES = ('never', 'batch', 'always')
+
+################################################
+# Bounded pool of background threads writing
+# images to an ImageStore, so disk latency never
+# stalls the MQTT network loop. Each worker takes
+# up to batch_size queued images at a time and
+# appends their index records in one write.
+################################################
+class AsyncWriter:
+    def __init__(self, store, workers=2, max_queue=256, batch_size=16, batch_wait_ms=20,
+                 fsync='batch', report_every=10.0):
+        if fsync not in FSYNC_POLICIES:
+            raise ValueError(f"fsync policy must be one of {FSYNC_POLICIES}")
+        self.store = store
+        self.batch_size = batch_size
+        self.batch_wait = batch_wait_ms / 1000.0
+        self.fsync = fsync
+        self.report_every = report_every
+        self._queue = queue.Queue(max_queue)
+
+        # Metrics since the last report
+        self._lock = threading.Lock()
+        self._latencies = []
+        self._batches = 0
+        self._duplicates = 0
+        self._max_depth = 0
+        self._blocked = 0
+        self._errors = 0
+        self._last_report = time.monotonic()
+
+        self._workers = [threading.Thread(target=self._run, daemon=True) for _ in range(workers)]
+        for worker in self._workers:
+            worker.start()
+
+    ################################################
+    # Queue one image; blocks only when the queue is
+    # full, which pushes back on the broker instead
+    # of growing without bound
+    ################################################
+    def submit(self, data, source=''):
+        item = (data, source, time.time(), time.perf_counter())
+        try:
+            self._queue.put_nowait(item)
+        except queue.Full:
+            with self._lock:
+                self._blocked += 1
+            self._queue.put(item)
+        depth = self._queue.qsize()
+        with self._lock:
+            self._max_depth = max(self._max_depth, depth)
+
+    def _take_batch(self):
+        item = self._queue.get()
+        if item is None:
+            return None
+        batch = [item]
+        deadline = time.perf_counter() + self.batch_wait
+        while len(batch) < self.batch_size:
+            remaining = deadline - time.perf_counter()
+            try:
+                item = self._queue.get(timeout=remaining) if remaining > 0 else self._queue.get_nowait()
+            except queue.Empty:
+                break
+            if item is None:
+                # Leave the stop marker for this worker's next pass
+                self._queue.put(None)
+                break
+            batch.append(item)
+        return batch
+
+    def _run(self):
+        while True:
+            batch = self._take_batch()
+            if batch is None:
+                return
+
+            records = []
+            duplicates = 0
+            try:
+                for data, source, timestamp, _ in batch:
+                    digest = hashlib.sha256(data).hexdigest()
+                    _, duplicate = self.store.write_object(data, digest, fsync=self.fsync == 'always')
+                    duplicates += duplicate
+                    records.append((timestamp, len(data), digest, source))
+                self.store.append_index(records, fsync=self.fsync != 'never')
+            except OSError as e:
+                print(f"Image write failed: {e}")
+                with self._lock:
+                    self._errors += len(batch)
+                continue
+
+            done = time.perf_counter()
+            with self._lock:
+                self._latencies.extend((done - queued) * 1000.0 for *_, queued in batch)
+                self._batches += 1
+                self._duplicates += duplicates
+            self._maybe_report()
+
+    def _maybe_report(self):
+        if self.report_every and time.monotonic() - self._last_report >= self.report_every:
+            print(self.report())
+
+    ################################################
+    # Summary of queue depth and enqueue to written
+    # latency since the last report
+    ################################################
+    def report(self):
+        with self._lock:
+            elapsed = time.monotonic() - self._last_report
+            written = len(self._latencies)
+            if written:
+                p50, p95, worst = np.percentile(self._latencies, [50, 95, 100])
+                latency = f"write latency p50 {p50:.1f} ms p95 {p95:.1f} ms max {worst:.1f} ms"
+            else:
+                latency = "no writes"
+            text = (f"Writer: {written / elapsed:.1f} img/s in {self._batches} batches, "
+                    f"{self._duplicates} duplicates, {latency}, queue depth {self._queue.qsize()} "
+                    f"(max {self._max_depth}), {self._blocked} blocked submits, {self._errors} errors")
+            self._latencies = []
+            self._batches = self._duplicates = self._blocked = self._errors = 0
+            self._max_depth = self._queue.qsize()
+            self._last_report = time.monotonic()
+        return text
+
+    ################################################
+    # Write out everything queued, then stop
+    ################################################
+    def close(self):
+        for _ in self._workers:
+            self._queue.put(None)
+        for worker in self._workers:
+            worker.join()
+        print(self.report())
@@ -0,0 +1,358 @@
+import argparse
+import json
+import os
+import platform
+import shutil
+import signal
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import zlib
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+import paho.mqtt.client as mqtt
+
+from image_chunks import ChunkSender, CHUNK_TOPIC, STATUS_TOPIC, STATUS_COMPLETE, pack_chunk, unpack_status
+from image_store import ImageStore
+
+BASE_DIR = os.path.dirname(os.path.abspath(__file__))
+SERVER_SCRIPT = os.path.join(BASE_DIR, 'mqtt_image_store_and_forward.py')
+
+# Prefix of every benchmark payload, so the receiving side can match it to
+# the send time: magic, run id, publisher, sequence number
+BENCH_HEADER = struct.Struct('<4sIHI')
+BENCH_MAGIC = b'MQBN'
+
+PERCENTILES = [50, 90, 95, 99, 100]
+
+# Sender name of the startup probe, whose image is left out of the count
+READY_SENDER = 'bench-ready'
+
+################################################
+# Records send times and matches republished
+# images back to them
+################################################
+class LatencyRecorder:
+    def __init__(self, run_id):
+        self.run_id = run_id
+        self._lock = threading.Lock()
+        self._sent = {}
+        self.latencies = {}
+        self.lag = []
+        self.received = 0
+        self.duplicates = 0
+        self.first_receive = None
+        self.last_receive = None
+        # Chunked sends: time from schedule to completion, and how many
+        # finished after the publisher's next image was due
+        self.completions = []
+        self.late = 0
+        self.failed = 0
+
+    def sent(self, publisher, seq, size, lag):
+        with self._lock:
+            self._sent[(publisher, seq)] = (time.perf_counter(), size)
+            self.lag.append(lag * 1000.0)
+
+    def on_message(self, client, userdata, msg):
+        now = time.perf_counter()
+        if len(msg.payload) < BENCH_HEADER.size:
+            return
+        magic, run_id, publisher, seq = BENCH_HEADER.unpack_from(msg.payload)
+        if magic != BENCH_MAGIC or run_id != self.run_id:
+            return
+        with self._lock:
+            sent = self._sent.pop((publisher, seq), None)
+            if sent is None:
+                self.duplicates += 1
+                return
+            start, size = sent
+            self.latencies.setdefault(size, []).append((now - start) * 1000.0)
+            self.received += 1
+            if self.first_receive is None:
+                self.first_receive = now
+            self.last_receive = now
+        if userdata:
+            # Do what mqtt_image_receiver.py does with every image
+            with open(userdata, 'wb') as f:
+                f.write(msg.payload)
+
+    def completed(self, ok, elapsed, interval):
+        with self._lock:
+            if not ok:
+                self.failed += 1
+                return
+            self.completions.append(elapsed * 1000.0)
+            self.late += elapsed > interval
+
+    def outstanding(self):
+        with self._lock:
+            return len(self._sent)
+
+################################################
+# One publisher sending on a fixed schedule, so
+# a slow pipeline shows up as latency and lag
+# instead of a lower send rate. Chunked sends
+# wait for the server's completion status, so
+# they run on a pool and the schedule never
+# waits for them.
+################################################
+def publisher(index, args, recorder, start_at, stop_at, counts):
+    client = mqtt.Client()
+    client.connect(args.host, args.port)
+    client.loop_start()
+
+    sender = None
+    pool = None
+    if args.chunked:
+        pool = ThreadPoolExecutor(max_workers=args.max_inflight)
+        name = f"bench-{recorder.run_id}-{index}"
+        sender = ChunkSender(lambda topic, payload: client.publish(topic, payload), name,
+                             chunk_size=args.chunk_size)
+        client.on_message = lambda c, u, msg: sender.on_status(msg.payload)
+        client.subscribe(STATUS_TOPIC + name)
+
+    rng = np.random.default_rng(index)
+    bodies = {size: bytearray(rng.integers(0, 256, size, dtype=np.uint8).tobytes())
+              for size in args.sizes}
+    interval = 1.0 / args.rate
+    seq = 0
+
+    def send_chunked(payload, seq, scheduled):
+        ok = sender.send(payload, seq)
+        recorder.completed(ok, time.perf_counter() - scheduled, interval)
+    next_send = start_at + index * interval / args.publishers
+
+    while True:
+        now = time.perf_counter()
+        if next_send > now:
+            time.sleep(next_send - now)
+        if time.perf_counter() >= stop_at:
+            break
+        size = args.sizes[seq % len(args.sizes)]
+        payload = bodies[size]
+        BENCH_HEADER.pack_into(payload, 0, BENCH_MAGIC, recorder.run_id, index, seq)
+        payload = bytes(payload)
+        recorder.sent(index, seq, size, time.perf_counter() - next_send)
+        if sender is not None:
+            pool.submit(send_chunked, payload, seq, next_send)
+        else:
+            client.publish("image/upload", payload, qos=args.qos)
+        seq += 1
+        next_send += interval
+
+    counts[index] = seq
+    if pool is not None:
+        # Sends still waiting for completion are counted when they finish
+        pool.shutdown(wait=True)
+    client.loop_stop()
+    client.disconnect()
+
+def percentiles(values):
+    if not values:
+        return None
+    p = np.percentile(values, PERCENTILES)
+    return {'p50': p[0], 'p90': p[1], 'p95': p[2], 'p99': p[3], 'max': p[4],
+            'mean': float(np.mean(values)), 'count': len(values)}
+
+################################################
+# Wait until the server has connected and
+# subscribed: send a one chunk probe image until
+# its completion status comes back. A repeated
+# probe is acknowledged as a duplicate, so the
+# probe is stored at most once.
+################################################
+def wait_ready(server, host, port, timeout=30.0):
+    ready = threading.Event()
+    client = mqtt.Client()
+    client.on_message = lambda c, u, msg: (unpack_status(msg.payload)[1] == STATUS_COMPLETE
+                                           and ready.set())
+    client.connect(host, port)
+    client.subscribe(STATUS_TOPIC + READY_SENDER, qos=1)
+    client.loop_start()
+    probe = b'ready'
+    chunk = pack_chunk(probe, 0, zlib.crc32(probe), 0, len(probe))
+    try:
+        deadline = time.perf_counter() + timeout
+        while not ready.is_set():
+            if server.poll() is not None:
+                raise RuntimeError("store and forward server exited on startup")
+            if time.perf_counter() > deadline:
+                raise RuntimeError(f"store and forward server not ready after {timeout:.0f} s")
+            client.publish(CHUNK_TOPIC + READY_SENDER, chunk)
+            ready.wait(0.2)
+    finally:
+        client.loop_stop()
+        client.disconnect()
+
+################################################
+# Start mqtt_image_store_and_forward.py with an
+# empty store, so stored images can be counted
+################################################
+def start_server(store_dir, host, port):
+    server = subprocess.Popen([sys.executable, SERVER_SCRIPT, '--host', host, '--port', str(port)],
+                              cwd=store_dir)
+    try:
+        wait_ready(server, host, port)
+    except BaseException:
+        server.kill()
+        server.wait()
+        raise
+    return server
+
+def stop_server(server, store_dir):
+    server.send_signal(signal.SIGINT)
+    server.wait(timeout=30)
+    store = ImageStore(os.path.join(store_dir, 'stored_images'))
+    stored = sum(e.source != READY_SENDER for e in store.query())
+    store.close()
+    return stored
+
+################################################
+# Fail when a latency or throughput figure is
+# more than max_regression worse than baseline
+################################################
+def compare(results, baseline, max_regression):
+    failures = []
+    for key in ('p50', 'p95', 'p99'):
+        old = baseline['latency_ms'].get(key)
+        new = results['latency_ms'].get(key)
+        if old and new and new > old * (1.0 + max_regression):
+            failures.append(f"latency {key} {new:.1f} ms vs {old:.1f} ms")
+    old = baseline['throughput']['images_per_s']
+    new = results['throughput']['images_per_s']
+    if new < old * (1.0 - max_regression):
+        failures.append(f"throughput {new:.1f} img/s vs {old:.1f} img/s")
+    return failures
+
+def main():
+    parser = argparse.ArgumentParser(description="Load and latency benchmark for the MQTT image path")
+    parser.add_argument('--host', default="localhost")
+    parser.add_argument('--port', type=int, default=1883)
+    parser.add_argument('--publishers', type=int, default=4)
+    parser.add_argument('--rate', type=float, default=5.0, help="images per second per publisher")
+    parser.add_argument('--sizes', type=int, nargs='+', default=[20000],
+                        help="payload sizes in bytes, cycled through by every publisher")
+    parser.add_argument('--duration', type=float, default=30.0)
+    parser.add_argument('--qos', type=int, choices=(0, 1, 2), default=0)
+    parser.add_argument('--chunked', action='store_true', help="send through image_chunks.py")
+    parser.add_argument('--chunk-size', type=int, default=1024)
+    parser.add_argument('--max-inflight', type=int, default=32,
+                        help="chunked sends in flight per publisher")
+    parser.add_argument('--drain', type=float, default=10.0,
+                        help="seconds to wait for outstanding images after sending stops")
+    parser.add_argument('--no-server', action='store_true',
+                        help="use an already running store and forward server")
+    parser.add_argument('--write-received', action='store_true',
+                        help="write each received image to disk like mqtt_image_receiver.py")
+    parser.add_argument('--output', default="mqtt_bench_results.json")
+    parser.add_argument('--baseline', help="results file to compare against")
+    parser.add_argument('--max-regression', type=float, default=0.2)
+    args = parser.parse_args()
+    if min(args.sizes) < BENCH_HEADER.size:
+        parser.error(f"payloads must be at least {BENCH_HEADER.size} bytes")
+
+    store_dir = tempfile.mkdtemp(prefix="mqtt_bench_")
+    server = None if args.no_server else start_server(store_dir, args.host, args.port)
+
+    run_id = struct.unpack('<I', os.urandom(4))[0]
+    recorder = LatencyRecorder(run_id)
+    received_path = os.path.join(store_dir, 'latest_from_server.jpg') if args.write_received else None
+    receiver = mqtt.Client(userdata=received_path)
+    receiver.on_message = recorder.on_message
+    subscribed = threading.Event()
+    receiver.on_subscribe = lambda *_: subscribed.set()
+    receiver.connect(args.host, args.port)
+    receiver.subscribe("image/stored", qos=args.qos)
+    receiver.loop_start()
+    if not subscribed.wait(10.0):
+        raise RuntimeError("no subscription acknowledgement from the broker")
+
+    start_at = time.perf_counter() + 0.5
+    stop_at = start_at + args.duration
+    counts = [0] * args.publishers
+    threads = [threading.Thread(target=publisher, args=(i, args, recorder, start_at, stop_at, counts))
+               for i in range(args.publishers)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    drain_until = time.perf_counter() + args.drain
+    while recorder.outstanding() and time.perf_counter() < drain_until:
+        time.sleep(0.1)
+    receiver.loop_stop()
+    receiver.disconnect()
+
+    stored = stop_server(server, store_dir) if server is not None else None
+    shutil.rmtree(store_dir, ignore_errors=True)
+
+    sent = sum(counts)
+    all_latencies = [v for values in recorder.latencies.values() for v in values]
+    window = (recorder.last_receive - recorder.first_receive) if recorder.received > 1 else 0.0
+    received_bytes = sum(size * len(values) for size, values in recorder.latencies.items())
+    results = {
+        'timestamp': time.strftime('%Y-%m-%dT%H:%M:%S'),
+        'host': platform.node(),
+        'config': {'publishers': args.publishers, 'rate': args.rate, 'sizes': args.sizes,
+                   'duration': args.duration, 'qos': args.qos, 'chunked': args.chunked,
+                   'chunk_size': args.chunk_size if args.chunked else None,
+                   'max_inflight': args.max_inflight if args.chunked else None},
+        'sent': sent,
+        'received': recorder.received,
+        'lost': recorder.outstanding(),
+        'duplicates': recorder.duplicates,
+        'stored': stored,
+        'throughput': {
+            'images_per_s': recorder.received / window if window else 0.0,
+            'mb_per_s': received_bytes / window / 1e6 if window else 0.0,
+            'offered_images_per_s': args.publishers * args.rate,
+        },
+        'latency_ms': percentiles(all_latencies) or {},
+        'latency_ms_by_size': {str(size): percentiles(values)
+                               for size, values in sorted(recorder.latencies.items())},
+        'publish_lag_ms': percentiles(recorder.lag) or {},
+    }
+    if args.chunked:
+        results['chunked'] = {
+            'completed': len(recorder.completions),
+            'late': recorder.late,
+            'failed': recorder.failed,
+            'completion_ms': percentiles(recorder.completions) or {},
+        }
+
+    with open(args.output, 'w') as f:
+        json.dump(results, f, indent=2)
+
+    latency = results['latency_ms']
+    print(f"Sent {sent}, received {recorder.received}, lost {results['lost']}, "
+          f"stored {stored if stored is not None else 'n/a'}")
+    print(f"Throughput {results['throughput']['images_per_s']:.1f} img/s "
+          f"({results['throughput']['mb_per_s']:.2f} MB/s) of "
+          f"{results['throughput']['offered_images_per_s']:.1f} offered")
+    if latency:
+        print(f"Latency p50 {latency['p50']:.1f} ms p95 {latency['p95']:.1f} ms "
+              f"p99 {latency['p99']:.1f} ms max {latency['max']:.1f} ms")
+    if args.chunked:
+        chunked = results['chunked']
+        print(f"Chunked sends completed {chunked['completed']}, late {chunked['late']}, "
+              f"failed {chunked['failed']}")
+    print(f"Results written to {args.output}")
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if baseline['config'] != results['config']:
+            print(f"Warning: baseline was run with {baseline['config']}")
+        failures = compare(results, baseline, args.max_regression)
+        for failure in failures:
+            print(f"Regression: {failure}")
+        if failures:
+            sys.exit(1)
+
+if __name__ == "__main__":
+    main()
@@ -1,11 +1,36 @@
+import argparse
+import os
+import struct
 import paho.mqtt.client as mqtt
 
+from image_chunks import ChunkSender, CHUNK_TOPIC, STATUS_TOPIC, DEFAULT_CHUNK_SIZE
+
+parser = argparse.ArgumentParser(description="Send an image to the store and forward server")
+parser.add_argument('image', nargs='?', default="sample.jpg")
+parser.add_argument('--whole', action='store_true', help="publish as one message instead of in chunks")
+parser.add_argument('--chunk-size', type=int, default=DEFAULT_CHUNK_SIZE)
+parser.add_argument('--sender', default="python-sender")
+args = parser.parse_args()
+
 client = mqtt.Client()
 client.connect("localhost", 1883)
 
-with open("sample.jpg", "rb") as f:
+with open(args.image, "rb") as f:
     img = f.read()
 
-client.publish("image/upload", img)
-print("Image sent to server.")
+if args.whole:
+    client.publish("image/upload", img)
+    print("Image sent to server.")
+else:
+    sender = ChunkSender(lambda topic, payload: client.publish(topic, payload),
+                         args.sender, chunk_size=args.chunk_size)
+    client.on_message = lambda client, userdata, msg: sender.on_status(msg.payload)
+    client.subscribe(STATUS_TOPIC + args.sender)
+    client.loop_start()
+    image_id = struct.unpack('<I', os.urandom(4))[0]
+    if sender.send(img, image_id):
+        print(f"Image sent to server in {args.chunk_size} byte chunks ({sender.resent} resent).")
+    else:
+        print("Server did not confirm the image.")
+    client.loop_stop()
 client.disconnect()
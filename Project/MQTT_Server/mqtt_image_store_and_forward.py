@@ -1,33 +1,72 @@
-import os
+import argparse
 import time
 import paho.mqtt.client as mqtt
 
-# Create a folder for storing images
+from image_chunks import Reassembler, CHUNK_TOPIC, STATUS_TOPIC
+
+from image_store import ImageStore
+from image_writer import AsyncWriter
+from image_retention import add_retention_arguments, retention_from_args
+
+# Retention is off unless asked for, since it deletes images
+parser = argparse.ArgumentParser(description="Store and forward images received over MQTT")
+parser.add_argument('--host', default="localhost", help="MQTT broker")
+parser.add_argument('--port', type=int, default=1883)
+add_retention_arguments(parser)
+args = parser.parse_args()
+
+# Content addressed store for received images, written in the background
+# so a slow disk never holds up the MQTT network loop
 IMAGE_FOLDER = "stored_images"
-os.makedirs(IMAGE_FOLDER, exist_ok=True)
+store = ImageStore(IMAGE_FOLDER)
+writer = AsyncWriter(store, workers=2, max_queue=256, batch_size=16, fsync='batch')
+
+# Runs in this process so it never races the writer over which images
+# are still referenced
+retention = retention_from_args(store, args)
+if retention is not None:
+    retention.start()
+
+def store_and_forward(client, image, source):
+    # Re-publish the image to another topic straight from memory
+    client.publish("image/stored", image)
+
+    # Queue the image to be saved under its content hash
+    writer.submit(image, source=source)
 
 def on_connect(client, userdata, flags, rc):
     print("Connected with code", rc)
     client.subscribe("image/upload")
+    client.subscribe(CHUNK_TOPIC + "+")
 
 def on_message(client, userdata, msg):
-    # Generate a timestamp-based filename
-    timestamp = time.strftime("%Y%m%d-%H%M%S")
-    filename = f"{IMAGE_FOLDER}/image_{timestamp}.jpg"
-
-    # Save the received image
-    with open(filename, "wb") as f:
-        f.write(msg.payload)
-    print(f"Image saved: {filename}")
-
-    # Re-publish the image to another topic
-    client.publish("image/stored", msg.payload)
-    print("Image re-published on topic 'image/stored'")
+    if msg.topic.startswith(CHUNK_TOPIC):
+        reassembler.feed(msg.topic[len(CHUNK_TOPIC):], msg.payload)
+    else:
+        store_and_forward(client, msg.payload, msg.topic)
 
 client = mqtt.Client()
 client.on_connect = on_connect
 client.on_message = on_message
 
-# Replace with actual broker IP if running remotely
-client.connect("localhost", 1883)
-client.loop_forever()
+# Images sent in chunks by memory constrained devices (see image_chunks.py)
+reassembler = Reassembler(
+    send_status=lambda sender, payload: client.publish(STATUS_TOPIC + sender, payload, qos=1),
+    on_image=lambda sender, image: store_and_forward(client, image, sender))
+
+client.connect(args.host, args.port)
+client.loop_start()
+try:
+    # Ask for chunks missing from quiet transfers
+    while True:
+        reassembler.poll()
+        time.sleep(0.1)
+except KeyboardInterrupt:
+    pass
+finally:
+    client.loop_stop()
+    # Write out anything still queued
+    if retention is not None:
+        retention.stop()
+    writer.close()
+    store.close()
\ No newline at end of file
@@ -0,0 +1,162 @@
+import argparse
+import socket
+import struct
+import threading
+import time
+import zlib
+import numpy as np
+import cv2
+
+import imagesocket
+
+WIDTH = 240
+HEIGHT = 240
+MODEL_SIZE = (224, 224)
+
+################################################
+# Time fn over a number of runs, returning the
+# mean milliseconds per call
+################################################
+def time_per_call(fn, runs):
+    fn()
+    start = time.perf_counter()
+    for _ in range(runs):
+        fn()
+    return (time.perf_counter() - start) * 1000.0 / runs
+
+################################################
+# Compare the original decode path with the
+# single pass decoder, at the camera resolution
+# and at the gesture model input size
+################################################
+def bench_decode(runs):
+    frame = np.random.default_rng(0).integers(0, 65536, WIDTH * HEIGHT, dtype=np.uint16).tobytes()
+
+    def original(size):
+        rgb = imagesocket.rgb565_to_rgb888(frame, WIDTH, HEIGHT)
+        bgr = cv2.cvtColor(rgb, cv2.COLOR_RGB2BGR)
+        return cv2.resize(bgr, size, interpolation=cv2.INTER_NEAREST)
+
+    for size in ((WIDTH, HEIGHT), MODEL_SIZE):
+        decoder = imagesocket.Rgb565Decoder(WIDTH, HEIGHT, size)
+        diff = np.abs(original(size).astype(int) - decoder.decode(frame)).max()
+
+        old_ms = time_per_call(lambda: original(size), runs)
+        new_ms = time_per_call(lambda: decoder.decode(frame), runs)
+        print(f"decode {WIDTH}x{HEIGHT} -> {size[0]}x{size[1]}: "
+              f"original {old_ms:.3f} ms, single pass {new_ms:.3f} ms "
+              f"({old_ms / new_ms:.1f}x), max diff {diff}")
+
+################################################
+# Build one framed frame as the ESP32S3 sends it
+################################################
+def make_frame(seq, payload):
+    header = struct.pack('<4sBBBBIIHHII', imagesocket.FRAME_MAGIC, imagesocket.FRAME_VERSION,
+                         imagesocket.PIXFMT_RGB565, 0, imagesocket.FRAME_HEADER_SIZE, seq, 0,
+                         WIDTH, HEIGHT, len(payload), zlib.crc32(payload))
+    return header + struct.pack('<I', zlib.crc32(header)) + payload
+
+# The wire format before the frame header: READY then a bare frame
+def make_ready_frame(seq, payload):
+    return b'READY' + payload
+
+################################################
+# Local fake camera: streams frames to the first
+# client as fast as the socket will take them
+################################################
+def fake_camera(server, frames, frame_format=make_frame):
+    payload = np.random.default_rng(0).integers(0, 256, WIDTH * HEIGHT * 2, dtype=np.uint8).tobytes()
+    data = [frame_format(seq, payload) for seq in range(1, 9)]
+    conn, _ = server.accept()
+    with conn:
+        for i in range(frames):
+            conn.sendall(data[i % len(data)])
+
+################################################
+# Receive loop exactly as imagesocket.py had it
+# before the frame header and FrameReceiver:
+# READY, then the frame, each read by recv()
+# calls appended to a fresh bytearray
+################################################
+def baseline_recv_exact(sock, size, timeout=5):
+    sock.settimeout(timeout)
+    data = bytearray()
+    try:
+        while len(data) < size:
+            remaining = size - len(data)
+            packet = sock.recv(remaining)
+            if not packet:
+                return None
+            data.extend(packet)
+        return data
+    except socket.timeout:
+        return None
+    except socket.error:
+        return None
+
+def baseline_recv_frame(sock):
+    ready = baseline_recv_exact(sock, 5)
+    if ready != b'READY':
+        return None
+    return baseline_recv_exact(sock, WIDTH * HEIGHT * 2)
+
+def run_receiver(name, frames, recv_frame_factory, frame_format=make_frame):
+    server = socket.create_server(('127.0.0.1', 0))
+    sender = threading.Thread(target=fake_camera, args=(server, frames, frame_format))
+    sender.start()
+
+    sock = socket.create_connection(server.getsockname())
+    recv_frame = recv_frame_factory(sock)
+    received = 0
+    wall = time.perf_counter()
+    cpu = time.process_time()
+    while recv_frame() is not None:
+        received += 1
+    wall = time.perf_counter() - wall
+    cpu = time.process_time() - cpu
+
+    sock.close()
+    sender.join()
+    server.close()
+
+    mb = received * (WIDTH * HEIGHT * 2) / 1e6
+    print(f"recv {name}: {received / wall:.0f} fps, {mb / wall:.0f} MB/s, "
+          f"{cpu * 1000.0 / received:.3f} ms CPU per frame")
+
+################################################
+# Compare receive throughput against a local
+# fake camera server
+################################################
+def bench_recv(frames):
+    run_receiver("baseline", frames, lambda sock: lambda: baseline_recv_frame(sock),
+                 frame_format=make_ready_frame)
+    run_receiver("recv_into", frames, lambda sock: imagesocket.FrameReceiver(sock).recv_frame)
+
+    # The baseline has no header or checksum; this is what the payload
+    # CRC alone costs the framed receiver per frame
+    payload = bytes(WIDTH * HEIGHT * 2)
+    print(f"recv payload crc32: {time_per_call(lambda: zlib.crc32(payload), 200):.3f} ms per frame")
+
+def main():
+    parser = argparse.ArgumentParser(description="imagesocket.py microbenchmarks")
+    # No choices=: argparse before 3.12 checks an empty nargs='*' list
+    # against them and rejects it, so the names are checked below
+    parser.add_argument('bench', nargs='*', help="decode and/or recv (default: both)")
+    parser.add_argument('--runs', type=int, default=500)
+    parser.add_argument('--frames', type=int, default=2000)
+    args = parser.parse_args()
+
+    benches = ['decode', 'recv']
+    for name in args.bench:
+        if name not in benches:
+            parser.error(f"unknown benchmark {name!r} (choose from {', '.join(benches)})")
+    if not args.bench:
+        args.bench = benches
+
+    if 'decode' in args.bench:
+        bench_decode(args.runs)
+    if 'recv' in args.bench:
+        bench_recv(args.frames)
+
+if __name__ == "__main__":
+    main()
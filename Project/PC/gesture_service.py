@@ -0,0 +1,234 @@
+import argparse
+import os
+import queue
+import socket
+import sys
+import threading
+import time
+import numpy as np
+
+import imagesocket
+
+# The gesture model lives next to the training scripts
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'gesture_recognition'))
+from prep_img import Preprocessor
+
+MODEL_SIZE = (224, 224)
+# Decoded model inputs: one being filled, one queued, one being classified
+DECODE_SLOTS = 3
+LATENCY_KPI_MS = 2000
+REPORT_EVERY = 50
+
+################################################
+# Single slot queue between two stages: a new
+# item replaces one that was not yet taken, so
+# a slow stage always works on the latest frame
+################################################
+class LatestQueue:
+    def __init__(self):
+        self._cond = threading.Condition()
+        self._item = None
+        self._closed = False
+        self.dropped = 0
+
+    # Returns the item that was replaced, if any
+    def put(self, item):
+        with self._cond:
+            replaced = self._item
+            if replaced is not None:
+                self.dropped += 1
+            self._item = item
+            self._cond.notify()
+        return replaced
+
+    def get(self):
+        with self._cond:
+            while self._item is None and not self._closed:
+                self._cond.wait()
+            item, self._item = self._item, None
+            return item
+
+    def close(self):
+        with self._cond:
+            self._closed = True
+            self._cond.notify_all()
+
+################################################
+# A frame moving through the pipeline, with the
+# host time it reached each stage
+################################################
+class FrameJob:
+    def __init__(self, header, payload, latency_ms):
+        self.header = header
+        self.payload = payload
+        self.network_ms = latency_ms
+        self.received = time.perf_counter()
+        self.decoded = None
+        self.prep = None
+
+################################################
+# Rolling per stage latency statistics
+################################################
+class StageStats:
+    def __init__(self, names):
+        self._samples = {name: [] for name in names}
+        self._lock = threading.Lock()
+
+    def add(self, **values):
+        with self._lock:
+            for name, value in values.items():
+                self._samples[name].append(value)
+
+    def report(self):
+        with self._lock:
+            lines = []
+            for name, samples in self._samples.items():
+                if samples:
+                    p50, p95 = np.percentile(samples, [50, 95])
+                    lines.append(f"{name} p50 {p50:.1f} ms p95 {p95:.1f} ms")
+                samples.clear()
+        return ", ".join(lines)
+
+################################################
+# Stage 1: receive frames into the pooled
+# buffers of imagesocket.FrameReceiver
+################################################
+def receive_stage(receiver, out_queue):
+    stream = imagesocket.StreamStats()
+    try:
+        while True:
+            result = receiver.recv_frame()
+            if result is None:
+                break
+            header, payload = result
+            if header.pixfmt == imagesocket.PIXFMT_GESTURE:
+                # Classified on the ESP32S3, nothing left to do here
+                if payload is not None:
+                    label, confidence, infer_ms = imagesocket.parse_gesture(payload)
+                    print(f"Frame {header.seq}: {label} ({confidence:.2f}) on device in {infer_ms} ms")
+                continue
+
+            stream.update(header)
+            if payload is not None:
+                # A frame the decode stage never took hands its buffer back
+                replaced = out_queue.put(FrameJob(header, payload, stream.latency_ms))
+                if replaced is not None:
+                    receiver.release(replaced.payload)
+    finally:
+        print(f"Receiver stopped: {stream}")
+        out_queue.close()
+
+################################################
+# Stage 2: decode RGB565 or JPEG into the model
+# input batch of a free preprocessor slot
+################################################
+def decode_stage(in_queue, out_queue, free_slots, receiver):
+    try:
+        while True:
+            job = in_queue.get()
+            if job is None:
+                break
+
+            prep = free_slots.get()
+            try:
+                prep.load(0, job.payload, job.header.pixfmt, job.header.width, job.header.height)
+            except ValueError as e:
+                print(f"Frame {job.header.seq}: {e}")
+                free_slots.put(prep)
+                continue
+            finally:
+                # The pooled payload is not referenced past this point
+                receiver.release(job.payload)
+                job.payload = None
+
+            job.prep = prep
+            job.decoded = time.perf_counter()
+
+            # A frame the inference stage never took hands its slot back
+            replaced = out_queue.put(job)
+            if replaced is not None:
+                free_slots.put(replaced.prep)
+    finally:
+        out_queue.close()
+
+################################################
+# Stage 3: classify the newest decoded frame
+################################################
+def inference_stage(in_queue, free_slots, stats, on_decision, model_path=None):
+    import predict
+    from predict import classify_array
+
+    if model_path is not None:
+        predict.load(model_path)
+
+    frames = 0
+    while True:
+        job = in_queue.get()
+        if job is None:
+            break
+        started = time.perf_counter()
+        label, confidence = classify_array(job.prep.batch)
+        done = time.perf_counter()
+        free_slots.put(job.prep)
+
+        # Frame to decision: network delay over the best case seen, plus
+        # the time from the frame arriving to the model's answer
+        total_ms = job.network_ms + (done - job.received) * 1000.0
+        stats.add(decode=(job.decoded - job.received) * 1000.0,
+                  queue=(started - job.decoded) * 1000.0,
+                  infer=(done - started) * 1000.0,
+                  total=total_ms)
+        on_decision(job.header, label, confidence, total_ms)
+
+        frames += 1
+        if frames % REPORT_EVERY == 0:
+            print(stats.report())
+
+def print_decision(header, label, confidence, total_ms):
+    kpi = "ok" if total_ms <= LATENCY_KPI_MS else "OVER KPI"
+    print(f"Frame {header.seq}: {label} ({confidence:.2f}) after {total_ms:.0f} ms [{kpi}]")
+
+################################################
+# Connect to the ESP32S3 and run the receive,
+# decode and inference stages concurrently
+################################################
+def main():
+    parser = argparse.ArgumentParser(description="Live gesture classification from the ESP32S3 camera")
+    parser.add_argument('--host', default=imagesocket.HOST)
+    parser.add_argument('--port', type=int, default=imagesocket.PORT)
+    parser.add_argument('--model', help="Keras .h5 or quantised .tflite model (default: the .h5)")
+    args = parser.parse_args()
+
+    sock = socket.create_connection((args.host, args.port))
+    print(f"Connected to {args.host}:{args.port}")
+
+    decode_queue = LatestQueue()
+    infer_queue = LatestQueue()
+    stats = StageStats(['decode', 'queue', 'infer', 'total'])
+    free_slots = queue.Queue()
+    for _ in range(DECODE_SLOTS):
+        free_slots.put(Preprocessor(target_size=MODEL_SIZE))
+
+    # Payload buffers go back to the receiver once decoded, so it waits
+    # rather than overwrite a frame still queued or being decoded
+    receiver = imagesocket.FrameReceiver(sock, pool_size=4, explicit_release=True)
+
+    stages = [
+        threading.Thread(target=receive_stage, args=(receiver, decode_queue), daemon=True),
+        threading.Thread(target=decode_stage, args=(decode_queue, infer_queue, free_slots, receiver),
+                         daemon=True),
+    ]
+    for stage in stages:
+        stage.start()
+
+    try:
+        inference_stage(infer_queue, free_slots, stats, print_decision, args.model)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        sock.close()
+        print(f"Dropped before decode: {decode_queue.dropped}, before inference: {infer_queue.dropped}")
+        print(stats.report())
+
+if __name__ == "__main__":
+    main()
@@ -1,20 +1,56 @@
+import queue
 import socket
+import struct
+import time
+import zlib
 import numpy as np
 import cv2
 
 HOST = '172.20.10.10'
 PORT = 5000
-WIDTH = 240
-HEIGHT = 240
-FRAME_SIZE = WIDTH * HEIGHT * 2
-READY_SIZE = 5
+
+# Frame header sent by the ESP32S3 (see ESP32_EYE/src/frame_proto.h)
+FRAME_MAGIC = b'DPFR'
+FRAME_VERSION = 1
+FRAME_HEADER = struct.Struct('<4sBBBBIIHHIII')
+FRAME_HEADER_SIZE = FRAME_HEADER.size
+MAX_PAYLOAD = 4 * 1024 * 1024
+
+PIXFMT_RGB565 = 1
+PIXFMT_JPEG = 2
+PIXFMT_GESTURE = 3
+
+# On-device classification result (struct frame_gesture)
+GESTURE = struct.Struct('<BBH')
+# Same order as LABELS in gesture_recognition/inference.py
+GESTURE_LABELS = ['0', '1', '2', '3', '4', '5', 'phone']
+
+class FrameHeader:
+    def __init__(self, raw):
+        (self.magic, self.version, self.pixfmt, self.flags, self.hdr_len,
+         self.seq, self.timestamp, self.width, self.height,
+         self.payload_len, self.payload_crc, self.hdr_crc) = FRAME_HEADER.unpack(raw)
+        self.valid = (self.magic == FRAME_MAGIC
+                      and self.version == FRAME_VERSION
+                      and self.hdr_len == FRAME_HEADER_SIZE
+                      and self.payload_len <= MAX_PAYLOAD
+                      and zlib.crc32(raw[:-4]) == self.hdr_crc)
+
+################################################
+# Unpack a gesture result classified on the
+# ESP32S3: (label, confidence 0-1, device ms)
+################################################
+def parse_gesture(payload):
+    label, confidence, infer_ms = GESTURE.unpack(payload[:GESTURE.size])
+    name = GESTURE_LABELS[label] if label < len(GESTURE_LABELS) else str(label)
+    return name, confidence / 100.0, infer_ms
 
 ################################################
 # Convert the RGB565 image data to RGB888
 ################################################
-def rgb565_to_rgb888(frame):
+def rgb565_to_rgb888(frame, width, height):
     # Read the data using byteswap for little endian
-    data = np.frombuffer(frame, dtype=np.uint16).byteswap().reshape((HEIGHT, WIDTH))
+    data = np.frombuffer(frame, dtype=np.uint16).byteswap().reshape((height, width))
 
     r = ((data >> 11) & 0x1F) << 3
     g = ((data >> 5) & 0x3F) << 2
@@ -28,27 +64,191 @@ def rgb565_to_rgb888(frame):
     return rgb
 
 ################################################
-# Receive READY message and image data from
-# ESP32S3 server
+# Single pass RGB565 decoder: one 32 bit table
+# lookup per output pixel into preallocated
+# buffers, with optional nearest neighbour resize
+################################################
+class Rgb565Decoder:
+    _luts = {}
+
+    def __init__(self, width, height, out_size=None, order='bgr'):
+        self.width = width
+        self.height = height
+        out_w, out_h = out_size or (width, height)
+        self.out = np.empty((out_h, out_w, 3), dtype=np.uint8)
+        self._packed = np.empty(out_h * out_w, dtype=np.uint32)
+        self._packed_view = self._packed.view(np.uint8).reshape(out_h, out_w, 4)
+        self._lut = self._table(order)
+
+        # Source pixel for every output pixel, as cv2.INTER_NEAREST picks it
+        if (out_w, out_h) != (width, height):
+            ys = np.arange(out_h) * height // out_h
+            xs = np.arange(out_w) * width // out_w
+            self._index = (ys[:, None] * width + xs[None, :]).ravel().astype(np.intp)
+            self._pixels = np.empty(self._index.shape, dtype=np.uint16)
+        else:
+            self._index = None
+
+    @classmethod
+    def _table(cls, order):
+        # Indexed by the raw little endian read of the big endian pixel, so
+        # the byteswap is folded into the table. Entries are packed as four
+        # bytes because numpy gathers whole words far faster than triplets.
+        if order not in cls._luts:
+            raw = np.arange(65536, dtype=np.uint32)
+            v = ((raw & 0xFF) << 8) | (raw >> 8)
+            r = ((v >> 11) & 0x1F) << 3
+            g = ((v >> 5) & 0x3F) << 2
+            b = (v & 0x1F) << 3
+            r |= r >> 5
+            g |= g >> 6
+            b |= b >> 5
+            first, third = (b, r) if order == 'bgr' else (r, b)
+            cls._luts[order] = first | (g << 8) | (third << 16)
+        return cls._luts[order]
+
+    def decode(self, frame):
+        pixels = np.frombuffer(frame, dtype='<u2', count=self.width * self.height)
+        if self._index is not None:
+            np.take(pixels, self._index, out=self._pixels, mode='clip')
+            pixels = self._pixels
+        np.take(self._lut, pixels, out=self._packed, mode='clip')
+        # Drop the padding byte into the contiguous output
+        return cv2.cvtColor(self._packed_view, cv2.COLOR_BGRA2BGR, dst=self.out)
+
+################################################
+# Receive frames from the ESP32S3 server
+# straight into a small pool of preallocated
+# buffers with recv_into, so no per frame
+# allocation or copy is made.
+# By default payload views stay valid until the
+# pool wraps around to them again. With
+# explicit_release, a buffer is only reused
+# after release(payload), and recv_frame waits
+# for one to be released when all are in use.
 ################################################
-def recv_exact(sock, size, timeout=5):
-    sock.settimeout(timeout)
-    data = bytearray()
-    try:
-        while len(data) < size:
-            remaining = size - len(data)
-            packet = sock.recv(remaining)
-            if not packet:
-                print("Socket closed/ Connection lost")
+class FrameReceiver:
+    def __init__(self, sock, pool_size=3, timeout=5, frame_size=240 * 240 * 2,
+                 explicit_release=False):
+        self.sock = sock
+        self.sock.settimeout(timeout)
+        self._header = bytearray(FRAME_HEADER_SIZE)
+        self._header_view = memoryview(self._header)
+        self._pool = [bytearray(frame_size) for _ in range(pool_size)]
+        self._next = 0
+        self._free = None
+        if explicit_release:
+            self._free = queue.Queue()
+            for buf in self._pool:
+                self._free.put(buf)
+
+    # Hand back the buffer behind a payload from recv_frame
+    def release(self, payload):
+        if self._free is not None:
+            self._free.put(payload.obj)
+
+    def _take_buffer(self, size):
+        if self._free is not None:
+            buf = self._free.get()
+        else:
+            buf = self._pool[self._next]
+        if len(buf) < size:
+            buf = bytearray(size)
+            if self._free is None:
+                self._pool[self._next] = buf
+        if self._free is None:
+            self._next = (self._next + 1) % len(self._pool)
+        return buf
+
+    def _recv_into(self, view):
+        try:
+            while len(view):
+                n = self.sock.recv_into(view)
+                if n == 0:
+                    print("Socket closed/ Connection lost")
+                    return False
+                view = view[n:]
+            return True
+        except socket.timeout:
+            print("Socket timed out while waiting for data.")
+            return False
+        except socket.error as e:
+            print(f"Socket error: {e}")
+            return False
+
+    ################################################
+    # Receive the next valid frame header, scanning
+    # forward for the magic after a desync
+    ################################################
+    def recv_header(self):
+        raw = self._header
+        if not self._recv_into(self._header_view):
+            return None
+        skipped = 0
+        while True:
+            header = FrameHeader(raw)
+            if header.valid:
+                if skipped:
+                    print(f"Resynchronised after skipping {skipped} bytes")
+                return header
+
+            # Drop bytes up to the next candidate magic and top the header back up
+            start = raw.find(FRAME_MAGIC, 1)
+            if start < 0:
+                start = len(raw) - (len(FRAME_MAGIC) - 1)
+            skipped += start
+            raw[:-start] = raw[start:]
+            if not self._recv_into(self._header_view[-start:]):
                 return None
-            data.extend(packet)
-        return data
-    except socket.timeout:
-        print("Socket timed out while waiting for data.")
-        return None
-    except socket.error as e:
-        print(f"Socket error: {e}")
-        return None
+
+    ################################################
+    # Receive one frame; returns (header, payload
+    # memoryview), (header, None) on a corrupt
+    # payload, or None once the connection is lost
+    ################################################
+    def recv_frame(self):
+        header = self.recv_header()
+        if header is None:
+            return None
+
+        payload = memoryview(self._take_buffer(header.payload_len))[:header.payload_len]
+        if not self._recv_into(payload):
+            self.release(payload)
+            return None
+        if zlib.crc32(payload) != header.payload_crc:
+            print(f"Frame {header.seq}: payload CRC mismatch, dropping")
+            self.release(payload)
+            return header, None
+        return header, payload
+
+################################################
+# Track drops and latency from the frame
+# sequence numbers and capture timestamps
+################################################
+class StreamStats:
+    def __init__(self):
+        self.last_seq = None
+        self.frames = 0
+        self.dropped = 0
+        self.min_offset = None
+        self.latency_ms = 0.0
+
+    def update(self, header):
+        if self.last_seq is not None and header.seq > self.last_seq + 1:
+            self.dropped += header.seq - self.last_seq - 1
+        self.last_seq = header.seq
+        self.frames += 1
+
+        # The device clock is ms since boot, so latency is reported relative
+        # to the fastest frame seen (the best case one-way delay)
+        offset = time.monotonic() * 1000.0 - header.timestamp
+        if self.min_offset is None or offset < self.min_offset:
+            self.min_offset = offset
+        self.latency_ms = offset - self.min_offset
+
+    def __str__(self):
+        return (f"frame {self.last_seq}: {self.frames} received, {self.dropped} dropped, "
+                f"+{self.latency_ms:.1f} ms latency over best case")
 
 ################################################
 # Connect to the TCP socket created by the
@@ -60,19 +260,43 @@ def main():
     s.connect((HOST, PORT))
     print(f"Connected to {HOST}:{PORT}")
 
+    receiver = FrameReceiver(s)
+    stats = StreamStats()
+    decoder = None
+
     while True:
-        ready = recv_exact(s, READY_SIZE)
-        if ready != b'READY':
-            print("Error:", ready)
-            return
-        frame = recv_exact(s, FRAME_SIZE)
-        if frame is None:
-            print("Connection closed / recv_exact failure")
+        result = receiver.recv_frame()
+        if result is None:
+            print("Connection closed / receive failure")
             break
 
-        rgb_img = rgb565_to_rgb888(frame)
-        bgr_img = cv2.cvtColor(rgb_img, cv2.COLOR_RGB2BGR)
-        cv2.imshow("ESP32 Frame", cv2.resize(bgr_img, (480, 480), interpolation=cv2.INTER_NEAREST))
+        header, frame = result
+        if header.pixfmt == PIXFMT_GESTURE:
+            if frame is not None:
+                label, confidence, infer_ms = parse_gesture(frame)
+                print(f"Frame {header.seq}: device classified {label} ({confidence:.2f}) in {infer_ms} ms")
+            continue
+
+        stats.update(header)
+        if frame is None:
+            continue
+        if stats.frames % 50 == 0:
+            print(stats)
+
+        if header.pixfmt == PIXFMT_RGB565:
+            # Decode straight to the 480x480 window size
+            if decoder is None or (decoder.width, decoder.height) != (header.width, header.height):
+                decoder = Rgb565Decoder(header.width, header.height, (480, 480))
+            cv2.imshow("ESP32 Frame", decoder.decode(frame))
+        elif header.pixfmt == PIXFMT_JPEG:
+            bgr_img = cv2.imdecode(np.frombuffer(frame, dtype=np.uint8), cv2.IMREAD_COLOR)
+            if bgr_img is None:
+                print(f"Frame {header.seq}: JPEG decode failed")
+                continue
+            cv2.imshow("ESP32 Frame", cv2.resize(bgr_img, (480, 480), interpolation=cv2.INTER_NEAREST))
+        else:
+            print(f"Frame {header.seq}: unsupported pixel format {header.pixfmt}")
+            continue
 
         if cv2.waitKey(1) & 0xFF == ord('q'):
             break
@@ -81,4 +305,4 @@ def main():
     cv2.destroyAllWindows()
 
 if __name__ == "__main__":
-    main()
\ No newline at end of file
+    main()
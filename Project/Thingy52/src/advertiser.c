@@ -0,0 +1,124 @@
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/logging/log.h>
+
+#include "advertiser.h"
+
+LOG_MODULE_REGISTER(advertiser);
+
+static uint8_t mfg_data[ADVERTISER_MAX_DATA];
+
+static struct bt_data ad[] = {
+	BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_NO_BREDR),
+	BT_DATA(BT_DATA_MANUFACTURER_DATA, mfg_data, 0),
+};
+
+// Guards the payload, the interval and the stats
+static K_MUTEX_DEFINE(adv_lock);
+
+static bool fast;
+static int64_t burst_started;
+static struct advertiser_stats stats;
+static struct k_work_delayable burst_end_work;
+
+/*
+ * The interval is fixed while a set is advertising, so changing it
+ * means stopping and starting again with the current payload
+ */
+static int adv_restart(bool fast_interval)
+{
+	const struct bt_le_adv_param *param = fast_interval ?
+		BT_LE_ADV_PARAM(BT_LE_ADV_OPT_NONE, ADV_FAST_INT_MIN, ADV_FAST_INT_MAX, NULL) :
+		BT_LE_ADV_PARAM(BT_LE_ADV_OPT_NONE, ADV_SLOW_INT_MIN, ADV_SLOW_INT_MAX, NULL);
+	int err;
+
+	bt_le_adv_stop();
+	err = bt_le_adv_start(param, ad, ARRAY_SIZE(ad), NULL, 0);
+	if (err) {
+		LOG_ERR("Advertising failed to start (err %d)", err);
+		return err;
+	}
+
+	fast = fast_interval;
+	return 0;
+}
+
+static void burst_end(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	k_mutex_lock(&adv_lock, K_FOREVER);
+	if (fast) {
+		stats.fast_ms += (uint32_t)(k_uptime_get() - burst_started);
+		adv_restart(false);
+		LOG_DBG("Back to the slow interval");
+	}
+	k_mutex_unlock(&adv_lock);
+}
+
+int advertiser_start(const uint8_t *data, size_t len)
+{
+	int err;
+
+	if (len > sizeof(mfg_data)) {
+		return -EINVAL;
+	}
+
+	k_work_init_delayable(&burst_end_work, burst_end);
+
+	k_mutex_lock(&adv_lock, K_FOREVER);
+	memcpy(mfg_data, data, len);
+	ad[1].data_len = len;
+	err = adv_restart(false);
+	k_mutex_unlock(&adv_lock);
+
+	return err;
+}
+
+int advertiser_update(const uint8_t *data, size_t len, bool urgent)
+{
+	int err;
+
+	if (len > sizeof(mfg_data)) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&adv_lock, K_FOREVER);
+
+	memcpy(mfg_data, data, len);
+	ad[1].data_len = len;
+	stats.updates++;
+
+	if (urgent && !fast) {
+		// Restarting picks up the new payload as well
+		err = adv_restart(true);
+		if (!err) {
+			burst_started = k_uptime_get();
+			stats.bursts++;
+		}
+	} else {
+		err = bt_le_adv_update_data(ad, ARRAY_SIZE(ad), NULL, 0);
+		if (err) {
+			LOG_ERR("Advertising data update failed (err %d)", err);
+		}
+	}
+
+	if (urgent && fast) {
+		k_work_reschedule(&burst_end_work, K_MSEC(ADV_BURST_MS));
+	}
+
+	k_mutex_unlock(&adv_lock);
+	return err;
+}
+
+void advertiser_get_stats(struct advertiser_stats *out)
+{
+	k_mutex_lock(&adv_lock, K_FOREVER);
+	*out = stats;
+	if (fast) {
+		out->fast_ms += (uint32_t)(k_uptime_get() - burst_started);
+	}
+	k_mutex_unlock(&adv_lock);
+}
@@ -0,0 +1,54 @@
+/*
+ * BLE advertising scheduler
+ *
+ * Advertising runs continuously from advertiser_start() on, at a slow
+ * interval that keeps the radio mostly idle. New readings replace the
+ * payload in place with bt_le_adv_update_data, so a scanner sees them on
+ * the next advertising event without the set being restarted. An urgent
+ * update also switches to a fast interval for ADV_BURST_MS, so the base
+ * node hears it within tens of milliseconds; the slow interval returns
+ * by itself once the burst is over.
+ */
+
+#ifndef ADVERTISER_H_
+#define ADVERTISER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest manufacturer data payload that fits a legacy advertisement:
+// 31 bytes, less 3 for the flags AD and 2 for this AD's length and type
+#define ADVERTISER_MAX_DATA 26
+
+// Slow interval, 1 s to 1.2 s, in 0.625 ms units
+#define ADV_SLOW_INT_MIN 0x0640
+#define ADV_SLOW_INT_MAX 0x0780
+// Burst interval, 20 ms to 30 ms
+#define ADV_FAST_INT_MIN 0x0020
+#define ADV_FAST_INT_MAX 0x0030
+// How long the fast interval lasts after an urgent update
+#define ADV_BURST_MS     1000
+
+struct advertiser_stats {
+	uint32_t updates;	/* payload changes */
+	uint32_t bursts;	/* switches to the fast interval */
+	uint32_t fast_ms;	/* time spent at the fast interval */
+};
+
+/*
+ * Start advertising the manufacturer data at the slow interval.
+ * Bluetooth must already be enabled. Returns 0 or a negative errno.
+ */
+int advertiser_start(const uint8_t *data, size_t len);
+
+/*
+ * Replace the advertised manufacturer data. With urgent set the fast
+ * interval is started, or extended if a burst is already running.
+ * Returns 0 or a negative errno.
+ */
+int advertiser_update(const uint8_t *data, size_t len, bool urgent);
+
+void advertiser_get_stats(struct advertiser_stats *stats);
+
+#endif /* ADVERTISER_H_ */
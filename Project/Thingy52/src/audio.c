@@ -0,0 +1,158 @@
+#include <zephyr/kernel.h>
+#include <zephyr/audio/dmic.h>
+#include <zephyr/logging/log.h>
+
+#include "audio.h"
+
+LOG_MODULE_REGISTER(audio);
+
+#define SAMPLE_BIT_WIDTH 16
+#define BLOCK_SIZE       (AUDIO_BLOCK_SAMPLES * sizeof(int16_t))
+/* Milliseconds to wait for a block to be read. */
+#define READ_TIMEOUT     (AUDIO_BLOCK_MS * 10)
+
+#define AUDIO_STACK_SIZE 2048
+#define AUDIO_PRIORITY   K_PRIO_PREEMPT(2)
+
+/* Driver will allocate blocks from this slab to receive audio data into them.
+ * The audio thread frees each block as soon as it has been processed.
+ */
+K_MEM_SLAB_DEFINE_STATIC(mem_slab, BLOCK_SIZE, AUDIO_BLOCK_COUNT, 4);
+
+K_THREAD_STACK_DEFINE(audio_stack, AUDIO_STACK_SIZE);
+static struct k_thread audio_thread;
+
+static const struct device *dmic;
+static audio_block_handler_t block_handler;
+
+static struct pcm_stream_cfg stream = {
+	.pcm_width = SAMPLE_BIT_WIDTH,
+	.pcm_rate = AUDIO_SAMPLE_RATE,
+	.block_size = BLOCK_SIZE,
+	.mem_slab = &mem_slab,
+};
+
+static struct dmic_cfg cfg = {
+	.io = {
+		/* These fields can be used to limit the PDM clock
+		 * configurations that the driver is allowed to use
+		 * to those supported by the microphone.
+		 */
+		.min_pdm_clk_freq = 1000000,
+		.max_pdm_clk_freq = 3250000,
+		.min_pdm_clk_dc   = 40,
+		.max_pdm_clk_dc   = 60,
+	},
+	.streams = &stream,
+	.channel = {
+		.req_num_streams = 1,
+		.req_num_chan = 1,
+	},
+};
+
+static struct audio_stats stats;
+static K_SPINLOCK_DEFINE(stats_lock);
+
+static int audio_restart(void)
+{
+	int ret;
+
+	dmic_trigger(dmic, DMIC_TRIGGER_STOP);
+	ret = dmic_trigger(dmic, DMIC_TRIGGER_START);
+	if (ret < 0) {
+		LOG_ERR("START trigger failed: %d", ret);
+	}
+	return ret;
+}
+
+/*
+ * Takes blocks in capture order for as long as the device runs. Blocks
+ * the driver dropped because none were free show up as a shortfall
+ * against the time elapsed.
+ */
+static void audio_thread_fn(void *p1, void *p2, void *p3)
+{
+	int64_t started = k_uptime_get();
+	uint32_t failures = 0;
+
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	while (1) {
+		void *buffer;
+		uint32_t size;
+		uint32_t start, took_us;
+		int64_t now;
+		int ret;
+
+		ret = dmic_read(dmic, 0, &buffer, &size, READ_TIMEOUT);
+		if (ret < 0) {
+			LOG_ERR("read failed: %d", ret);
+			K_SPINLOCK(&stats_lock) {
+				stats.read_errors++;
+			}
+			// The stream has stalled; restart it rather than stay deaf
+			if (++failures >= 3 && audio_restart() == 0) {
+				started = k_uptime_get();
+				K_SPINLOCK(&stats_lock) {
+					stats.blocks = 0;
+				}
+				failures = 0;
+			}
+			continue;
+		}
+		failures = 0;
+
+		now = k_uptime_get();
+		start = k_cycle_get_32();
+		block_handler((const int16_t *)buffer, size / sizeof(int16_t), now);
+		took_us = k_cyc_to_us_ceil32(k_cycle_get_32() - start);
+
+		k_mem_slab_free(&mem_slab, buffer);
+
+		K_SPINLOCK(&stats_lock) {
+			uint32_t expected = (now - started) / AUDIO_BLOCK_MS;
+
+			stats.blocks++;
+			stats.dropped = expected > stats.blocks ? expected - stats.blocks : 0;
+			stats.max_process_us = MAX(stats.max_process_us, took_us);
+		}
+	}
+}
+
+int audio_start(const struct device *dmic_dev, audio_block_handler_t handler)
+{
+	int ret;
+
+	dmic = dmic_dev;
+	block_handler = handler;
+
+	cfg.channel.req_chan_map_lo = dmic_build_channel_map(0, 0, PDM_CHAN_LEFT);
+
+	ret = dmic_configure(dmic, &cfg);
+	if (ret < 0) {
+		LOG_ERR("Failed to configure the driver: %d", ret);
+		return ret;
+	}
+
+	ret = dmic_trigger(dmic, DMIC_TRIGGER_START);
+	if (ret < 0) {
+		LOG_ERR("START trigger failed: %d", ret);
+		return ret;
+	}
+
+	k_thread_create(&audio_thread, audio_stack, K_THREAD_STACK_SIZEOF(audio_stack),
+			audio_thread_fn, NULL, NULL, NULL, AUDIO_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&audio_thread, "audio");
+
+	LOG_INF("Capturing %d ms blocks at %d Hz", AUDIO_BLOCK_MS, AUDIO_SAMPLE_RATE);
+	return 0;
+}
+
+void audio_get_stats(struct audio_stats *out)
+{
+	K_SPINLOCK(&stats_lock) {
+		*out = stats;
+	}
+}
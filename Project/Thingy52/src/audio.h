@@ -0,0 +1,46 @@
+/*
+ * Continuous PDM microphone capture
+ *
+ * The DMIC is configured and started once and then runs permanently into
+ * a ring of AUDIO_BLOCK_COUNT slab blocks. A dedicated thread takes each
+ * block as the driver completes it, hands it to the block handler and
+ * frees it straight away, so the microphone is never deaf between reads.
+ */
+
+#ifndef AUDIO_H_
+#define AUDIO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/device.h>
+
+#define AUDIO_SAMPLE_RATE 16000
+// Block length; also the granularity at which sound is analysed
+#define AUDIO_BLOCK_MS    20
+#define AUDIO_BLOCK_SAMPLES (AUDIO_SAMPLE_RATE * AUDIO_BLOCK_MS / 1000)
+// Blocks the driver can fill before the thread must have taken one
+#define AUDIO_BLOCK_COUNT 8
+
+/*
+ * Called on the audio thread for every block of mono 16 bit PCM.
+ * timestamp is the uptime in ms at which the block finished capturing.
+ * The samples are only valid for the duration of the call.
+ */
+typedef void (*audio_block_handler_t)(const int16_t *samples, size_t count, int64_t timestamp);
+
+struct audio_stats {
+	uint32_t blocks;	/* blocks handled since start */
+	uint32_t dropped;	/* blocks the driver had to discard */
+	uint32_t read_errors;
+	uint32_t max_process_us;	/* longest time the handler took */
+};
+
+/*
+ * Configure the microphone, start it and the processing thread.
+ * Returns 0 or a negative errno.
+ */
+int audio_start(const struct device *dmic_dev, audio_block_handler_t handler);
+
+void audio_get_stats(struct audio_stats *stats);
+
+#endif /* AUDIO_H_ */
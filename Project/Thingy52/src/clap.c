@@ -0,0 +1,108 @@
+#include "clap.h"
+
+#ifdef CONFIG_CMSIS_DSP
+#include <arm_math.h>
+#endif
+
+/*
+ * Mean square of one window. Sum of squares as CMSIS-DSP arm_power_q15
+ * computes it (dual MAC on Cortex-M4), or the same in portable C.
+ */
+static uint32_t window_energy(const int16_t *x, size_t n)
+{
+	int64_t sum;
+
+#ifdef CONFIG_CMSIS_DSP
+	arm_power_q15((const q15_t *)x, n, &sum);
+#else
+	sum = 0;
+	for (size_t i = 0; i < n; i++) {
+		sum += (int32_t)x[i] * x[i];
+	}
+#endif
+	return (uint32_t)(sum / (int64_t)n);
+}
+
+/*
+ * Track the background level: follow quieter windows quickly and louder
+ * ones slowly, so a clap barely moves it but a room getting noisier does
+ */
+static void update_floor(struct clap_detector *det, uint32_t energy)
+{
+	if (energy < det->floor) {
+		det->floor -= (det->floor - energy) >> 3;
+	} else {
+		det->floor += (energy - det->floor) >> 8;
+	}
+	if (det->floor < CLAP_FLOOR_MIN) {
+		det->floor = CLAP_FLOOR_MIN;
+	}
+}
+
+void clap_detector_init(struct clap_detector *det)
+{
+	det->state = CLAP_IDLE;
+	det->floor = CLAP_FLOOR_MIN;
+	det->prev_energy = CLAP_FLOOR_MIN;
+	det->peak = 0;
+	det->onset_floor = 0;
+	det->onset = 0;
+	det->refractory_until = 0;
+}
+
+size_t clap_detector_process(struct clap_detector *det, const int16_t *samples, size_t count,
+			     int64_t start_ms, struct clap_event *events, size_t max_events)
+{
+	size_t found = 0;
+
+	for (size_t w = 0; w + CLAP_WINDOW_SAMPLES <= count; w += CLAP_WINDOW_SAMPLES) {
+		int64_t now = start_ms + (int64_t)(w / CLAP_WINDOW_SAMPLES) * CLAP_WINDOW_MS;
+		uint32_t energy = window_energy(samples + w, CLAP_WINDOW_SAMPLES);
+		uint64_t loud = (uint64_t)det->floor * CLAP_ONSET_RATIO;
+
+		switch (det->state) {
+		case CLAP_IDLE:
+			if (now >= det->refractory_until &&
+			    energy >= CLAP_MIN_ENERGY && energy > loud &&
+			    energy > (uint64_t)det->prev_energy * CLAP_ATTACK_RATIO) {
+				det->state = CLAP_ACTIVE;
+				det->onset = now;
+				det->peak = energy;
+				det->onset_floor = det->floor;
+			} else {
+				update_floor(det, energy);
+			}
+			break;
+
+		case CLAP_ACTIVE:
+			if (energy > det->peak) {
+				det->peak = energy;
+			}
+			if ((uint64_t)energy * CLAP_DECAY_RATIO <= det->peak) {
+				// Short and sharp: a clap
+				if (found < max_events) {
+					events[found].timestamp = det->onset;
+					events[found].peak = det->peak;
+					events[found].floor = det->onset_floor;
+					events[found].duration_ms = (uint16_t)(now - det->onset);
+					found++;
+				}
+				det->refractory_until = det->onset + CLAP_REFRACTORY_MS;
+				det->state = CLAP_IDLE;
+			} else if (now - det->onset > CLAP_MAX_MS) {
+				det->state = CLAP_SUSTAINED;
+			}
+			break;
+
+		case CLAP_SUSTAINED:
+			if (energy <= loud) {
+				det->state = CLAP_IDLE;
+			}
+			break;
+		}
+
+		det->prev_energy = energy;
+	}
+
+	return found;
+}
@@ -0,0 +1,75 @@
+/*
+ * Block based clap detector
+ *
+ * Each audio block is cut into CLAP_WINDOW_SAMPLES windows and the mean
+ * square energy of every window is computed in fixed point. A clap is a
+ * window far above the adaptive noise floor that also rises sharply from
+ * the window before it, and whose energy falls away again within
+ * CLAP_MAX_MS; louder sounds that last longer (speech, music, knocks
+ * that ring) are rejected. After a clap the detector ignores onsets for
+ * CLAP_REFRACTORY_MS so its echo is not counted twice.
+ *
+ * Window energy uses the CMSIS-DSP arm_power_q15 kernel when
+ * CONFIG_CMSIS_DSP is enabled and portable C otherwise, and nothing else
+ * depends on Zephyr, so the detector can also be built on a host and fed
+ * recorded audio.
+ */
+
+#ifndef CLAP_H_
+#define CLAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CLAP_SAMPLE_RATE    16000
+#define CLAP_WINDOW_SAMPLES 80	/* 5 ms */
+#define CLAP_WINDOW_MS      (CLAP_WINDOW_SAMPLES * 1000 / CLAP_SAMPLE_RATE)
+
+// Onset: energy this many times the noise floor, and this many times the
+// previous window
+#define CLAP_ONSET_RATIO    20
+#define CLAP_ATTACK_RATIO   4
+// Quietest energy that can be a clap (mean square of 16 bit samples)
+#define CLAP_MIN_ENERGY     (1500 * 1500)
+// Energy must fall to 1/CLAP_DECAY_RATIO of the peak within CLAP_MAX_MS
+#define CLAP_DECAY_RATIO    16
+#define CLAP_MAX_MS         80
+#define CLAP_REFRACTORY_MS  150
+// Floor never drops below this, so digital silence does not make every
+// sound an onset
+#define CLAP_FLOOR_MIN      100
+
+struct clap_event {
+	int64_t timestamp;	/* onset, uptime ms */
+	uint32_t peak;		/* peak window energy */
+	uint32_t floor;		/* noise floor at the onset */
+	uint16_t duration_ms;	/* onset to decay */
+};
+
+enum clap_state {
+	CLAP_IDLE,
+	CLAP_ACTIVE,		/* onset seen, waiting for the decay */
+	CLAP_SUSTAINED,		/* too long to be a clap, waiting for quiet */
+};
+
+struct clap_detector {
+	enum clap_state state;
+	uint32_t floor;
+	uint32_t prev_energy;
+	uint32_t peak;
+	uint32_t onset_floor;
+	int64_t onset;
+	int64_t refractory_until;
+};
+
+void clap_detector_init(struct clap_detector *det);
+
+/*
+ * Run the detector over one block of mono 16 bit PCM captured at
+ * CLAP_SAMPLE_RATE, starting at uptime start_ms. Detected claps are
+ * written to events, up to max_events; returns how many.
+ */
+size_t clap_detector_process(struct clap_detector *det, const int16_t *samples, size_t count,
+			     int64_t start_ms, struct clap_event *events, size_t max_events);
+
+#endif /* CLAP_H_ */
@@ -13,46 +13,31 @@ Clap detection using Thingy52 PDM mic
 #include <zephyr/sys/byteorder.h>
 #include <zephyr/drivers/sensor.h>
 
-LOG_MODULE_REGISTER(dmic_sample);
+#include "advertiser.h"
+#include "audio.h"
+#include "clap.h"
+#include "sampler.h"
+#include "sensor_payload.h"
 
-#define MAX_SAMPLE_RATE  16000
-#define SAMPLE_BIT_WIDTH 16
-#define BYTES_PER_SAMPLE sizeof(int16_t)
-/* Milliseconds to wait for a block to be read. */
-#define READ_TIMEOUT     1000
+LOG_MODULE_REGISTER(dmic_sample);
 
 // alias'
 #define HTS221_NODE DT_ALIAS(temphum)
-const struct device *hts221_dev = DEVICE_DT_GET(HTS221_NODE);
 #define APDS9960_NODE DT_ALIAS(light)
-const struct device *light_sensor = DEVICE_DT_GET(APDS9960_NODE);
-
 
-/* Size of a block for 100 ms of audio data. */
-#define BLOCK_SIZE(_sample_rate, _number_of_channels) \
-	(BYTES_PER_SAMPLE * (_sample_rate / 10) * _number_of_channels)
-
-/* Driver will allocate blocks from this slab to receive audio data into them.
- * Application, after getting a given block from the driver and processing its
- * data, needs to free that block.
- */
-#define MAX_BLOCK_SIZE   BLOCK_SIZE(MAX_SAMPLE_RATE, 2)
-#define BLOCK_COUNT      4
-K_MEM_SLAB_DEFINE_STATIC(mem_slab, MAX_BLOCK_SIZE, BLOCK_COUNT, 4);
 
 #define LED0_NODE DT_ALIAS(led0)
 // Set up LED for debugging
 static const struct gpio_dt_spec led = GPIO_DT_SPEC_GET(LED0_NODE, gpios);
 
-// Constants for BLE
-#define UUID_OFFSET 4
-#define MAJOR_OFFSET 20
-#define MINOR_OFFSET 22
-#define IBEACON_EXPECTED_LEN 25
-#define ORIGINAL_RSSI_OFFSET 25
+// Sampling periods; the KPI asks for 2 measurements per second
+#define TEMP_PERIOD_MS  500
+#define LIGHT_PERIOD_MS 500
+// How often the statistics are logged
+#define STATS_INTERVAL_MS 5000
 
 struct values {
-	uint16_t temp;
+	int16_t temp;
 	uint16_t light;
 	uint16_t clap;
 	uint16_t newtemp;
@@ -60,156 +45,171 @@ struct values {
 	uint16_t newclap;
 };
 
-static int do_pdm_transfer(const struct device *dmic_dev,
-			   struct dmic_cfg *cfg,
-			   size_t block_count,
-			   struct values *data)
-{
-	int ret;
-
-	ret = dmic_configure(dmic_dev, cfg);
-	if (ret < 0) {
-		LOG_ERR("Failed to configure the driver: %d", ret);
-		return ret;
-	}
-
-	ret = dmic_trigger(dmic_dev, DMIC_TRIGGER_START);
-	if (ret < 0) {
-		LOG_ERR("START trigger failed: %d", ret);
-		return ret;
-	}
-
-	for (int i = 0; i < block_count; ++i) {
-		void *buffer;
-		uint32_t size;
-		
-		// Toggle LED for debugging
-		gpio_pin_toggle_dt(&led);
-
-		// Read PDM values
-		ret = dmic_read(dmic_dev, 0, &buffer, &size, READ_TIMEOUT);
-		if (ret < 0) {
-			LOG_ERR("%d - read failed: %d", i, ret);
-			return ret;
-		}
-
-		// Toggle LED for debugging 
-		gpio_pin_toggle_dt(&led);
+static struct clap_detector clap_detector;
 
-		// Convert PDM values to PCM values
-		int16_t *samples = (int16_t *)buffer;
-		size_t sample_count = size / sizeof(int16_t);
+// Detector cost, updated on the audio thread
+static uint32_t clap_cycles_max;
+static uint64_t clap_cycles_total;
+static uint32_t clap_blocks;
+static uint32_t clap_dropped;
+static K_SPINLOCK_DEFINE(clap_lock);
 
-		// Detect clap
-		for (size_t i = 0; i < sample_count; ++i) {
-			if (abs(samples[i]) > 10000) {
-				LOG_INF("Clap at sample %d", i);
-				// update clap
-				data->clap += 1;
-				data->newclap = 1;
+/*
+ * Called for every captured block while the microphone runs. Claps go
+ * straight to the radio layer as sampler events, with no polling delay.
+ */
+static void on_audio_block(const int16_t *samples, size_t count, int64_t timestamp)
+{
+	// Running count, so a scanner hearing the same beacon twice does not
+	// count the clap twice
+	static uint16_t claps;
+	struct clap_event events[4];
+	uint32_t start, cycles;
+	size_t found;
+
+	// Toggle LED for debugging
+	gpio_pin_toggle_dt(&led);
+
+	// timestamp is when the block ended; the detector wants its start
+	start = k_cycle_get_32();
+	found = clap_detector_process(&clap_detector, samples, count,
+				      timestamp - count * 1000 / AUDIO_SAMPLE_RATE,
+				      events, ARRAY_SIZE(events));
+	cycles = k_cycle_get_32() - start;
+
+	for (size_t i = 0; i < found; i++) {
+		struct sample s = {
+			.timestamp = events[i].timestamp,
+			.value = ++claps,
+			.type = SENSOR_CLAP,
+		};
+
+		LOG_INF("Clap at %lld ms, %u ms long, peak %u over floor %u",
+			events[i].timestamp, events[i].duration_ms, events[i].peak,
+			events[i].floor);
+		if (sampler_push_event(&s) != 0) {
+			LOG_WRN("Clap event ring full");
+			K_SPINLOCK(&clap_lock) {
+				clap_dropped++;
 			}
 		}
-
-		// Provide time for memory to be freed
-		k_msleep(100);
-
-		k_mem_slab_free(&mem_slab, buffer);
 	}
 
-	ret = dmic_trigger(dmic_dev, DMIC_TRIGGER_STOP);
-	if (ret < 0) {
-		LOG_ERR("STOP trigger failed: %d", ret);
-		return ret;
+	K_SPINLOCK(&clap_lock) {
+		clap_cycles_max = MAX(clap_cycles_max, cycles);
+		clap_cycles_total += cycles;
+		clap_blocks++;
 	}
-
-	return ret;
 }
 
-void read_temperature(struct values *data)
+static int read_temperature(const struct device *dev, struct sample *out)
 {
 	struct sensor_value temp_val;
+	int ret;
 
-	if (!device_is_ready(hts221_dev)) {
-		LOG_ERR("HTS221 temperature sensor not ready");
-		return;
+	ret = sensor_sample_fetch(dev);
+	if (ret == 0) {
+		ret = sensor_channel_get(dev, SENSOR_CHAN_AMBIENT_TEMP, &temp_val);
 	}
-
-	if (sensor_sample_fetch(hts221_dev) == 0 &&
-		sensor_channel_get(hts221_dev, SENSOR_CHAN_AMBIENT_TEMP, &temp_val) == 0) {
-
-		data->temp = (uint16_t)(sensor_value_to_double(&temp_val) * 100);
-		data->newtemp = 1;
+	if (ret < 0) {
+		return ret;
 	}
+
+	out->type = SENSOR_TEMP;
+	out->value = (int16_t)(sensor_value_to_double(&temp_val) * 100);
+	out->timestamp = k_uptime_get();
+	return 1;
 }
 
-void read_light(const struct device *light_sensor, struct values *data)
+static int read_light(const struct device *dev, struct sample *out)
 {
-    struct sensor_value lux;
-
-    if (!device_is_ready(light_sensor)) {
-        LOG_ERR("Light sensor not ready");
-        return;
-    }
+	struct sensor_value lux;
+	int ret;
 
-    if (sensor_sample_fetch(light_sensor) == 0 &&
-        sensor_channel_get(light_sensor, SENSOR_CHAN_LIGHT, &lux) == 0) {
+	ret = sensor_sample_fetch(dev);
+	if (ret == 0) {
+		ret = sensor_channel_get(dev, SENSOR_CHAN_LIGHT, &lux);
+	}
+	if (ret < 0) {
+		return ret;
+	}
 
-        data->light = (uint16_t)lux.val1;  // Store integer lux value
-        data->newlight = 1;
-        LOG_INF("Ambient light: %d lux", lux.val1);
-    }
+	out->type = SENSOR_LIGHT;
+	out->value = (uint16_t)lux.val1;  // Store integer lux value
+	out->timestamp = k_uptime_get();
+	return 1;
 }
 
+static struct sampler_sensor sensors[] = {
+	SAMPLER_SENSOR("HTS221", DEVICE_DT_GET(HTS221_NODE), TEMP_PERIOD_MS, read_temperature),
+	SAMPLER_SENSOR("APDS9960", DEVICE_DT_GET(APDS9960_NODE), LIGHT_PERIOD_MS, read_light),
+};
 
+static void log_stats(void)
+{
+	struct audio_stats stats;
+	struct advertiser_stats adv_stats;
+	struct sampler_stats sampler_stats;
+
+	audio_get_stats(&stats);
+	LOG_INF("Audio: %u blocks, %u dropped, %u read errors, max %u us per block",
+		stats.blocks, stats.dropped, stats.read_errors, stats.max_process_us);
+	K_SPINLOCK(&clap_lock) {
+		LOG_INF("Clap detector: %llu cycles per block on average, %u max, %u dropped",
+			clap_blocks ? clap_cycles_total / clap_blocks : 0, clap_cycles_max,
+			clap_dropped);
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(sensors); i++) {
+		sampler_get_stats(&sensors[i], &sampler_stats);
+		LOG_INF("%s: %u samples, %u errors, %u missed, jitter %u us mean, %u us max",
+			sensors[i].name, sampler_stats.samples, sampler_stats.errors,
+			sampler_stats.missed, sampler_stats.mean_jitter_us,
+			sampler_stats.max_jitter_us);
+	}
+	LOG_INF("Sampler: %u readings dropped", sampler_dropped());
+	advertiser_get_stats(&adv_stats);
+	LOG_INF("Advertising: %u updates, %u bursts, %u ms at the fast interval",
+		adv_stats.updates, adv_stats.bursts, adv_stats.fast_ms);
+}
 
-static void advertise_thingy(struct values data) {
-    uint8_t beacon_data[] = {
-        0x4C, 0x00, 0x02, 0x15,                         // Apple iBeacon prefix
-        0x19, 0xEE, 0x15, 0x16, 0x01, 0x6B, 0x4B, 0xEC, // UUID part 1 (example)
-        0xAD, 0x96, 0xBC, 0xB9, 0x6D, 0x16, 0x6E, 0x97, // UUID part 2 (example)
-        0x00, 0x00, 0x00, 0x00,                         // Major / Minor placeholder
-        0xC8                                            // TX Power (example value)
-    };
-
-	// Pack values: top byte = temp, bottom byte = light
-    uint16_t major_part = ((data.temp & 0xFF) << 8) | (data.light & 0xFF);
-    // Clap into upper byte of minor, lower byte can be a flag (0x01) if needed
-    uint16_t minor_part = ((data.clap & 0xFF) << 8) | 0x01;
-
-    // Set the measurement into MAJOR or MINOR
-	// if (data.newtemp && data.newclap) {
-    // major_part = data.temp;   // temperature
-    // minor_part = data.clap;   // clap count
-	// } else if (data.newtemp) {
-	// 	major_part = 0;
-	// 	minor_part = data.temp;
-	// } else if (data.newlight) {
-	// 	major_part = 1;
-	// 	minor_part = data.light;
-	// } else if (data.newclap) {
-	// 	major_part = 2;
-	// 	minor_part = data.clap;
-	// }
-
-    sys_put_be16(major_part, &beacon_data[MAJOR_OFFSET]);
-    sys_put_be16(minor_part, &beacon_data[MINOR_OFFSET]);
-
-    struct bt_data ad[] = {
-        BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_NO_BREDR),
-        BT_DATA(BT_DATA_MANUFACTURER_DATA, beacon_data, sizeof(beacon_data)),
-    };
-
-    bt_le_adv_stop();
-    int err = bt_le_adv_start(BT_LE_ADV_NCONN, ad, ARRAY_SIZE(ad), NULL, 0);
-    if (err) {
-        printk("Advertising failed to start (err %d)\n", err);
-        return;
-    }
-
-    printk("[ADVERTISING] Measurement\n");
+/*
+ * Build the payload for the latest values and hand it to the advertiser,
+ * which keeps sending it until the next call. urgent values go out at
+ * the fast interval.
+ */
+static void advertise_thingy(const struct values *data, bool urgent)
+{
+	static bool started;
+	static uint16_t seq;
+	uint8_t payload[SENSOR_PAYLOAD_MAX];
+	struct sensor_payload_writer w;
+	int len;
+
+	// Every reading that is current goes in each advertisement
+	sensor_payload_begin(&w, payload, sizeof(payload), ++seq);
+	if (data->newtemp) {
+		sensor_payload_put16(&w, SENSOR_TEMP, (uint16_t)data->temp);
+	}
+	if (data->newlight) {
+		sensor_payload_put16(&w, SENSOR_LIGHT, data->light);
+	}
+	sensor_payload_put16(&w, SENSOR_CLAP, data->clap);
+	len = sensor_payload_end(&w);
+	if (len < 0) {
+		LOG_ERR("Payload does not fit: %d", len);
+		return;
+	}
 
-    k_sleep(K_MSEC(200));
-    bt_le_adv_stop();
+	if (!started) {
+		if (advertiser_start(payload, len) != 0) {
+			return;
+		}
+		started = true;
+		if (!urgent) {
+			return;
+		}
+	}
+	advertiser_update(payload, len, urgent);
 }
 
 int main(void)
@@ -238,12 +238,6 @@ int main(void)
 		return 0;
 	}
 
-	// checks temp sensor readiness
-	if (!device_is_ready(hts221_dev)) {
-	LOG_ERR("HTS221 temperature sensor not ready");
-	return 0;
-}
-
 	// Manually turn on powr to mic
 	const struct device *const expander = DEVICE_DT_GET(DT_NODELABEL(sx1509b));
 	if (!device_is_ready(expander)) {
@@ -253,50 +247,61 @@ int main(void)
 	gpio_pin_configure(expander, 9, GPIO_OUTPUT_ACTIVE);
 	gpio_pin_set(expander, 9, 1);
 
-	struct pcm_stream_cfg stream = {
-		.pcm_width = SAMPLE_BIT_WIDTH,
-		.mem_slab  = &mem_slab,
-	};
-	struct dmic_cfg cfg = {
-		.io = {
-			/* These fields can be used to limit the PDM clock
-			 * configurations that the driver is allowed to use
-			 * to those supported by the microphone.
-			 */
-			.min_pdm_clk_freq = 1000000,
-			.max_pdm_clk_freq = 3250000,
-			.min_pdm_clk_dc   = 40,
-			.max_pdm_clk_dc   = 60,
-		},
-		.streams = &stream,
-		.channel = {
-			.req_num_streams = 1,
-		},
-	};
-
-	cfg.channel.req_num_chan = 1;
-	cfg.channel.req_chan_map_lo =
-		dmic_build_channel_map(0, 0, PDM_CHAN_LEFT);
-	cfg.streams[0].pcm_rate = MAX_SAMPLE_RATE;
-	cfg.streams[0].block_size =
-		BLOCK_SIZE(cfg.streams[0].pcm_rate, cfg.channel.req_num_chan);
+	// Listen continuously from here on
+	clap_detector_init(&clap_detector);
+	ret = audio_start(dmic_dev, on_audio_block);
+	if (ret < 0) {
+		return 0;
+	}
+
+	sampler_start(sensors, ARRAY_SIZE(sensors));
+
+	// Values stay advertised until replaced, so they are kept across loops
+	struct values data = {0};
+	int64_t next_stats = k_uptime_get() + STATS_INTERVAL_MS;
 
 	while (1) {
-		struct values data = {0}; // Reset sensor values
-
-		// Read temperature and light into struct
-		read_temperature(&data);
-		read_light(light_sensor, &data);
-		// Detect claps and update struct
-		ret = do_pdm_transfer(dmic_dev, &cfg, BLOCK_COUNT, &data);
-		if (ret < 0) {
-			return 0;
+		struct sample samples[8];
+		bool changed = false;
+		bool urgent = false;
+		size_t n;
+
+		sampler_wait(K_TIMEOUT_ABS_MS(next_stats));
+
+		// Everything that arrived together goes out in one payload
+		while ((n = sampler_drain(samples, ARRAY_SIZE(samples))) > 0) {
+			for (size_t i = 0; i < n; i++) {
+				switch (samples[i].type) {
+				case SENSOR_TEMP:
+					data.temp = samples[i].value;
+					data.newtemp = 1;
+					break;
+				case SENSOR_LIGHT:
+					data.light = samples[i].value;
+					data.newlight = 1;
+					break;
+				case SENSOR_CLAP:
+					// A clap goes out at the fast interval
+					data.clap = samples[i].value;
+					data.newclap = 1;
+					urgent = true;
+					break;
+				}
+			}
+			changed = true;
 		}
 
 		// Send over BLE
-		advertise_thingy(data);
+		if (changed) {
+			advertise_thingy(&data, urgent);
+		}
 
-		k_sleep(K_SECONDS(5));
+		if (k_uptime_get() >= next_stats) {
+			next_stats += STATS_INTERVAL_MS;
+			LOG_INF("Latest: %d hundredths of a degree C, light %u, %u claps",
+				data.temp, data.light, data.clap);
+			log_stats();
+		}
 	}
 
 	LOG_INF("Exiting");
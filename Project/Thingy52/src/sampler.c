@@ -0,0 +1,170 @@
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/logging/log.h>
+
+#include "sampler.h"
+
+LOG_MODULE_REGISTER(sampler);
+
+BUILD_ASSERT((SAMPLER_RING_LEN & (SAMPLER_RING_LEN - 1)) == 0,
+	     "SAMPLER_RING_LEN must be a power of two");
+
+K_THREAD_STACK_DEFINE(sampler_stack, SAMPLER_STACK_SIZE);
+static struct k_work_q sampler_workq;
+
+/*
+ * head is only written by the producer and tail only by the consumer;
+ * each publishes its slot with an atomic store after touching it
+ */
+struct sample_ring {
+	struct sample slots[SAMPLER_RING_LEN];
+	atomic_t head;
+	atomic_t tail;
+	atomic_t dropped;
+};
+
+// Filled by the sampling work queue
+static struct sample_ring sensor_ring;
+// Filled by sampler_push_event()
+static struct sample_ring event_ring;
+
+// Given whenever a reading is added
+static K_SEM_DEFINE(ring_ready, 0, 1);
+
+static K_SPINLOCK_DEFINE(stats_lock);
+
+static int ring_put(struct sample_ring *ring, const struct sample *s)
+{
+	uint32_t head = (uint32_t)atomic_get(&ring->head);
+
+	if (head - (uint32_t)atomic_get(&ring->tail) >= SAMPLER_RING_LEN) {
+		atomic_inc(&ring->dropped);
+		return -ENOMEM;
+	}
+	ring->slots[head & (SAMPLER_RING_LEN - 1)] = *s;
+	atomic_set(&ring->head, head + 1);
+	k_sem_give(&ring_ready);
+	return 0;
+}
+
+static bool ring_empty(struct sample_ring *ring)
+{
+	return atomic_get(&ring->head) == atomic_get(&ring->tail);
+}
+
+static size_t ring_take(struct sample_ring *ring, struct sample *out, size_t max)
+{
+	uint32_t tail = (uint32_t)atomic_get(&ring->tail);
+	uint32_t head = (uint32_t)atomic_get(&ring->head);
+	size_t n = 0;
+
+	while (tail != head && n < max) {
+		out[n++] = ring->slots[tail & (SAMPLER_RING_LEN - 1)];
+		tail++;
+	}
+	atomic_set(&ring->tail, tail);
+	return n;
+}
+
+static void sample_work(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct sampler_sensor *sensor = CONTAINER_OF(dwork, struct sampler_sensor, work);
+	int64_t period = k_ms_to_ticks_ceil64(sensor->period_ms);
+	int64_t now = k_uptime_ticks();
+	uint32_t jitter_us = (uint32_t)k_ticks_to_us_floor64(MAX(now - sensor->deadline, 0));
+	uint32_t missed = 0;
+	struct sample s;
+	int ret;
+
+	ret = sensor->read(sensor->dev, &s);
+	if (ret > 0) {
+		ring_put(&sensor_ring, &s);
+	} else if (ret < 0) {
+		LOG_WRN("%s read failed: %d", sensor->name, ret);
+	}
+
+	// Next deadline on the original grid, skipping any already past
+	sensor->deadline += period;
+	now = k_uptime_ticks();
+	while (sensor->deadline < now) {
+		sensor->deadline += period;
+		missed++;
+	}
+	k_work_reschedule_for_queue(&sampler_workq, &sensor->work,
+				    K_TIMEOUT_ABS_TICKS(sensor->deadline));
+
+	K_SPINLOCK(&stats_lock) {
+		sensor->stats.samples++;
+		sensor->stats.errors += ret < 0;
+		sensor->stats.missed += missed;
+		sensor->stats.max_jitter_us = MAX(sensor->stats.max_jitter_us, jitter_us);
+		sensor->jitter_total_us += jitter_us;
+	}
+}
+
+int sampler_start(struct sampler_sensor *sensors, size_t count)
+{
+	int64_t start;
+	int started = 0;
+
+	k_work_queue_start(&sampler_workq, sampler_stack, K_THREAD_STACK_SIZEOF(sampler_stack),
+			   SAMPLER_PRIORITY, NULL);
+	k_thread_name_set(&sampler_workq.thread, "sampler");
+
+	// Every sensor's grid starts at the same tick
+	start = k_uptime_ticks();
+
+	for (size_t i = 0; i < count; i++) {
+		struct sampler_sensor *sensor = &sensors[i];
+
+		if (sensor->dev != NULL && !device_is_ready(sensor->dev)) {
+			LOG_ERR("%s (%s) is not ready, not sampling it", sensor->name,
+				sensor->dev->name);
+			continue;
+		}
+
+		sensor->deadline = start;
+		k_work_init_delayable(&sensor->work, sample_work);
+		k_work_schedule_for_queue(&sampler_workq, &sensor->work,
+					  K_TIMEOUT_ABS_TICKS(sensor->deadline));
+		LOG_INF("Sampling %s every %u ms", sensor->name, sensor->period_ms);
+		started++;
+	}
+
+	return started;
+}
+
+int sampler_push_event(const struct sample *s)
+{
+	return ring_put(&event_ring, s);
+}
+
+void sampler_wait(k_timeout_t timeout)
+{
+	if (ring_empty(&event_ring) && ring_empty(&sensor_ring)) {
+		k_sem_take(&ring_ready, timeout);
+	}
+}
+
+size_t sampler_drain(struct sample *out, size_t max)
+{
+	size_t n = ring_take(&event_ring, out, max);
+
+	return n + ring_take(&sensor_ring, out + n, max - n);
+}
+
+void sampler_get_stats(const struct sampler_sensor *sensor, struct sampler_stats *out)
+{
+	K_SPINLOCK(&stats_lock) {
+		*out = sensor->stats;
+		out->mean_jitter_us = sensor->stats.samples ?
+			(uint32_t)(sensor->jitter_total_us / sensor->stats.samples) : 0;
+	}
+}
+
+uint32_t sampler_dropped(void)
+{
+	return (uint32_t)(atomic_get(&sensor_ring.dropped) + atomic_get(&event_ring.dropped));
+}
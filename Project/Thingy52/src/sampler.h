@@ -0,0 +1,98 @@
+/*
+ * Sensor sampling scheduler
+ *
+ * Each sensor is read by its own delayable work item at its own period,
+ * on a work queue dedicated to sampling. Deadlines are absolute (start +
+ * n * period), so a slow read delays one sample without shifting every
+ * one after it; a deadline that has already passed when the previous
+ * read finishes is counted as missed and skipped.
+ *
+ * Readings go into lock-free single producer, single consumer rings.
+ * The sampling work queue is the only producer of the sensor ring.
+ * Events detected elsewhere, such as claps on the audio thread, go
+ * straight into a second ring with sampler_push_event(), so they neither
+ * wait for a polling period nor queue behind a slow sensor read. The
+ * radio layer drains both after sampler_wait() wakes it.
+ */
+
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+
+// Readings each ring holds before new ones are dropped; a power of two
+#define SAMPLER_RING_LEN 32
+
+#define SAMPLER_STACK_SIZE 2048
+#define SAMPLER_PRIORITY   K_PRIO_PREEMPT(4)
+
+struct sample {
+	int64_t timestamp;	/* uptime ms */
+	int32_t value;
+	uint8_t type;		/* enum sensor_reading_type */
+};
+
+/*
+ * Read one sensor. Returns 1 with out filled in, 0 if there is nothing
+ * new to report, or a negative errno.
+ */
+typedef int (*sampler_read_t)(const struct device *dev, struct sample *out);
+
+struct sampler_stats {
+	uint32_t samples;	/* reads that ran */
+	uint32_t errors;	/* reads that failed */
+	uint32_t missed;	/* deadlines skipped because a read overran */
+	uint32_t max_jitter_us;	/* latest start after a deadline */
+	uint32_t mean_jitter_us;
+};
+
+struct sampler_sensor {
+	const char *name;
+	const struct device *dev;	/* NULL if the read needs no device */
+	uint32_t period_ms;
+	sampler_read_t read;
+
+	/* Private */
+	struct k_work_delayable work;
+	int64_t deadline;		/* ticks */
+	uint64_t jitter_total_us;
+	struct sampler_stats stats;
+};
+
+#define SAMPLER_SENSOR(_name, _dev, _period_ms, _read) \
+	{ .name = (_name), .dev = (_dev), .period_ms = (_period_ms), .read = (_read) }
+
+/*
+ * Check every device once and start sampling the ready ones. Sensors
+ * whose device is not ready are logged and left out. The array must
+ * outlive the sampler. Returns how many sensors were started.
+ */
+int sampler_start(struct sampler_sensor *sensors, size_t count);
+
+/*
+ * Queue an event reading. Must always be called from the same thread,
+ * which must not be the sampling work queue. Returns 0, or -ENOMEM if
+ * the event ring is full.
+ */
+int sampler_push_event(const struct sample *s);
+
+/*
+ * Block until there are readings to drain or the timeout expires
+ */
+void sampler_wait(k_timeout_t timeout);
+
+/*
+ * Take up to max readings, events first and each ring oldest first.
+ * Only one thread may drain.
+ */
+size_t sampler_drain(struct sample *out, size_t max);
+
+void sampler_get_stats(const struct sampler_sensor *sensor, struct sampler_stats *stats);
+
+// Readings lost because a ring was full
+uint32_t sampler_dropped(void);
+
+#endif /* SAMPLER_H_ */
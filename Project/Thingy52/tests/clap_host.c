@@ -0,0 +1,418 @@
+/*
+ * Host test for the clap detector
+ *
+ * Feeds audio through clap_detector_process in 20 ms blocks, as the audio
+ * thread does.
+ *
+ *   clap_host                     synthetic audio: background noise, a train
+ *                                 of claps at two per second and then a
+ *                                 sustained 440 Hz tone. Every clap must be
+ *                                 found near its onset and the tone must not
+ *                                 be reported.
+ *   clap_host --write NAME        write that audio to NAME.wav, with its
+ *                                 onsets in NAME.txt
+ *   clap_host REC.wav ...         replay recordings, 16 bit PCM at
+ *                                 CLAP_SAMPLE_RATE, scored against REC.txt
+ *
+ * A label file has one clap per line, onset in seconds first, as in an
+ * Audacity label track export ("start<TAB>end<TAB>label"); anything after
+ * the first number is ignored, as are lines starting with '#'. Each
+ * recording reports precision and recall, and fails below the 60%
+ * accuracy KPI. The time spent per block is reported too, as a share of
+ * the block's 20 ms; it is host time, so it only tracks changes in cost
+ * from run to run, while the on target figure is logged by the app.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clap.h"
+
+#define SECONDS        10
+#define SAMPLES        (CLAP_SAMPLE_RATE * SECONDS)
+#define BLOCK_SAMPLES  320
+#define BLOCK_MS       (BLOCK_SAMPLES * 1000 / CLAP_SAMPLE_RATE)
+#define CLAP_COUNT     10
+#define CLAP_FIRST_MS  1000
+#define CLAP_SPACING_MS 500
+#define TONE_START_MS  7000
+#define TONE_END_MS    8000
+// Allowed distance between a reported onset and the real one
+#define ONSET_SLACK_MS 10
+// Hand placed labels are less exact
+#define LABEL_SLACK_MS 50
+#define MAX_LABELS     4096
+// Accuracy KPI, for both precision and recall
+#define KPI_PERCENT    60
+
+static int16_t audio[SAMPLES];
+
+// Small deterministic generator, so every run sees the same audio
+static uint32_t rng_state = 1;
+
+static int32_t noise(int32_t amplitude)
+{
+	rng_state = rng_state * 1103515245u + 12345u;
+	return (int32_t)((rng_state >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+static int16_t clip(int32_t x)
+{
+	return x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : (int16_t)x;
+}
+
+static void synthesise(void)
+{
+	for (int i = 0; i < SAMPLES; i++) {
+		audio[i] = (int16_t)noise(200);
+	}
+
+	// A clap: a burst of noise decaying over about 8 ms
+	for (int c = 0; c < CLAP_COUNT; c++) {
+		int start = (CLAP_FIRST_MS + c * CLAP_SPACING_MS) * CLAP_SAMPLE_RATE / 1000;
+
+		for (int k = 0; k < CLAP_SAMPLE_RATE / 10; k++) {
+			double envelope = 20000.0 * exp(-k / (0.008 * CLAP_SAMPLE_RATE));
+
+			audio[start + k] = clip(audio[start + k] +
+						(int32_t)(envelope * noise(1000) / 1000.0));
+		}
+	}
+
+	for (int i = TONE_START_MS * CLAP_SAMPLE_RATE / 1000;
+	     i < TONE_END_MS * CLAP_SAMPLE_RATE / 1000; i++) {
+		audio[i] = clip(audio[i] + (int32_t)(8000.0 * sin(2.0 * M_PI * 440.0 * i /
+								  CLAP_SAMPLE_RATE)));
+	}
+}
+
+struct run {
+	int64_t onsets[MAX_LABELS];
+	size_t count;
+	size_t blocks;
+	double ns_total;
+	double ns_max;
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Run the detector over whole blocks of samples, timing every block
+static void run_detector(const int16_t *samples, size_t count, struct run *run)
+{
+	struct clap_detector det;
+	struct clap_event events[8];
+
+	memset(run, 0, sizeof(*run));
+	clap_detector_init(&det);
+
+	for (size_t b = 0; b + BLOCK_SAMPLES <= count; b += BLOCK_SAMPLES) {
+		double start = now_ns();
+		size_t n = clap_detector_process(&det, &samples[b], BLOCK_SAMPLES,
+						 (int64_t)b * 1000 / CLAP_SAMPLE_RATE, events, 8);
+		double ns = now_ns() - start;
+
+		run->ns_total += ns;
+		run->ns_max = ns > run->ns_max ? ns : run->ns_max;
+		run->blocks++;
+		for (size_t i = 0; i < n && run->count < MAX_LABELS; i++) {
+			run->onsets[run->count++] = events[i].timestamp;
+		}
+	}
+}
+
+static void report_cost(const struct run *run)
+{
+	double mean = run->blocks ? run->ns_total / run->blocks : 0.0;
+
+	printf("%zu blocks: %.0f ns per block on average (%.3f%% of %d ms), %.0f ns max\n",
+	       run->blocks, mean, mean / (BLOCK_MS * 1e4), BLOCK_MS, run->ns_max);
+}
+
+static int synthetic_test(void)
+{
+	struct run *run = malloc(sizeof(*run));
+	int failures = 0;
+
+	synthesise();
+	run_detector(audio, SAMPLES, run);
+
+	for (size_t i = 0; i < run->count; i++) {
+		int64_t t = run->onsets[i];
+		int64_t offset = (t - CLAP_FIRST_MS) % CLAP_SPACING_MS;
+		int64_t nearest = offset <= CLAP_SPACING_MS / 2 ? offset :
+				  offset - CLAP_SPACING_MS;
+
+		printf("clap at %lld ms\n", (long long)t);
+		if (t >= TONE_START_MS && t < TONE_END_MS) {
+			printf("FAIL: tone reported as a clap at %lld ms\n", (long long)t);
+			failures++;
+		} else if (t < CLAP_FIRST_MS - ONSET_SLACK_MS ||
+			   llabs(nearest) > ONSET_SLACK_MS) {
+			printf("FAIL: clap at %lld ms is not near a real one\n", (long long)t);
+			failures++;
+		}
+	}
+
+	if (run->count != CLAP_COUNT) {
+		printf("FAIL: found %zu claps, expected %d\n", run->count, CLAP_COUNT);
+		failures++;
+	}
+
+	report_cost(run);
+	printf("%zu of %d claps found, %d failures\n", run->count, CLAP_COUNT, failures);
+	free(run);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void put_le(FILE *f, uint32_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++) {
+		fputc((value >> (8 * i)) & 0xFF, f);
+	}
+}
+
+static uint32_t get_le(const uint8_t *p, int bytes)
+{
+	uint32_t value = 0;
+
+	for (int i = bytes - 1; i >= 0; i--) {
+		value = (value << 8) | p[i];
+	}
+	return value;
+}
+
+static char *with_extension(const char *path, const char *ext)
+{
+	const char *dot = strrchr(path, '.');
+	const char *slash = strrchr(path, '/');
+	size_t base = dot && (!slash || dot > slash) ? (size_t)(dot - path) : strlen(path);
+	char *out = malloc(base + strlen(ext) + 1);
+
+	memcpy(out, path, base);
+	strcpy(out + base, ext);
+	return out;
+}
+
+static int write_synthetic(const char *name)
+{
+	char *wav_path = with_extension(name, ".wav");
+	char *label_path = with_extension(name, ".txt");
+	FILE *wav = fopen(wav_path, "wb");
+	FILE *labels = fopen(label_path, "w");
+	uint32_t data_size = SAMPLES * 2;
+	int ret = EXIT_SUCCESS;
+
+	if (!wav || !labels) {
+		printf("FAIL: cannot create %s or %s\n", wav_path, label_path);
+		ret = EXIT_FAILURE;
+		goto out;
+	}
+
+	synthesise();
+
+	fwrite("RIFF", 1, 4, wav);
+	put_le(wav, 36 + data_size, 4);
+	fwrite("WAVEfmt ", 1, 8, wav);
+	put_le(wav, 16, 4);
+	put_le(wav, 1, 2);				/* PCM */
+	put_le(wav, 1, 2);				/* mono */
+	put_le(wav, CLAP_SAMPLE_RATE, 4);
+	put_le(wav, CLAP_SAMPLE_RATE * 2, 4);
+	put_le(wav, 2, 2);
+	put_le(wav, 16, 2);
+	fwrite("data", 1, 4, wav);
+	put_le(wav, data_size, 4);
+	for (int i = 0; i < SAMPLES; i++) {
+		put_le(wav, (uint16_t)audio[i], 2);
+	}
+
+	fprintf(labels, "# Synthetic claps; the 440 Hz tone from %d to %d ms is not one\n",
+		TONE_START_MS, TONE_END_MS);
+	for (int c = 0; c < CLAP_COUNT; c++) {
+		double t = (CLAP_FIRST_MS + c * CLAP_SPACING_MS) / 1000.0;
+
+		fprintf(labels, "%.3f\t%.3f\tclap\n", t, t);
+	}
+	printf("Wrote %s and %s\n", wav_path, label_path);
+
+out:
+	if (wav) {
+		fclose(wav);
+	}
+	if (labels) {
+		fclose(labels);
+	}
+	free(wav_path);
+	free(label_path);
+	return ret;
+}
+
+/*
+ * Read a 16 bit PCM WAV file at CLAP_SAMPLE_RATE; multi channel files are
+ * reduced to their first channel. Returns the samples, or NULL.
+ */
+static int16_t *read_wav(const char *path, size_t *count)
+{
+	FILE *f = fopen(path, "rb");
+	uint8_t header[12], chunk[8], fmt[16];
+	uint32_t channels = 0;
+	int16_t *samples = NULL;
+
+	if (!f) {
+		printf("FAIL: cannot open %s\n", path);
+		return NULL;
+	}
+	if (fread(header, 1, 12, f) != 12 || memcmp(header, "RIFF", 4) ||
+	    memcmp(header + 8, "WAVE", 4)) {
+		printf("FAIL: %s is not a WAV file\n", path);
+		goto out;
+	}
+
+	while (fread(chunk, 1, 8, f) == 8) {
+		uint32_t size = get_le(chunk + 4, 4);
+
+		if (!memcmp(chunk, "fmt ", 4) && size >= 16) {
+			if (fread(fmt, 1, 16, f) != 16) {
+				break;
+			}
+			channels = get_le(fmt + 2, 2);
+			if (get_le(fmt, 2) != 1 || get_le(fmt + 14, 2) != 16 || channels == 0 ||
+			    get_le(fmt + 4, 4) != CLAP_SAMPLE_RATE) {
+				printf("FAIL: %s must be 16 bit PCM at %d Hz\n", path,
+				       CLAP_SAMPLE_RATE);
+				goto out;
+			}
+			size -= 16;
+		} else if (!memcmp(chunk, "data", 4) && channels) {
+			size_t frames = size / (2 * channels);
+			uint8_t frame[2 * 8];
+
+			if (channels > 8) {
+				printf("FAIL: %s has %u channels\n", path, channels);
+				goto out;
+			}
+			samples = malloc((frames ? frames : 1) * sizeof(*samples));
+			for (*count = 0; *count < frames; (*count)++) {
+				if (fread(frame, 2, channels, f) != channels) {
+					break;
+				}
+				samples[*count] = (int16_t)get_le(frame, 2);
+			}
+			goto out;
+		}
+		// Chunks are padded to an even size
+		if (fseek(f, size + (size & 1), SEEK_CUR)) {
+			break;
+		}
+	}
+	printf("FAIL: %s has no PCM data\n", path);
+
+out:
+	fclose(f);
+	return samples;
+}
+
+// Label onsets in ms, or -1 if the file cannot be read
+static int read_labels(const char *path, int64_t *onsets, size_t max)
+{
+	FILE *f = fopen(path, "r");
+	char line[256];
+	int count = 0;
+
+	if (!f) {
+		printf("FAIL: cannot open label file %s\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) && (size_t)count < max) {
+		double seconds;
+
+		if (line[0] != '#' && sscanf(line, "%lf", &seconds) == 1) {
+			onsets[count++] = (int64_t)llround(seconds * 1000.0);
+		}
+	}
+	fclose(f);
+	return count;
+}
+
+// Detections within LABEL_SLACK_MS of a label not already matched
+static size_t match(const int64_t *labels, size_t label_count, const int64_t *found,
+		    size_t found_count)
+{
+	static char used[MAX_LABELS];
+	size_t hits = 0;
+
+	memset(used, 0, sizeof(used));
+	for (size_t i = 0; i < found_count; i++) {
+		for (size_t j = 0; j < label_count; j++) {
+			if (!used[j] && llabs(found[i] - labels[j]) <= LABEL_SLACK_MS) {
+				used[j] = 1;
+				hits++;
+				break;
+			}
+		}
+	}
+	return hits;
+}
+
+static int replay(const char *path)
+{
+	static int64_t labels[MAX_LABELS];
+	char *label_path = with_extension(path, ".txt");
+	struct run *run = malloc(sizeof(*run));
+	size_t count = 0;
+	int16_t *samples = read_wav(path, &count);
+	int label_count = read_labels(label_path, labels, MAX_LABELS);
+	int ret = EXIT_FAILURE;
+
+	if (samples && label_count >= 0) {
+		size_t hits;
+		double precision, recall;
+
+		run_detector(samples, count, run);
+		hits = match(labels, label_count, run->onsets, run->count);
+		precision = run->count ? 100.0 * hits / run->count : 100.0;
+		recall = label_count ? 100.0 * hits / label_count : 100.0;
+
+		printf("%s: %zu found, %d labelled, %zu matched within %d ms\n", path,
+		       run->count, label_count, hits, LABEL_SLACK_MS);
+		printf("precision %.1f%% recall %.1f%%\n", precision, recall);
+		report_cost(run);
+		if (precision < KPI_PERCENT || recall < KPI_PERCENT) {
+			printf("FAIL: below the %d%% accuracy KPI\n", KPI_PERCENT);
+		} else {
+			ret = EXIT_SUCCESS;
+		}
+	}
+
+	free(samples);
+	free(run);
+	free(label_path);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = EXIT_SUCCESS;
+
+	if (argc == 1) {
+		return synthetic_test();
+	}
+	if (argc == 3 && !strcmp(argv[1], "--write")) {
+		return write_synthetic(argv[2]);
+	}
+	for (int i = 1; i < argc; i++) {
+		if (replay(argv[i]) != EXIT_SUCCESS) {
+			ret = EXIT_FAILURE;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,420 @@
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+
+#include "mqtt_session.h"
+
+static struct mqtt_session_msg *queue_at(struct mqtt_session *s, uint8_t i)
+{
+    return &s->queue[(s->queue_head + i) % MQTT_SESSION_QUEUE_LEN];
+}
+
+static uint16_t next_message_id(struct mqtt_session *s)
+{
+    // Message id 0 is not allowed
+    if (++s->next_message_id == 0) {
+        s->next_message_id = 1;
+    }
+    return s->next_message_id;
+}
+
+/*
+ * Resolve the broker hostname into the cached address, falling back to a
+ * fixed IP when DNS fails
+ */
+static int resolve_broker(struct mqtt_session *s)
+{
+    const struct mqtt_session_config *cfg = s->config;
+    struct sockaddr_in *broker = (struct sockaddr_in *)&s->broker;
+    struct zsock_addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct zsock_addrinfo *res;
+    char addr[NET_IPV4_ADDR_LEN];
+    int ret;
+
+    ret = zsock_getaddrinfo(cfg->hostname, NULL, &hints, &res);
+    if (ret == 0) {
+        memcpy(broker, res->ai_addr, sizeof(*broker));
+        zsock_freeaddrinfo(res);
+    } else if (cfg->fallback_ip &&
+               net_addr_pton(AF_INET, cfg->fallback_ip, &broker->sin_addr) == 0) {
+        printk("DNS lookup of %s failed (%d), using %s\n", cfg->hostname, ret, cfg->fallback_ip);
+    } else {
+        printk("DNS lookup of %s failed: %d\n", cfg->hostname, ret);
+        return -EHOSTUNREACH;
+    }
+
+    broker->sin_family = AF_INET;
+    broker->sin_port = htons(cfg->port);
+    s->broker_valid = true;
+
+    net_addr_ntop(AF_INET, &broker->sin_addr, addr, sizeof(addr));
+    printk("Broker %s at %s:%u\n", cfg->hostname, addr, cfg->port);
+    return 0;
+}
+
+static void schedule_reconnect(struct mqtt_session *s)
+{
+    uint32_t jitter = s->backoff_ms / 4;
+
+    s->state = MQTT_SESSION_DISCONNECTED;
+    s->next_attempt = k_uptime_get() + s->backoff_ms + (jitter ? k_cycle_get_32() % jitter : 0);
+    s->backoff_ms = MIN(s->backoff_ms * 2, MQTT_SESSION_BACKOFF_MAX_MS);
+
+    if (++s->failures >= MQTT_SESSION_RESOLVE_AFTER) {
+        // The broker may have moved; look it up again next time
+        s->broker_valid = false;
+        s->failures = 0;
+    }
+}
+
+// Drop the connection and schedule the next attempt, once per connection
+static void connection_lost(struct mqtt_session *s, const char *why, int err)
+{
+    if (s->state == MQTT_SESSION_DISCONNECTED) {
+        return;
+    }
+    printk("MQTT connection lost (%s: %d), retrying in %u ms\n", why, err, s->backoff_ms);
+    // Marked first so the DISCONNECT event from the abort is ignored
+    s->state = MQTT_SESSION_DISCONNECTED;
+    mqtt_abort(&s->client);
+    schedule_reconnect(s);
+}
+
+static int send_subscription(struct mqtt_session *s, const struct mqtt_session_sub *sub)
+{
+    struct mqtt_topic topic = {
+        .topic = {
+            .utf8 = (const uint8_t *)sub->topic,
+            .size = strlen(sub->topic),
+        },
+        .qos = sub->qos,
+    };
+    const struct mqtt_subscription_list list = {
+        .list = &topic,
+        .list_count = 1,
+        .message_id = next_message_id(s),
+    };
+
+    return mqtt_subscribe(&s->client, &list);
+}
+
+static int send_queued(struct mqtt_session *s, struct mqtt_session_msg *msg, bool dup)
+{
+    struct mqtt_publish_param param;
+
+    memset(&param, 0, sizeof(param));
+    param.message.topic.qos = MQTT_QOS_1_AT_LEAST_ONCE;
+    param.message.topic.topic.utf8 = (const uint8_t *)msg->topic;
+    param.message.topic.topic.size = strlen(msg->topic);
+    param.message.payload.data = msg->payload;
+    param.message.payload.len = msg->len;
+    param.message_id = msg->message_id;
+    param.dup_flag = dup;
+
+    return mqtt_publish(&s->client, &param);
+}
+
+/*
+ * After CONNACK: restore subscriptions the broker does not still have,
+ * then replay every unacknowledged QoS 1 message in order
+ */
+static int restore(struct mqtt_session *s, bool session_present)
+{
+    int ret;
+
+    if (!session_present) {
+        for (uint8_t i = 0; i < s->sub_count; i++) {
+            ret = send_subscription(s, &s->subs[i]);
+            if (ret) {
+                return ret;
+            }
+        }
+    }
+
+    for (uint8_t i = 0; i < s->queue_count; i++) {
+        struct mqtt_session_msg *msg = queue_at(s, i);
+
+        if (!msg->acked) {
+            ret = send_queued(s, msg, true);
+            if (ret) {
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+static void on_puback(struct mqtt_session *s, uint16_t message_id)
+{
+    for (uint8_t i = 0; i < s->queue_count; i++) {
+        struct mqtt_session_msg *msg = queue_at(s, i);
+
+        if (msg->message_id == message_id) {
+            msg->acked = true;
+            break;
+        }
+    }
+
+    // Acknowledgements can arrive out of order; free from the front
+    while (s->queue_count && queue_at(s, 0)->acked) {
+        s->queue_head = (s->queue_head + 1) % MQTT_SESSION_QUEUE_LEN;
+        s->queue_count--;
+    }
+}
+
+static void evt_handler(struct mqtt_client *client, const struct mqtt_evt *evt)
+{
+    struct mqtt_session *s = CONTAINER_OF(client, struct mqtt_session, client);
+
+    switch (evt->type) {
+    case MQTT_EVT_CONNACK:
+        if (evt->result != 0) {
+            printk("MQTT connect refused: %d\n", evt->result);
+            connection_lost(s, "connack", evt->result);
+            break;
+        }
+        {
+            bool present = evt->param.connack.session_present_flag;
+
+            printk("MQTT client connected%s\n", present ? " (session resumed)" : "");
+            s->state = MQTT_SESSION_CONNECTED;
+            s->backoff_ms = MQTT_SESSION_BACKOFF_MIN_MS;
+            s->failures = 0;
+            if (restore(s, present)) {
+                connection_lost(s, "restore", -EIO);
+                break;
+            }
+            if (s->config->on_connect) {
+                s->config->on_connect(s, present);
+            }
+        }
+        break;
+    case MQTT_EVT_DISCONNECT:
+        if (s->state != MQTT_SESSION_DISCONNECTED) {
+            printk("MQTT client disconnected\n");
+            schedule_reconnect(s);
+        }
+        break;
+    case MQTT_EVT_PUBACK:
+        on_puback(s, evt->param.puback.message_id);
+        break;
+    case MQTT_EVT_PUBLISH:
+        {
+            const struct mqtt_publish_param *p = &evt->param.publish;
+
+            if (p->message.topic.qos == MQTT_QOS_1_AT_LEAST_ONCE) {
+                const struct mqtt_puback_param ack = { .message_id = p->message_id };
+
+                mqtt_publish_qos1_ack(client, &ack);
+            }
+            if (s->config->on_publish) {
+                s->config->on_publish(s, p);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void start_connect(struct mqtt_session *s)
+{
+    const struct mqtt_session_config *cfg = s->config;
+    int ret;
+
+    if (!s->broker_valid && resolve_broker(s) != 0) {
+        schedule_reconnect(s);
+        return;
+    }
+
+    mqtt_client_init(&s->client);
+    s->client.broker = &s->broker;
+    s->client.evt_cb = evt_handler;
+    s->client.client_id.utf8 = (const uint8_t *)cfg->client_id;
+    s->client.client_id.size = strlen(cfg->client_id);
+    s->client.protocol_version = MQTT_VERSION_3_1_1;
+    s->client.clean_session = cfg->clean_session;
+    s->client.transport.type = MQTT_TRANSPORT_NON_SECURE;
+    s->client.rx_buf = s->rx_buf;
+    s->client.rx_buf_size = sizeof(s->rx_buf);
+    s->client.tx_buf = s->tx_buf;
+    s->client.tx_buf_size = sizeof(s->tx_buf);
+    if (cfg->username) {
+        s->client.user_name = &s->username;
+        s->client.password = &s->password;
+    }
+
+    ret = mqtt_connect(&s->client);
+    if (ret) {
+        printk("MQTT connect to %s failed: %d, retrying in %u ms\n",
+               cfg->hostname, ret, s->backoff_ms);
+        schedule_reconnect(s);
+        return;
+    }
+
+    s->state = MQTT_SESSION_CONNECTING;
+    s->connect_started = k_uptime_get();
+    s->reconnects++;
+}
+
+void mqtt_session_init(struct mqtt_session *s, const struct mqtt_session_config *config)
+{
+    memset(s, 0, sizeof(*s));
+    s->config = config;
+    s->state = MQTT_SESSION_DISCONNECTED;
+    s->backoff_ms = MQTT_SESSION_BACKOFF_MIN_MS;
+    if (config->username) {
+        s->username.utf8 = (const uint8_t *)config->username;
+        s->username.size = strlen(config->username);
+        s->password.utf8 = (const uint8_t *)config->password;
+        s->password.size = config->password ? strlen(config->password) : 0;
+    }
+}
+
+int mqtt_session_subscribe(struct mqtt_session *s, const char *topic, enum mqtt_qos qos)
+{
+    struct mqtt_session_sub *sub;
+
+    if (s->sub_count == MQTT_SESSION_MAX_SUBS) {
+        return -ENOBUFS;
+    }
+    sub = &s->subs[s->sub_count++];
+    sub->topic = topic;
+    sub->qos = qos;
+
+    if (s->state != MQTT_SESSION_CONNECTED) {
+        return 0;
+    }
+    return send_subscription(s, sub);
+}
+
+int mqtt_session_publish(struct mqtt_session *s, const char *topic,
+                         const uint8_t *payload, uint16_t len, enum mqtt_qos qos)
+{
+    struct mqtt_session_msg *msg;
+    int ret;
+
+    if (qos == MQTT_QOS_0_AT_MOST_ONCE) {
+        struct mqtt_publish_param param;
+
+        if (s->state != MQTT_SESSION_CONNECTED) {
+            return -ENOTCONN;
+        }
+        memset(&param, 0, sizeof(param));
+        param.message.topic.qos = qos;
+        param.message.topic.topic.utf8 = (const uint8_t *)topic;
+        param.message.topic.topic.size = strlen(topic);
+        param.message.payload.data = (uint8_t *)payload;
+        param.message.payload.len = len;
+        return mqtt_publish(&s->client, &param);
+    }
+
+    if (qos != MQTT_QOS_1_AT_LEAST_ONCE) {
+        return -ENOTSUP;
+    }
+    if (s->queue_count == MQTT_SESSION_QUEUE_LEN || len > MQTT_SESSION_PAYLOAD_MAX ||
+        strlen(topic) >= MQTT_SESSION_TOPIC_MAX) {
+        return -ENOBUFS;
+    }
+
+    msg = queue_at(s, s->queue_count++);
+    msg->message_id = next_message_id(s);
+    msg->acked = false;
+    msg->len = len;
+    strcpy(msg->topic, topic);
+    memcpy(msg->payload, payload, len);
+
+    if (s->state != MQTT_SESSION_CONNECTED) {
+        // Sent when the connection comes back
+        return 0;
+    }
+    ret = send_queued(s, msg, false);
+    if (ret) {
+        connection_lost(s, "publish", ret);
+    }
+    return 0;
+}
+
+void mqtt_session_process(struct mqtt_session *s, int timeout_ms)
+{
+    int64_t now = k_uptime_get();
+    bool changed = atomic_cas(&s->network_changed, 1, 0);
+    struct zsock_pollfd fd;
+    int ret;
+
+    if (s->state == MQTT_SESSION_DISCONNECTED) {
+        if (changed) {
+            s->backoff_ms = MQTT_SESSION_BACKOFF_MIN_MS;
+            s->next_attempt = now;
+        }
+        if (now < s->next_attempt) {
+            k_msleep((int32_t)MIN((int64_t)timeout_ms, s->next_attempt - now));
+            return;
+        }
+        start_connect(s);
+        if (s->state == MQTT_SESSION_DISCONNECTED) {
+            return;
+        }
+    } else if (changed && s->state == MQTT_SESSION_CONNECTED) {
+        // A dead connection fails this write or never answers it
+        ret = mqtt_ping(&s->client);
+        if (ret) {
+            connection_lost(s, "ping", ret);
+            return;
+        }
+    }
+
+    if (s->state == MQTT_SESSION_CONNECTING &&
+        now - s->connect_started > MQTT_SESSION_CONNACK_TIMEOUT_MS) {
+        connection_lost(s, "connack timeout", -ETIMEDOUT);
+        return;
+    }
+
+    fd.fd = s->client.transport.tcp.sock;
+    fd.events = ZSOCK_POLLIN;
+    ret = zsock_poll(&fd, 1, (int)MIN((uint32_t)timeout_ms, mqtt_keepalive_time_left(&s->client)));
+    if (ret < 0) {
+        connection_lost(s, "poll", -errno);
+        return;
+    }
+
+    if (fd.revents & ZSOCK_POLLIN) {
+        ret = mqtt_input(&s->client);
+        if (ret) {
+            connection_lost(s, "input", ret);
+            return;
+        }
+    }
+    if (fd.revents & (ZSOCK_POLLERR | ZSOCK_POLLHUP | ZSOCK_POLLNVAL)) {
+        connection_lost(s, "socket", -ECONNRESET);
+        return;
+    }
+
+    if (s->state != MQTT_SESSION_DISCONNECTED) {
+        ret = mqtt_live(&s->client);
+        if (ret && ret != -EAGAIN) {
+            connection_lost(s, "keepalive", ret);
+        }
+    }
+}
+
+void mqtt_session_network_changed(struct mqtt_session *s)
+{
+    atomic_set(&s->network_changed, 1);
+}
+
+bool mqtt_session_connected(const struct mqtt_session *s)
+{
+    return s->state == MQTT_SESSION_CONNECTED;
+}
+
+struct mqtt_client *mqtt_session_client(struct mqtt_session *s)
+{
+    return &s->client;
+}
@@ -0,0 +1,162 @@
+/*
+ * Reconnecting MQTT session for the Zephyr clients
+ *
+ * Wraps a Zephyr mqtt_client so a dropped connection is repaired instead
+ * of ending the program:
+ *   - the broker address is resolved once and cached; DNS is only asked
+ *     again after repeated connect failures
+ *   - reconnects back off exponentially from MQTT_SESSION_BACKOFF_MIN_MS
+ *     to MQTT_SESSION_BACKOFF_MAX_MS, with jitter
+ *   - subscriptions are remembered and sent again after a reconnect,
+ *     unless the broker kept them in a persistent session
+ *   - QoS 1 publishes are copied into a queue until the broker
+ *     acknowledges them, and replayed with the DUP flag after a reconnect
+ *
+ * All functions must be called from the one thread that runs
+ * mqtt_session_process().
+ */
+
+#ifndef MQTT_SESSION_H_
+#define MQTT_SESSION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/mqtt.h>
+#include <zephyr/net/socket.h>
+
+#ifndef MQTT_SESSION_BUF_LEN
+#define MQTT_SESSION_BUF_LEN 128
+#endif
+
+// Outbound QoS 1 messages held until acknowledged
+#ifndef MQTT_SESSION_QUEUE_LEN
+#define MQTT_SESSION_QUEUE_LEN 8
+#endif
+#ifndef MQTT_SESSION_PAYLOAD_MAX
+#define MQTT_SESSION_PAYLOAD_MAX 256
+#endif
+#define MQTT_SESSION_TOPIC_MAX 64
+
+#ifndef MQTT_SESSION_MAX_SUBS
+#define MQTT_SESSION_MAX_SUBS 4
+#endif
+
+#define MQTT_SESSION_BACKOFF_MIN_MS  250
+#define MQTT_SESSION_BACKOFF_MAX_MS  30000
+// Give up on a CONNACK after this long and try again
+#define MQTT_SESSION_CONNACK_TIMEOUT_MS 5000
+// Consecutive connect failures before the cached address is resolved again
+#define MQTT_SESSION_RESOLVE_AFTER   3
+
+struct mqtt_session;
+
+/*
+ * Called for every received PUBLISH. The payload must be read (or
+ * skipped) with mqtt_readall_publish_payload() on mqtt_session_client().
+ * QoS 1 messages are acknowledged by the session.
+ */
+typedef void (*mqtt_session_publish_cb)(struct mqtt_session *session,
+                                        const struct mqtt_publish_param *p);
+
+// Called after each successful connect, once subscriptions are restored
+typedef void (*mqtt_session_connect_cb)(struct mqtt_session *session, bool session_present);
+
+struct mqtt_session_config {
+    const char *hostname;
+    const char *fallback_ip;    /* used when DNS fails, may be NULL */
+    uint16_t port;
+    const char *client_id;
+    const char *username;       /* may be NULL */
+    const char *password;
+    bool clean_session;         /* false asks the broker to keep our state */
+    mqtt_session_publish_cb on_publish;
+    mqtt_session_connect_cb on_connect;
+};
+
+enum mqtt_session_state {
+    MQTT_SESSION_DISCONNECTED,
+    MQTT_SESSION_CONNECTING,
+    MQTT_SESSION_CONNECTED,
+};
+
+struct mqtt_session_msg {
+    uint16_t message_id;
+    bool acked;
+    uint16_t len;
+    char topic[MQTT_SESSION_TOPIC_MAX];
+    uint8_t payload[MQTT_SESSION_PAYLOAD_MAX];
+};
+
+struct mqtt_session_sub {
+    const char *topic;
+    enum mqtt_qos qos;
+};
+
+struct mqtt_session {
+    const struct mqtt_session_config *config;
+    struct mqtt_client client;
+    struct sockaddr_storage broker;
+    bool broker_valid;
+    struct mqtt_utf8 username;
+    struct mqtt_utf8 password;
+
+    uint8_t rx_buf[MQTT_SESSION_BUF_LEN];
+    uint8_t tx_buf[MQTT_SESSION_BUF_LEN];
+
+    enum mqtt_session_state state;
+    int64_t next_attempt;
+    int64_t connect_started;
+    uint32_t backoff_ms;
+    uint8_t failures;
+    atomic_t network_changed;
+
+    struct mqtt_session_sub subs[MQTT_SESSION_MAX_SUBS];
+    uint8_t sub_count;
+
+    // Ring of unacknowledged QoS 1 messages, oldest first
+    struct mqtt_session_msg queue[MQTT_SESSION_QUEUE_LEN];
+    uint8_t queue_head;
+    uint8_t queue_count;
+    uint16_t next_message_id;
+
+    uint32_t reconnects;
+};
+
+/*
+ * Set up the session. Nothing is sent until mqtt_session_process().
+ */
+void mqtt_session_init(struct mqtt_session *session, const struct mqtt_session_config *config);
+
+/*
+ * Remember a subscription and send it now if connected. The topic string
+ * must stay valid for the life of the session.
+ */
+int mqtt_session_subscribe(struct mqtt_session *session, const char *topic, enum mqtt_qos qos);
+
+/*
+ * Publish a message. QoS 1 messages are queued until acknowledged, so they
+ * may be published while disconnected; -ENOBUFS when the queue is full or
+ * the message too large. QoS 0 messages need a connection (-ENOTCONN).
+ */
+int mqtt_session_publish(struct mqtt_session *session, const char *topic,
+                         const uint8_t *payload, uint16_t len, enum mqtt_qos qos);
+
+/*
+ * Connect or reconnect when due, then wait up to timeout_ms for input and
+ * handle it, keeping the connection alive. Call this in a loop.
+ */
+void mqtt_session_process(struct mqtt_session *session, int timeout_ms);
+
+/*
+ * Hint that the network came back (e.g. from an IPv4 address event). Any
+ * thread may call this: a pending reconnect is tried straight away and an
+ * open connection is pinged to find out whether it survived.
+ */
+void mqtt_session_network_changed(struct mqtt_session *session);
+
+bool mqtt_session_connected(const struct mqtt_session *session);
+
+struct mqtt_client *mqtt_session_client(struct mqtt_session *session);
+
+#endif /* MQTT_SESSION_H_ */
@@ -0,0 +1,196 @@
+/*
+ * Sensor node advertising payload
+ *
+ * Manufacturer specific data sent by the Thingy52 and decoded by the
+ * nRF52840 base node. Layout, little endian:
+ *
+ *   company id   2 bytes   SENSOR_PAYLOAD_COMPANY_ID
+ *   version      1 byte    SENSOR_PAYLOAD_VERSION
+ *   seq          2 bytes   bumped on every new payload
+ *   readings     type, length, value; repeated
+ *   crc          1 byte    CRC-8 over version, seq and readings
+ *
+ * Values keep the sensor's full resolution, and one advertisement carries
+ * every reading that is current. The sequence number lets a scanner that
+ * hears the same payload many times act on it once. Readings of an
+ * unknown type are skipped by length, so newer nodes can add types
+ * without breaking older base nodes.
+ *
+ * Header only and free of Zephyr dependencies, so it can be built and
+ * exercised on a host.
+ */
+
+#ifndef SENSOR_PAYLOAD_H_
+#define SENSOR_PAYLOAD_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bluetooth SIG id reserved for internal use and testing
+#define SENSOR_PAYLOAD_COMPANY_ID 0xFFFF
+#define SENSOR_PAYLOAD_VERSION    1
+
+// Company id, version, seq and crc
+#define SENSOR_PAYLOAD_OVERHEAD   6
+// Largest payload that fits a legacy advertisement next to the flags:
+// 31 bytes, less 3 for the flags AD and 2 for this AD's length and type
+#define SENSOR_PAYLOAD_MAX        26
+
+enum sensor_reading_type {
+	SENSOR_TEMP = 1,	/* int16, hundredths of a degree C */
+	SENSOR_HUMIDITY = 2,	/* uint16, hundredths of a percent */
+	SENSOR_LIGHT = 3,	/* uint16, ambient light as reported */
+	SENSOR_CLAP = 4,	/* uint16, claps since boot, wrapping */
+};
+
+struct sensor_reading {
+	uint8_t type;
+	int32_t value;
+};
+
+struct sensor_payload_writer {
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+	int err;		/* first error, reported by _end */
+};
+
+static inline uint8_t sensor_payload_crc8(const uint8_t *data, size_t len)
+{
+	uint8_t crc = 0;
+
+	// Polynomial 0x07, as CRC-8/SMBUS
+	for (size_t i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+		}
+	}
+	return crc;
+}
+
+static inline void sensor_payload_begin(struct sensor_payload_writer *w, uint8_t *buf,
+					size_t size, uint16_t seq)
+{
+	w->buf = buf;
+	w->size = size;
+	w->len = 0;
+	w->err = 0;
+
+	if (size < SENSOR_PAYLOAD_OVERHEAD) {
+		w->err = -ENOSPC;
+		return;
+	}
+	buf[0] = SENSOR_PAYLOAD_COMPANY_ID & 0xFF;
+	buf[1] = SENSOR_PAYLOAD_COMPANY_ID >> 8;
+	buf[2] = SENSOR_PAYLOAD_VERSION;
+	buf[3] = seq & 0xFF;
+	buf[4] = seq >> 8;
+	w->len = 5;
+}
+
+/*
+ * Append a 16 bit reading. Errors are remembered and returned by
+ * sensor_payload_end(), so a run of puts needs no checks in between.
+ */
+static inline void sensor_payload_put16(struct sensor_payload_writer *w, uint8_t type,
+					uint16_t value)
+{
+	if (w->err) {
+		return;
+	}
+	// Leave room for the crc
+	if (w->len + 4 + 1 > w->size) {
+		w->err = -ENOSPC;
+		return;
+	}
+	w->buf[w->len++] = type;
+	w->buf[w->len++] = 2;
+	w->buf[w->len++] = value & 0xFF;
+	w->buf[w->len++] = value >> 8;
+}
+
+/*
+ * Seal the payload with its crc. Returns the total length, or a
+ * negative errno if it did not fit.
+ */
+static inline int sensor_payload_end(struct sensor_payload_writer *w)
+{
+	if (w->err) {
+		return w->err;
+	}
+	w->buf[w->len] = sensor_payload_crc8(&w->buf[2], w->len - 2);
+	w->len++;
+	return (int)w->len;
+}
+
+/*
+ * Decode a payload into readings, up to max_readings of them. Returns
+ * the number of readings, -ENOMSG if the data is not a sensor payload,
+ * -ENOTSUP for a version this decoder does not know, or -EBADMSG if the
+ * crc or a reading length is wrong.
+ */
+static inline int sensor_payload_parse(const uint8_t *data, size_t len, uint16_t *seq,
+				       struct sensor_reading *readings, size_t max_readings)
+{
+	size_t pos = 5;
+	size_t end;
+	int count = 0;
+
+	if (len < SENSOR_PAYLOAD_OVERHEAD ||
+	    data[0] != (SENSOR_PAYLOAD_COMPANY_ID & 0xFF) ||
+	    data[1] != (SENSOR_PAYLOAD_COMPANY_ID >> 8)) {
+		return -ENOMSG;
+	}
+	if (data[2] != SENSOR_PAYLOAD_VERSION) {
+		return -ENOTSUP;
+	}
+	end = len - 1;
+	if (sensor_payload_crc8(&data[2], end - 2) != data[end]) {
+		return -EBADMSG;
+	}
+
+	*seq = (uint16_t)(data[3] | (data[4] << 8));
+
+	while (pos < end) {
+		uint8_t type, vlen;
+		uint32_t raw = 0;
+
+		if (end - pos < 2) {
+			return -EBADMSG;
+		}
+		type = data[pos];
+		vlen = data[pos + 1];
+		pos += 2;
+		if (vlen > end - pos) {
+			return -EBADMSG;
+		}
+
+		switch (type) {
+		case SENSOR_TEMP:
+		case SENSOR_HUMIDITY:
+		case SENSOR_LIGHT:
+		case SENSOR_CLAP:
+			if (vlen != 2) {
+				return -EBADMSG;
+			}
+			raw = data[pos] | (data[pos + 1] << 8);
+			if ((size_t)count < max_readings) {
+				readings[count].type = type;
+				readings[count].value = type == SENSOR_TEMP ?
+					(int16_t)raw : (int32_t)raw;
+				count++;
+			}
+			break;
+		default:
+			// Newer reading type; skip it
+			break;
+		}
+		pos += vlen;
+	}
+
+	return count;
+}
+
+#endif /* SENSOR_PAYLOAD_H_ */
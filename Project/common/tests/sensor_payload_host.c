@@ -0,0 +1,135 @@
+/*
+ * Host test for the sensor payload encoder and decoder
+ *
+ * Round trips readings, then checks that corrupted, truncated, foreign
+ * and oversized payloads are reported rather than decoded into wrong
+ * values, and that unknown reading types are skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sensor_payload.h"
+
+static int failures;
+
+#define CHECK(cond)                                                          \
+	do {                                                                 \
+		if (!(cond)) {                                               \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);  \
+			failures++;                                          \
+		}                                                            \
+	} while (0)
+
+static int encode_sample(uint8_t *buf)
+{
+	struct sensor_payload_writer w;
+
+	sensor_payload_begin(&w, buf, SENSOR_PAYLOAD_MAX, 0x1234);
+	sensor_payload_put16(&w, SENSOR_TEMP, (uint16_t)(int16_t)-1234);
+	sensor_payload_put16(&w, SENSOR_LIGHT, 54321);
+	sensor_payload_put16(&w, SENSOR_CLAP, 65535);
+	return sensor_payload_end(&w);
+}
+
+static void test_round_trip(void)
+{
+	uint8_t buf[SENSOR_PAYLOAD_MAX];
+	struct sensor_reading r[8];
+	uint16_t seq = 0;
+	int len = encode_sample(buf);
+	int count;
+
+	CHECK(len == SENSOR_PAYLOAD_OVERHEAD + 3 * 4);
+	count = sensor_payload_parse(buf, len, &seq, r, 8);
+	CHECK(count == 3);
+	CHECK(seq == 0x1234);
+	if (count == 3) {
+		CHECK(r[0].type == SENSOR_TEMP && r[0].value == -1234);
+		CHECK(r[1].type == SENSOR_LIGHT && r[1].value == 54321);
+		CHECK(r[2].type == SENSOR_CLAP && r[2].value == 65535);
+	}
+
+	// More readings than the caller has room for are dropped, not overrun
+	CHECK(sensor_payload_parse(buf, len, &seq, r, 1) == 1);
+}
+
+static void test_corruption(void)
+{
+	uint8_t buf[SENSOR_PAYLOAD_MAX];
+	struct sensor_reading r[8];
+	uint16_t seq;
+	int len = encode_sample(buf);
+
+	// Every single bit flip after the company id must be caught
+	for (int i = 2; i < len; i++) {
+		for (int bit = 0; bit < 8; bit++) {
+			buf[i] ^= 1 << bit;
+			CHECK(sensor_payload_parse(buf, len, &seq, r, 8) < 0);
+			buf[i] ^= 1 << bit;
+		}
+	}
+
+	for (int cut = 0; cut < len; cut++) {
+		CHECK(sensor_payload_parse(buf, cut, &seq, r, 8) < 0);
+	}
+
+	buf[0] ^= 1;
+	CHECK(sensor_payload_parse(buf, len, &seq, r, 8) == -ENOMSG);
+	buf[0] ^= 1;
+
+	buf[2] = SENSOR_PAYLOAD_VERSION + 1;
+	CHECK(sensor_payload_parse(buf, len, &seq, r, 8) == -ENOTSUP);
+}
+
+static void test_capacity(void)
+{
+	uint8_t buf[SENSOR_PAYLOAD_MAX];
+	struct sensor_payload_writer w;
+	int i;
+
+	// Five readings fill a legacy advertisement exactly; a sixth does not fit
+	sensor_payload_begin(&w, buf, sizeof(buf), 1);
+	for (i = 0; i < 5; i++) {
+		sensor_payload_put16(&w, SENSOR_LIGHT, i);
+	}
+	CHECK(sensor_payload_end(&w) == SENSOR_PAYLOAD_MAX);
+
+	sensor_payload_begin(&w, buf, sizeof(buf), 1);
+	for (i = 0; i < 6; i++) {
+		sensor_payload_put16(&w, SENSOR_LIGHT, i);
+	}
+	CHECK(sensor_payload_end(&w) == -ENOSPC);
+
+	sensor_payload_begin(&w, buf, SENSOR_PAYLOAD_OVERHEAD - 1, 1);
+	CHECK(sensor_payload_end(&w) == -ENOSPC);
+}
+
+static void test_unknown_type(void)
+{
+	uint8_t buf[SENSOR_PAYLOAD_MAX];
+	struct sensor_payload_writer w;
+	struct sensor_reading r[8];
+	uint16_t seq;
+	int len;
+
+	sensor_payload_begin(&w, buf, sizeof(buf), 7);
+	sensor_payload_put16(&w, 0x7F, 1);
+	sensor_payload_put16(&w, SENSOR_CLAP, 3);
+	len = sensor_payload_end(&w);
+
+	CHECK(sensor_payload_parse(buf, len, &seq, r, 8) == 1);
+	CHECK(r[0].type == SENSOR_CLAP && r[0].value == 3);
+}
+
+int main(void)
+{
+	test_round_trip();
+	test_corruption();
+	test_capacity();
+	test_unknown_type();
+
+	printf("%d failures\n", failures);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
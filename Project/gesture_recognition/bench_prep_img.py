@@ -0,0 +1,86 @@
+import argparse
+import io
+import os
+import time
+import numpy as np
+import cv2
+from PIL import Image
+
+from prep_img import Preprocessor, IMG_SIZE
+
+BASE_DIR = os.path.dirname(os.path.abspath(__file__))
+TEST_IMAGE = os.path.join(BASE_DIR, 'testing_images', '4', '901.jpg')
+
+################################################
+# Time fn over a number of runs, returning the
+# best of five mean milliseconds per call so a
+# noisy machine does not skew one side
+################################################
+def time_per_call(fn, runs, repeats=5):
+    fn()
+    best = float('inf')
+    for _ in range(repeats):
+        start = time.perf_counter()
+        for _ in range(runs // repeats):
+            fn()
+        best = min(best, (time.perf_counter() - start) * 1000.0 / (runs // repeats))
+    return best
+
+################################################
+# The original prep_img.py path: Keras load_img
+# is a PIL open and nearest resize, followed by
+# float conversion, scaling and expand_dims
+################################################
+def original(image):
+    img = Image.open(image).convert('RGB').resize(IMG_SIZE, Image.NEAREST)
+    img_array = np.asarray(img, dtype=np.float32)
+    img_array = img_array / 255.0
+    return np.expand_dims(img_array, axis=0)
+
+def original_rgb565(frame, width, height):
+    data = np.frombuffer(frame, dtype='>u2').reshape(height, width)
+    r = ((data >> 11) & 0x1F) << 3
+    g = ((data >> 5) & 0x3F) << 2
+    b = (data & 0x1F) << 3
+    img = np.stack((r | (r >> 5), g | (g >> 6), b | (b >> 5)), axis=-1).astype(np.uint8)
+    img = np.asarray(Image.fromarray(img).resize(IMG_SIZE, Image.NEAREST), dtype=np.float32)
+    return np.expand_dims(img / 255.0, axis=0)
+
+def compare(name, old, new, prep, runs):
+    new()
+    diff = np.abs(prep.batch - old()).mean()
+    old_ms = time_per_call(old, runs)
+    new_ms = time_per_call(new, runs)
+    print(f"{name}: original {old_ms:.3f} ms, preprocessor {new_ms:.3f} ms "
+          f"({old_ms / new_ms:.1f}x), mean abs diff {diff:.4f}")
+
+def main():
+    parser = argparse.ArgumentParser(description="prep_img.py microbenchmarks")
+    parser.add_argument('image', nargs='?', default=TEST_IMAGE)
+    parser.add_argument('--runs', type=int, default=500)
+    args = parser.parse_args()
+
+    prep = Preprocessor()
+
+    # A training image from disk, as classify_image loads it
+    compare("file", lambda: original(args.image), lambda: prep.load_file(0, args.image), prep, args.runs)
+
+    # A 240x240 camera frame, as JPEG and RGB565 payload bytes
+    bgr = cv2.resize(cv2.imread(args.image), (240, 240), interpolation=cv2.INTER_AREA)
+    jpeg = cv2.imencode('.jpg', bgr, [cv2.IMWRITE_JPEG_QUALITY, 60])[1].tobytes()
+    rgb = bgr[..., ::-1].astype(np.uint16)
+    frame = (((rgb[..., 0] >> 3) << 11) | ((rgb[..., 1] >> 2) << 5) | (rgb[..., 2] >> 3)).astype('>u2').tobytes()
+
+    compare("jpeg payload", lambda: original(io.BytesIO(jpeg)), lambda: prep.load_jpeg(0, jpeg),
+            prep, args.runs)
+    compare("rgb565 payload", lambda: original_rgb565(frame, 240, 240),
+            lambda: prep.load_rgb565(0, frame, 240, 240), prep, args.runs)
+
+    # A 4:3 JPEG letterboxed into the square input (the original stretches it)
+    wide = cv2.imencode('.jpg', cv2.resize(bgr, (320, 240)), [cv2.IMWRITE_JPEG_QUALITY, 60])[1].tobytes()
+    boxed = Preprocessor(letterbox=True)
+    compare("320x240 jpeg, letterboxed", lambda: original(io.BytesIO(wide)),
+            lambda: boxed.load_jpeg(0, wide), boxed, args.runs)
+
+if __name__ == "__main__":
+    main()
@@ -1,4 +1,7 @@
+import argparse
+import hashlib
 import os
+import time
 import numpy as np
 import tensorflow as tf
 from tensorflow.keras.preprocessing.image import ImageDataGenerator
@@ -11,65 +14,255 @@ from tensorflow.keras.optimizers import Adam
 BASE_DIR = os.path.dirname(os.path.abspath(__file__))
 TRAIN_DIR = os.path.join(BASE_DIR, 'training_images')
 TEST_DIR = os.path.join(BASE_DIR, 'testing_images')
+CACHE_DIR = os.path.join(BASE_DIR, 'cache')
+EMBEDDING_DIR = os.path.join(CACHE_DIR, 'embeddings')
 
 # Config
 IMG_SIZE = (224, 224)
 BATCH_SIZE = 32
 EPOCHS = 10
+AUTOTUNE = tf.data.AUTOTUNE
 
-# Data generators
-train_datagen = ImageDataGenerator(
-    rescale=1./255,
-    rotation_range=15,
-    zoom_range=0.1,
-    width_shift_range=0.1,
-    height_shift_range=0.1,
-    horizontal_flip=True
-)
-
-test_datagen = ImageDataGenerator(rescale=1./255)
-
-train_generator = train_datagen.flow_from_directory(
-    TRAIN_DIR,
-    target_size=IMG_SIZE,
-    batch_size=BATCH_SIZE,
-    class_mode='categorical'
-)
-
-test_generator = test_datagen.flow_from_directory(
-    TEST_DIR,
-    target_size=IMG_SIZE,
-    batch_size=BATCH_SIZE,
-    class_mode='categorical',
-    shuffle=False
-)
-
-# Build model
-base_model = MobileNetV2(include_top=False, weights='imagenet', input_shape=(224, 224, 3))
-base_model.trainable = False  # Freeze base layers
-
-x = base_model.output
-x = GlobalAveragePooling2D()(x)
-x = Dense(128, activation='relu')(x)
-predictions = Dense(7, activation='softmax')(x)
-
-model = Model(inputs=base_model.input, outputs=predictions)
-
-# Compile model
-model.compile(optimizer=Adam(learning_rate=0.0001),
-              loss='categorical_crossentropy',
-              metrics=['accuracy'])
-
-# Train model
-model.fit(
-    train_generator,
-    epochs=EPOCHS,
-    validation_data=test_generator
-)
-
-# Evaluate model
-loss, acc = model.evaluate(test_generator)
-print(f"Test Accuracy: {acc*100:.2f}%")
-
-# Save model
-model.save(os.path.join(BASE_DIR, 'gesture_model.h5'))
+################################################
+# Original Keras generators: decode and augment
+# one image at a time in Python every epoch
+################################################
+def make_generators():
+    train_datagen = ImageDataGenerator(
+        rescale=1./255,
+        rotation_range=15,
+        zoom_range=0.1,
+        width_shift_range=0.1,
+        height_shift_range=0.1,
+        horizontal_flip=True
+    )
+
+    test_datagen = ImageDataGenerator(rescale=1./255)
+
+    train_generator = train_datagen.flow_from_directory(
+        TRAIN_DIR,
+        target_size=IMG_SIZE,
+        batch_size=BATCH_SIZE,
+        class_mode='categorical'
+    )
+
+    test_generator = test_datagen.flow_from_directory(
+        TEST_DIR,
+        target_size=IMG_SIZE,
+        batch_size=BATCH_SIZE,
+        class_mode='categorical',
+        shuffle=False
+    )
+
+    return train_generator, test_generator, train_generator.samples
+
+################################################
+# Image paths and one hot labels, with classes
+# in the same order flow_from_directory uses
+################################################
+def list_images(directory):
+    classes = sorted(d for d in os.listdir(directory) if os.path.isdir(os.path.join(directory, d)))
+    paths, labels = [], []
+    for index, name in enumerate(classes):
+        folder = os.path.join(directory, name)
+        for f in sorted(os.listdir(folder)):
+            if f.lower().endswith(('.jpg', '.jpeg', '.png')):
+                paths.append(os.path.join(folder, f))
+                labels.append(index)
+    return paths, tf.keras.utils.to_categorical(labels, len(classes))
+
+def decode_image(path, label):
+    img = tf.io.decode_image(tf.io.read_file(path), channels=3, expand_animations=False)
+    img = tf.image.resize(img, IMG_SIZE, method='nearest')
+    return tf.cast(img, tf.uint8), label
+
+# Same augmentations as the generator, applied to a whole batch at once
+augment = tf.keras.Sequential([
+    tf.keras.layers.RandomRotation(15 / 360, fill_mode='nearest'),
+    tf.keras.layers.RandomZoom(0.1, fill_mode='nearest'),
+    tf.keras.layers.RandomTranslation(0.1, 0.1, fill_mode='nearest'),
+    tf.keras.layers.RandomFlip('horizontal'),
+])
+
+################################################
+# tf.data pipeline: JPEGs are decoded in parallel
+# once and cached to disk as uint8 tensors, then
+# each epoch shuffles, batches, augments per
+# batch and prefetches ahead of the model
+################################################
+def make_dataset(directory, training):
+    paths, labels = list_images(directory)
+
+    # A new cache is built whenever an image is added, removed or changed
+    key = hashlib.sha1()
+    for path in paths:
+        key.update(f"{path}:{os.path.getmtime(path)}:{os.path.getsize(path)}".encode())
+    os.makedirs(CACHE_DIR, exist_ok=True)
+    split = 'train' if training else 'test'
+    name = f"{split}-{key.hexdigest()[:12]}"
+    cache = os.path.join(CACHE_DIR, name)
+
+    # Caches for earlier versions of the images are never read again
+    for f in os.listdir(CACHE_DIR):
+        if f.startswith(split + '-') and not f.startswith(name):
+            os.remove(os.path.join(CACHE_DIR, f))
+
+    ds = tf.data.Dataset.from_tensor_slices((paths, labels))
+    ds = ds.map(decode_image, num_parallel_calls=AUTOTUNE).cache(cache)
+    if training:
+        ds = ds.shuffle(len(paths))
+    ds = ds.batch(BATCH_SIZE)
+
+    if training:
+        ds = ds.map(lambda x, y: (augment(tf.cast(x, tf.float32), training=True) / 255.0, y),
+                    num_parallel_calls=AUTOTUNE)
+    else:
+        ds = ds.map(lambda x, y: (tf.cast(x, tf.float32) / 255.0, y), num_parallel_calls=AUTOTUNE)
+    return ds.prefetch(AUTOTUNE), len(paths)
+
+def make_datasets():
+    train_ds, samples = make_dataset(TRAIN_DIR, training=True)
+    test_ds, _ = make_dataset(TEST_DIR, training=False)
+    return train_ds, test_ds, samples
+
+################################################
+# Images per second for each training epoch
+################################################
+class EpochThroughput(tf.keras.callbacks.Callback):
+    def __init__(self, samples):
+        super().__init__()
+        self.samples = samples
+        self.rates = []
+
+    def on_epoch_begin(self, epoch, logs=None):
+        self.start = time.perf_counter()
+
+    def on_epoch_end(self, epoch, logs=None):
+        rate = self.samples / (time.perf_counter() - self.start)
+        self.rates.append(rate)
+        print(f"Epoch {epoch + 1}: {rate:.1f} img/s")
+
+################################################
+# Input only throughput: one pass over each
+# pipeline with no model attached. The dataset
+# is run to its end every epoch, as fit does;
+# tf.data only keeps the file cache once a
+# pass has completed.
+################################################
+def benchmark(epochs):
+    for name, make in (('generator', make_generators), ('tf.data', make_datasets)):
+        train, _, samples = make()
+        steps = -(-samples // BATCH_SIZE)
+        for epoch in range(epochs):
+            start = time.perf_counter()
+            if isinstance(train, tf.data.Dataset):
+                for batch in train:
+                    pass
+            else:
+                # The generator loops forever
+                for _, batch in zip(range(steps), train):
+                    pass
+            rate = samples / (time.perf_counter() - start)
+            print(f"{name} epoch {epoch + 1}: {rate:.1f} img/s")
+
+def build_model():
+    base_model = MobileNetV2(include_top=False, weights='imagenet', input_shape=(224, 224, 3))
+    base_model.trainable = False  # Freeze base layers
+
+    x = base_model.output
+    x = GlobalAveragePooling2D()(x)
+    x = Dense(128, activation='relu')(x)
+    predictions = Dense(7, activation='softmax')(x)
+
+    model = Model(inputs=base_model.input, outputs=predictions)
+
+    # Compile model
+    model.compile(optimizer=Adam(learning_rate=0.0001),
+                  loss='categorical_crossentropy',
+                  metrics=['accuracy'])
+    return model
+
+################################################
+# Train only the dense head from cached backbone
+# embeddings, then graft it onto the full model.
+# Augmentation is skipped: each image has one
+# cached embedding.
+################################################
+def train_head(epochs):
+    from embeddings import EmbeddingCache, EMBEDDING_DIM
+
+    cache = EmbeddingCache(EMBEDDING_DIR)
+    train_paths, train_labels = list_images(TRAIN_DIR)
+    test_paths, test_labels = list_images(TEST_DIR)
+
+    start = time.perf_counter()
+    train_x, train_hashes = cache.embed(train_paths, decode_image)
+    test_x, test_hashes = cache.embed(test_paths, decode_image)
+    cache.prune(train_hashes + test_hashes)
+    print(f"Embeddings ready in {time.perf_counter() - start:.1f} s")
+
+    inputs = tf.keras.Input(shape=(EMBEDDING_DIM,))
+    x = Dense(128, activation='relu')(inputs)
+    outputs = Dense(7, activation='softmax')(x)
+    head = Model(inputs, outputs)
+    head.compile(optimizer=Adam(learning_rate=0.0001),
+                 loss='categorical_crossentropy',
+                 metrics=['accuracy'])
+
+    start = time.perf_counter()
+    head.fit(train_x, train_labels, batch_size=BATCH_SIZE, epochs=epochs,
+             validation_data=(test_x, test_labels), shuffle=True)
+    print(f"Head trained in {time.perf_counter() - start:.1f} s")
+
+    loss, acc = head.evaluate(test_x, test_labels, verbose=0)
+    print(f"Test Accuracy: {acc*100:.2f}%")
+
+    # Same layers as build_model, so the saved model is a drop in replacement
+    model = build_model()
+    for dst, src in zip(model.layers[-2:], head.layers[-2:]):
+        dst.set_weights(src.get_weights())
+    model.save(os.path.join(BASE_DIR, 'gesture_model.h5'))
+
+def main():
+    parser = argparse.ArgumentParser(description="Train the gesture model")
+    parser.add_argument('--pipeline', choices=['tfdata', 'generator'], default='tfdata')
+    parser.add_argument('--epochs', type=int, default=EPOCHS)
+    parser.add_argument('--benchmark', action='store_true',
+                        help="only time the input pipelines, without training")
+    parser.add_argument('--head-only', action='store_true',
+                        help="train only the dense head from cached backbone embeddings")
+    args = parser.parse_args()
+
+    if args.benchmark:
+        benchmark(args.epochs)
+        return
+    if args.head_only:
+        train_head(args.epochs)
+        return
+
+    if args.pipeline == 'tfdata':
+        train_data, test_data, samples = make_datasets()
+    else:
+        train_data, test_data, samples = make_generators()
+
+    model = build_model()
+    throughput = EpochThroughput(samples)
+
+    # Train model
+    model.fit(
+        train_data,
+        epochs=args.epochs,
+        validation_data=test_data,
+        callbacks=[throughput]
+    )
+    print(f"{args.pipeline}: mean {np.mean(throughput.rates):.1f} img/s per epoch")
+
+    # Evaluate model
+    loss, acc = model.evaluate(test_data)
+    print(f"Test Accuracy: {acc*100:.2f}%")
+
+    # Save model
+    model.save(os.path.join(BASE_DIR, 'gesture_model.h5'))
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,127 @@
+import hashlib
+import json
+import os
+import numpy as np
+import tensorflow as tf
+from tensorflow.keras.applications import MobileNetV2
+
+# MobileNetV2 output after global average pooling
+EMBEDDING_DIM = 1280
+
+def file_hash(path):
+    with open(path, 'rb') as f:
+        return hashlib.sha1(f.read()).hexdigest()
+
+################################################
+# On disk cache of backbone embeddings keyed by
+# the SHA-1 of the image file. Vectors are rows
+# of a flat float32 file read through a memmap;
+# an edited image hashes differently, so its old
+# row is simply never looked up again.
+################################################
+class EmbeddingCache:
+    def __init__(self, directory):
+        os.makedirs(directory, exist_ok=True)
+        self.vectors_path = os.path.join(directory, 'vectors.f32')
+        self.index_path = os.path.join(directory, 'index.json')
+        self.index = {}
+        if os.path.exists(self.index_path):
+            with open(self.index_path) as f:
+                self.index = json.load(f)
+        # An interrupted write can leave a torn row at the end of the file;
+        # cut it off so later rows stay aligned, and drop entries for rows
+        # that did not make it
+        self._truncate_torn_row()
+        rows = self.rows
+        self.index = {h: row for h, row in self.index.items() if row < rows}
+        self._backbone = None
+
+    def _truncate_torn_row(self):
+        if not os.path.exists(self.vectors_path):
+            return
+        row_size = EMBEDDING_DIM * 4
+        size = os.path.getsize(self.vectors_path)
+        if size % row_size:
+            with open(self.vectors_path, 'r+b') as f:
+                f.truncate(size // row_size * row_size)
+
+    @property
+    def rows(self):
+        if not os.path.exists(self.vectors_path):
+            return 0
+        return os.path.getsize(self.vectors_path) // (EMBEDDING_DIM * 4)
+
+    def _vectors(self):
+        return np.memmap(self.vectors_path, dtype=np.float32, mode='r',
+                         shape=(self.rows, EMBEDDING_DIM))
+
+    def _append(self, hashes, vectors):
+        self._truncate_torn_row()
+        with open(self.vectors_path, 'ab') as f:
+            start = f.tell() // (EMBEDDING_DIM * 4)
+            f.write(np.ascontiguousarray(vectors, dtype=np.float32).tobytes())
+        for i, h in enumerate(hashes):
+            self.index[h] = start + i
+
+        # Index last, so a crash leaves rows without an entry rather than
+        # entries pointing past the end of the file
+        tmp = self.index_path + '.tmp'
+        with open(tmp, 'w') as f:
+            json.dump(self.index, f)
+        os.replace(tmp, self.index_path)
+
+    def backbone(self):
+        if self._backbone is None:
+            self._backbone = MobileNetV2(include_top=False, weights='imagenet',
+                                         input_shape=(224, 224, 3), pooling='avg')
+        return self._backbone
+
+    ################################################
+    # Embeddings for a list of image files, running
+    # the backbone only on images not yet cached.
+    # Returns the embeddings and the file hashes.
+    ################################################
+    def embed(self, paths, decode, batch_size=32):
+        hashes = [file_hash(p) for p in paths]
+        missing = sorted({h: p for h, p in zip(hashes, paths) if h not in self.index}.items())
+
+        if missing:
+            print(f"Embedding {len(missing)} new or changed images "
+                  f"({len(paths) - len(missing)} cached)")
+            new_hashes = [h for h, _ in missing]
+            ds = tf.data.Dataset.from_tensor_slices([p for _, p in missing])
+            ds = ds.map(lambda p: tf.cast(decode(p, 0)[0], tf.float32) / 255.0,
+                        num_parallel_calls=tf.data.AUTOTUNE)
+            ds = ds.batch(batch_size).prefetch(tf.data.AUTOTUNE)
+            self._append(new_hashes, self.backbone().predict(ds, verbose=0))
+
+        vectors = self._vectors()
+        return np.stack([vectors[self.index[h]] for h in hashes]), hashes
+
+    ################################################
+    # Rewrite the cache keeping only the given
+    # images, once most rows have gone stale
+    ################################################
+    def prune(self, live_hashes, threshold=0.5):
+        live = [h for h in dict.fromkeys(live_hashes) if h in self.index]
+        if self.rows == 0 or len(live) >= self.rows * threshold:
+            return
+        vectors = np.array([self._vectors()[self.index[h]] for h in live], dtype=np.float32)
+        index = {h: row for row, h in enumerate(live)}
+
+        # Write the new cache beside the old one, then drop the old index
+        # before swapping anything in: a crash part way leaves either the
+        # old cache intact or no index at all, never an index whose rows
+        # now hold other vectors
+        tmp_vectors = self.vectors_path + '.tmp'
+        tmp_index = self.index_path + '.tmp'
+        with open(tmp_vectors, 'wb') as f:
+            f.write(np.ascontiguousarray(vectors).tobytes())
+        with open(tmp_index, 'w') as f:
+            json.dump(index, f)
+        if os.path.exists(self.index_path):
+            os.remove(self.index_path)
+        os.replace(tmp_vectors, self.vectors_path)
+        os.replace(tmp_index, self.index_path)
+        self.index = index
+        print(f"Pruned embedding cache to {len(live)} rows")
@@ -0,0 +1,209 @@
+import argparse
+import os
+import queue
+import threading
+import time
+from concurrent.futures import Future
+import numpy as np
+
+from prep_img import prepare_image_for_classification
+
+# TensorFlow is only imported for the Keras model (or when tflite_runtime
+# is missing), so the .tflite path stays light
+
+# Constants
+BASE_DIR = os.path.dirname(os.path.abspath(__file__))
+MODEL_PATH = os.path.join(BASE_DIR, 'gesture_model.h5')
+TFLITE_MODEL_PATH = os.path.join(BASE_DIR, 'gesture_model_int8.tflite')
+IMG_SIZE = (224, 224)
+IMAGE_EXTENSIONS = ('.jpg', '.jpeg', '.png')
+
+# Label map (based on training folders)
+LABELS = ['0', '1', '2', '3', '4', '5', 'phone']
+
+################################################
+# Runs a quantised .tflite export of the model
+# (see quantize.py), converting float images to
+# the int8 input and the output back to floats
+################################################
+class TfliteModel:
+    def __init__(self, model_path, threads=None):
+        try:
+            from tflite_runtime.interpreter import Interpreter
+        except ImportError:
+            import tensorflow as tf
+            Interpreter = tf.lite.Interpreter
+        self.interpreter = Interpreter(model_path=model_path, num_threads=threads or os.cpu_count())
+        self.interpreter.allocate_tensors()
+        self.input = self.interpreter.get_input_details()[0]
+        self.output = self.interpreter.get_output_details()[0]
+        self._batch = None
+
+    def __call__(self, batch):
+        count = len(batch)
+        if self._batch != count:
+            self.interpreter.resize_input_tensor(self.input['index'], (count, IMG_SIZE[1], IMG_SIZE[0], 3))
+            self.interpreter.allocate_tensors()
+            self._batch = count
+
+        scale, zero_point = self.input['quantization']
+        if self.input['dtype'] != np.float32:
+            info = np.iinfo(self.input['dtype'])
+            batch = np.clip(np.round(batch / scale + zero_point), info.min, info.max)
+        self.interpreter.set_tensor(self.input['index'], batch.astype(self.input['dtype']))
+        self.interpreter.invoke()
+
+        out = self.interpreter.get_tensor(self.output['index'])
+        scale, zero_point = self.output['quantization']
+        if self.output['dtype'] != np.float32:
+            out = (out.astype(np.float32) - zero_point) * scale
+        return out
+
+################################################
+# Loads the gesture model once and classifies
+# images in micro-batches. Single images queued
+# with submit() are grouped until the batch is
+# full or the oldest has waited max_latency_ms.
+################################################
+class InferenceEngine:
+    def __init__(self, model_path=MODEL_PATH, max_batch=16, max_latency_ms=20):
+        self.max_batch = max_batch
+        self.max_latency = max_latency_ms / 1000.0
+        if model_path.endswith('.tflite'):
+            self._infer = TfliteModel(model_path)
+        else:
+            import tensorflow as tf
+            from tensorflow.keras.models import load_model
+
+            self.model = load_model(model_path)
+
+            # One traced graph for every batch size, instead of model.predict
+            # setting up a data pipeline on each call
+            self._infer = tf.function(
+                lambda batch: self.model(batch, training=False),
+                input_signature=[tf.TensorSpec((None, IMG_SIZE[1], IMG_SIZE[0], 3), tf.float32)])
+
+        self._batch = np.zeros((max_batch, IMG_SIZE[1], IMG_SIZE[0], 3), dtype=np.float32)
+
+        # Trace and allocate up front so the first real frame is not slow
+        self._run(1)
+        self._run(max_batch)
+
+        self._queue = queue.Queue()
+        self._worker = threading.Thread(target=self._serve, daemon=True)
+        self._worker.start()
+
+    def _run(self, count):
+        prediction = np.asarray(self._infer(self._batch[:count]))
+        classes = np.argmax(prediction, axis=1)
+        return [(LABELS[c], float(prediction[i, c])) for i, c in enumerate(classes)]
+
+    ################################################
+    # Background worker: gather queued images into
+    # a batch and resolve their futures
+    ################################################
+    def _serve(self):
+        while True:
+            item = self._queue.get()
+            if item is None:
+                return
+            pending = [item]
+            deadline = time.perf_counter() + self.max_latency
+
+            while len(pending) < self.max_batch:
+                remaining = deadline - time.perf_counter()
+                if remaining <= 0:
+                    break
+                try:
+                    item = self._queue.get(timeout=remaining)
+                except queue.Empty:
+                    break
+                if item is None:
+                    self._queue.put(None)
+                    break
+                pending.append(item)
+
+            for i, (image, _) in enumerate(pending):
+                self._batch[i] = image
+            try:
+                results = self._run(len(pending))
+            except Exception as e:
+                for _, future in pending:
+                    future.set_exception(e)
+                continue
+            for (_, future), result in zip(pending, results):
+                future.set_result(result)
+
+    # Queue one (224, 224, 3) float image scaled to [0, 1]; the future
+    # resolves to (label, confidence)
+    def submit(self, image):
+        future = Future()
+        self._queue.put((image, future))
+        return future
+
+    def classify(self, image):
+        return self.submit(image).result()
+
+    # Classify an (N, 224, 224, 3) array directly, bypassing the queue.
+    # Must not be mixed with submit() from another thread.
+    def classify_batch(self, images):
+        results = []
+        for start in range(0, len(images), self.max_batch):
+            chunk = images[start:start + self.max_batch]
+            self._batch[:len(chunk)] = chunk
+            results.extend(self._run(len(chunk)))
+        return results
+
+    def close(self):
+        self._queue.put(None)
+        self._worker.join()
+
+def load_image(image_path):
+    return prepare_image_for_classification(image_path, IMG_SIZE)[0]
+
+def find_images(directory):
+    paths = []
+    for root, _, files in os.walk(directory):
+        paths.extend(os.path.join(root, f) for f in files if f.lower().endswith(IMAGE_EXTENSIONS))
+    return sorted(paths)
+
+################################################
+# Classify every image under a directory and
+# report inference throughput
+################################################
+def main():
+    parser = argparse.ArgumentParser(description="Batched gesture classification over a directory")
+    parser.add_argument('directory', nargs='?', default=os.path.join(BASE_DIR, 'testing_images'))
+    parser.add_argument('--model', default=MODEL_PATH, help="Keras .h5 or quantised .tflite model")
+    parser.add_argument('--batch', type=int, default=16)
+    parser.add_argument('--quiet', action='store_true', help="only print the summary")
+    args = parser.parse_args()
+
+    paths = find_images(args.directory)
+    if not paths:
+        print(f"No images found in {args.directory}")
+        return
+
+    engine = InferenceEngine(args.model, max_batch=args.batch)
+    infer_time = 0.0
+    start = time.perf_counter()
+
+    for i in range(0, len(paths), args.batch):
+        chunk = paths[i:i + args.batch]
+        images = np.stack([load_image(path) for path in chunk])
+
+        t = time.perf_counter()
+        results = engine.classify_batch(images)
+        infer_time += time.perf_counter() - t
+
+        if not args.quiet:
+            for path, (label, confidence) in zip(chunk, results):
+                print(f"{os.path.relpath(path, args.directory)}: {label} ({confidence:.2f})")
+
+    total_time = time.perf_counter() - start
+    engine.close()
+    print(f"{len(paths)} images: {len(paths) / infer_time:.1f} img/s inference, "
+          f"{len(paths) / total_time:.1f} img/s including decode (batch {args.batch})")
+
+if __name__ == "__main__":
+    main()
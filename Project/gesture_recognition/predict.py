@@ -1,28 +1,44 @@
-import os
-import numpy as np
-from tensorflow.keras.models import load_model
-from tensorflow.keras.preprocessing.image import load_img, img_to_array
+import argparse
+
+from prep_img import prepare_image_for_classification
+from inference import InferenceEngine, LABELS, MODEL_PATH
 
 # Constants
 IMG_SIZE = (224, 224)
 IMAGE_PATH = 'testing_images/4/901.jpg'  # Replace with other image filenames
 
-# Load model
-model = load_model('gesture_model.h5')
+labels = LABELS
+
+# Loaded and warmed once, by load() or on first use
+engine = None
 
-# Define your label map manually (based on training folders)
-labels = ['0', '1', '2', '3', '4', '5', 'phone']
+# Pick the model: the Keras .h5 by default, or an int8 .tflite export
+# from quantize.py
+def load(model_path=MODEL_PATH):
+    global engine
+    engine = InferenceEngine(model_path)
+    print(f"Loaded gesture model {model_path}")
+    return engine
+
+# Classify a (1, 224, 224, 3) float array scaled to [0, 1]
+def classify_array(img_array):
+    if engine is None:
+        load()
+    return engine.classify_batch(img_array)[0]
 
 def classify_image(image_path):
-    img = load_img(image_path, target_size=IMG_SIZE)
-    img_array = img_to_array(img) / 255.0
-    img_array = np.expand_dims(img_array, axis=0)
+    img_array = prepare_image_for_classification(image_path, IMG_SIZE)
 
-    prediction = model.predict(img_array)
-    predicted_class = np.argmax(prediction)
-    confidence = np.max(prediction)
+    label, confidence = classify_array(img_array)
 
-    print(f"Predicted Gesture: {labels[predicted_class]} (Confidence: {confidence:.2f})")
+    print(f"Predicted Gesture: {label} (Confidence: {confidence:.2f})")
 
 # Run it
-classify_image(IMAGE_PATH)
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Classify one gesture image")
+    parser.add_argument('image', nargs='?', default=IMAGE_PATH)
+    parser.add_argument('--model', default=MODEL_PATH, help="Keras .h5 or quantised .tflite model")
+    args = parser.parse_args()
+
+    load(args.model)
+    classify_image(args.image)
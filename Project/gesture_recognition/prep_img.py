@@ -1,10 +1,164 @@
 import numpy as np
-from tensorflow.keras.preprocessing.image import load_img, img_to_array
+import cv2
+
+IMG_SIZE = (224, 224)
+
+# Pixel formats, as in the ESP32S3 frame header (ESP32_EYE/src/frame_proto.h)
+PIXFMT_RGB565 = 1
+PIXFMT_JPEG = 2
+
+SCALE = np.float32(1.0 / 255.0)
+
+################################################
+# Width and height from a JPEG's start of frame
+# marker, without decoding it
+################################################
+def jpeg_size(data):
+    i = 2
+    while i + 9 < len(data):
+        if data[i] != 0xFF:
+            return None
+        marker = data[i + 1]
+        if marker in (0xC0, 0xC1, 0xC2):
+            return (data[i + 7] << 8) | data[i + 8], (data[i + 5] << 8) | data[i + 6]
+        i += 2 + ((data[i + 2] << 8) | data[i + 3])
+    return None
+
+################################################
+# Decodes JPEG or RGB565 payload bytes straight
+# into a preallocated float32 model batch:
+# resize, optional letterbox, BGR to RGB and
+# scaling to [0, 1] with no full size float
+# intermediates. The batch is reused, so copy
+# it if it has to outlive the next load.
+################################################
+class Preprocessor:
+    _rgb565_lut = None
+
+    def __init__(self, batch_size=1, target_size=IMG_SIZE, letterbox=False, pad=0.0,
+                 interpolation=cv2.INTER_NEAREST):
+        self.target_size = target_size
+        self.letterbox = letterbox
+        self.pad = pad
+        self.interpolation = interpolation
+        self.batch = np.empty((batch_size, target_size[1], target_size[0], 3), dtype=np.float32)
+        self._resized = {}
+        self._index = {}
+
+    ################################################
+    # Where the image lands in the output: its
+    # scaled size and top left corner
+    ################################################
+    def _placement(self, width, height):
+        out_w, out_h = self.target_size
+        if not self.letterbox:
+            return out_w, out_h, 0, 0
+        scale = min(out_w / width, out_h / height)
+        w = max(1, round(width * scale))
+        h = max(1, round(height * scale))
+        return w, h, (out_w - w) // 2, (out_h - h) // 2
+
+    def _fill_pad(self, slot, w, h, left, top):
+        if w == slot.shape[1] and h == slot.shape[0]:
+            return
+        slot[:top] = self.pad
+        slot[top + h:] = self.pad
+        slot[top:top + h, :left] = self.pad
+        slot[top:top + h, left + w:] = self.pad
+
+    def load_jpeg(self, index, data):
+        size = jpeg_size(data)
+        flags = cv2.IMREAD_COLOR
+        if size is not None:
+            # Let the decoder scale by 1/2, 1/4 or 1/8 in the DCT when the
+            # image is still at least as big as the target afterwards
+            w, h, _, _ = self._placement(*size)
+            for factor, reduced in ((8, cv2.IMREAD_REDUCED_COLOR_8),
+                                    (4, cv2.IMREAD_REDUCED_COLOR_4),
+                                    (2, cv2.IMREAD_REDUCED_COLOR_2)):
+                if size[0] // factor >= w and size[1] // factor >= h:
+                    flags = reduced
+                    break
+
+        bgr = cv2.imdecode(np.frombuffer(data, dtype=np.uint8), flags)
+        if bgr is None:
+            raise ValueError("JPEG decode failed")
+        self.load_bgr(index, bgr)
+
+    def load_bgr(self, index, bgr):
+        slot = self.batch[index]
+        w, h, left, top = self._placement(bgr.shape[1], bgr.shape[0])
+        if (bgr.shape[1], bgr.shape[0]) != (w, h):
+            if (w, h) not in self._resized:
+                self._resized[(w, h)] = np.empty((h, w, 3), dtype=np.uint8)
+            bgr = cv2.resize(bgr, (w, h), dst=self._resized[(w, h)], interpolation=self.interpolation)
+
+        self._fill_pad(slot, w, h, left, top)
+        # Channel swap, widening and scaling in a single pass
+        np.multiply(bgr[..., ::-1], SCALE, out=slot[top:top + h, left:left + w], casting='unsafe')
+
+    @classmethod
+    def _lut(cls):
+        # Indexed by the raw little endian read of a big endian pixel, giving
+        # the scaled RGB values directly
+        if cls._rgb565_lut is None:
+            raw = np.arange(65536, dtype=np.uint32)
+            v = ((raw & 0xFF) << 8) | (raw >> 8)
+            r = ((v >> 11) & 0x1F) << 3
+            g = ((v >> 5) & 0x3F) << 2
+            b = (v & 0x1F) << 3
+            rgb = np.stack((r | (r >> 5), g | (g >> 6), b | (b >> 5)), axis=-1)
+            cls._rgb565_lut = (rgb * SCALE).astype(np.float32)
+        return cls._rgb565_lut
+
+    def load_rgb565(self, index, data, width, height):
+        slot = self.batch[index]
+        w, h, left, top = self._placement(width, height)
+
+        # Source pixel for every output pixel, as cv2.INTER_NEAREST picks it
+        key = (width, height)
+        if key not in self._index:
+            ys = np.arange(h) * height // h
+            xs = np.arange(w) * width // w
+            index_map = (ys[:, None] * width + xs[None, :]).ravel().astype(np.intp)
+            self._index[key] = index_map, np.empty(index_map.shape, dtype=np.uint16)
+        index_map, picked = self._index[key]
+
+        pixels = np.frombuffer(data, dtype='<u2', count=width * height)
+        np.take(pixels, index_map, out=picked, mode='clip')
+        self._fill_pad(slot, w, h, left, top)
+        # Byteswap, expand and scale in one gather, straight into the batch
+        # when the image fills it
+        if (w, h) == self.target_size:
+            np.take(self._lut(), picked, axis=0, out=slot.reshape(-1, 3), mode='clip')
+        else:
+            slot[top:top + h, left:left + w] = self._lut()[picked].reshape(h, w, 3)
+
+    def load(self, index, data, pixfmt, width=0, height=0):
+        if pixfmt == PIXFMT_RGB565:
+            self.load_rgb565(index, data, width, height)
+        elif pixfmt == PIXFMT_JPEG:
+            self.load_jpeg(index, data)
+        else:
+            raise ValueError(f"unsupported pixel format {pixfmt}")
+
+    def load_file(self, index, image_path):
+        with open(image_path, 'rb') as f:
+            data = f.read()
+        if data[:2] == b'\xff\xd8':
+            self.load_jpeg(index, data)
+        else:
+            bgr = cv2.imdecode(np.frombuffer(data, dtype=np.uint8), cv2.IMREAD_COLOR)
+            if bgr is None:
+                raise ValueError(f"{image_path}: decode failed")
+            self.load_bgr(index, bgr)
+
+_preprocessors = {}
 
 #Loads and formats a JPEG image for model classification.
 def prepare_image_for_classification(image_path, target_size=(224, 224)):
-    img = load_img(image_path, target_size=target_size)  # PIL image
-    img_array = img_to_array(img)                        # Convert to NumPy array
-    img_array = img_array / 255.0                        # Normalize to [0, 1]
-    img_array = np.expand_dims(img_array, axis=0)        # Shape: (1, height, width, 3)
-    return img_array
+    if target_size not in _preprocessors:
+        _preprocessors[target_size] = Preprocessor(target_size=target_size)
+    prep = _preprocessors[target_size]
+    prep.load_file(0, image_path)
+    return prep.batch.copy()                             # Shape: (1, height, width, 3)
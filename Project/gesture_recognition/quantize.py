@@ -0,0 +1,94 @@
+import argparse
+import os
+import random
+import time
+import numpy as np
+import tensorflow as tf
+from tensorflow.keras.models import load_model
+
+from inference import (BASE_DIR, MODEL_PATH, TFLITE_MODEL_PATH, LABELS,
+                       InferenceEngine, find_images, load_image)
+
+# Paths
+TRAIN_DIR = os.path.join(BASE_DIR, 'training_images')
+TEST_DIR = os.path.join(BASE_DIR, 'testing_images')
+
+# KPI 1: gesture classification accuracy
+ACCURACY_KPI = 0.70
+
+################################################
+# Calibration images for the quantiser, a fixed
+# random sample across all gesture classes
+################################################
+def representative_dataset(samples):
+    paths = find_images(TRAIN_DIR)
+    random.Random(0).shuffle(paths)
+
+    def generator():
+        for path in paths[:samples]:
+            yield [load_image(path)[np.newaxis].astype(np.float32)]
+
+    return generator
+
+################################################
+# Post training full integer quantisation: int8
+# weights, activations, input and output
+################################################
+def export(model_path, out_path, samples):
+    model = load_model(model_path)
+    converter = tf.lite.TFLiteConverter.from_keras_model(model)
+    converter.optimizations = [tf.lite.Optimize.DEFAULT]
+    converter.representative_dataset = representative_dataset(samples)
+    converter.target_spec.supported_ops = [tf.lite.OpsSet.TFLITE_BUILTINS_INT8]
+    converter.inference_input_type = tf.int8
+    converter.inference_output_type = tf.int8
+
+    with open(out_path, 'wb') as f:
+        f.write(converter.convert())
+    print(f"Saved {out_path}: {os.path.getsize(out_path) / 1024:.0f} KB "
+          f"(float model {os.path.getsize(model_path) / 1024:.0f} KB)")
+
+################################################
+# Accuracy over testing_images and single image
+# latency, as the live stream sees it
+################################################
+def evaluate(model_path, images, truth):
+    engine = InferenceEngine(model_path, max_batch=1)
+    correct = 0
+    latencies = []
+    for image, label in zip(images, truth):
+        t = time.perf_counter()
+        predicted, _ = engine.classify_batch(image[np.newaxis])[0]
+        latencies.append((time.perf_counter() - t) * 1000.0)
+        correct += predicted == label
+    engine.close()
+
+    accuracy = correct / len(truth)
+    p50, p95 = np.percentile(latencies, [50, 95])
+    kpi = "pass" if accuracy >= ACCURACY_KPI else "FAIL"
+    print(f"{os.path.basename(model_path)}: accuracy {accuracy * 100:.2f}% [{kpi}], "
+          f"latency p50 {p50:.1f} ms p95 {p95:.1f} ms, "
+          f"{os.path.getsize(model_path) / 1024:.0f} KB")
+
+def main():
+    parser = argparse.ArgumentParser(description="Export and evaluate the int8 TFLite gesture model")
+    parser.add_argument('--model', default=MODEL_PATH)
+    parser.add_argument('--out', default=TFLITE_MODEL_PATH)
+    parser.add_argument('--samples', type=int, default=300, help="representative images for calibration")
+    parser.add_argument('--skip-export', action='store_true', help="only evaluate an existing export")
+    args = parser.parse_args()
+
+    if not args.skip_export:
+        export(args.model, args.out, args.samples)
+
+    # The class is the name of the folder holding the image
+    paths = [p for p in find_images(TEST_DIR) if os.path.basename(os.path.dirname(p)) in LABELS]
+    images = [load_image(p) for p in paths]
+    truth = [os.path.basename(os.path.dirname(p)) for p in paths]
+    print(f"Evaluating on {len(paths)} test images (KPI {ACCURACY_KPI * 100:.0f}%)")
+
+    evaluate(args.model, images, truth)
+    evaluate(args.out, images, truth)
+
+if __name__ == "__main__":
+    main()
@@ -14,7 +14,9 @@
 #include <ctype.h>
 #include <zephyr/drivers/sensor.h>
 
-uint16_t temp;
+#include "sensor_payload.h"
+
+int16_t temp;
 uint16_t light;
 uint16_t clap;
 bool new_temp;
@@ -34,7 +36,7 @@ static const struct json_obj_descr data_struct[] = {
 };
 
 
-extern void json_print(int major, int value) {
+static void print_to_serial(void) {
     char json_output[256];
 
     struct json_data data;
@@ -59,41 +61,70 @@ extern void json_print(int major, int value) {
 
 static bool adv_data_cb(struct bt_data *data, void *user_data) {
 
-    static const uint8_t expected_uuid[16] = {
-        0x19, 0xEE, 0x15, 0x16, 0x01, 0x6B, 0x4B, 0xEC,
-        0xAD, 0x96, 0xBC, 0xB9, 0x6D, 0x16, 0x6E, 0x97
-    };
+    // The node repeats each payload until it has a new one
+    static bool have_seq;
+    static uint16_t last_seq;
+    // Node's running clap count, to turn it into new claps
+    static bool have_claps;
+    static uint16_t last_claps;
+
+    struct sensor_reading readings[8];
+    uint16_t seq;
 
     // Only parse manufacturer-specific data
-    if (data->type != BT_DATA_MANUFACTURER_DATA || data->data_len < 25) return true;
-
-    const uint8_t *payload = data->data;
-
-    // Check for iBeacon header
-    if (!(payload[0] == 0x4C && payload[1] == 0x00 && payload[2] == 0x02 && payload[3] == 0x15)) return true;
-
-    // Check UUID match
-    if (memcmp(&payload[4], expected_uuid, 16) != 0) return true;
-
-    // Extract fields
-    uint16_t major = (payload[20] << 8) | payload[20 + 1];
-    uint16_t minor = (payload[22] << 8) | payload[22 + 1];
-
-    if (major == 0) {
-        //Temperature
-        temp = minor;
-        new_temp = true;
-        printk("Temp received %d", (int)temp);
-    } else if (major == 1) {
-        //Light
-        light = minor;
-        new_light = true;
-        printk("Temp received %d", (int)light);
-    } else if (major == 2) {
-        //Clap
-        clap = minor;
-        new_clap = true;
-        printk("Temp received %d", (int)clap);
+    if (data->type != BT_DATA_MANUFACTURER_DATA) return true;
+
+    int count = sensor_payload_parse(data->data, data->data_len, &seq,
+                                     readings, ARRAY_SIZE(readings));
+    if (count == -ENOMSG) return true;
+    if (count < 0) {
+        printk("Bad sensor payload (err %d)\n", count);
+        return false;
+    }
+
+    if (have_seq && seq == last_seq) return false;
+    // A sequence number that goes backwards means the node restarted
+    bool restarted = have_seq && (int16_t)(seq - last_seq) < 0;
+    have_seq = true;
+    last_seq = seq;
+
+    for (int i = 0; i < count; i++) {
+        switch (readings[i].type) {
+        case SENSOR_TEMP:
+            temp = readings[i].value;
+            new_temp = true;
+            printk("Temp received %d\n", (int)temp);
+            break;
+        case SENSOR_LIGHT:
+            light = readings[i].value;
+            new_light = true;
+            printk("Light received %d\n", (int)light);
+            break;
+        case SENSOR_CLAP: {
+            uint16_t total = readings[i].value;
+
+            // A restarted node counts from zero again, so its total is all
+            // new claps rather than a wrap. A count that drops is taken as a
+            // restart too, in case the sequence number happened to land
+            // ahead of the old one.
+            if (have_claps && (restarted || total < last_claps)) {
+                printk("Sensor node restarted\n");
+                last_claps = 0;
+            }
+
+            // The first payload only sets the baseline
+            if (have_claps && total != last_claps) {
+                clap += (uint16_t)(total - last_claps);
+                new_clap = true;
+                printk("Clap received %d\n", (int)clap);
+            }
+            have_claps = true;
+            last_claps = total;
+            break;
+        }
+        default:
+            break;
+        }
     }
 
     return false;  // Stop parsing further
@@ -114,7 +145,9 @@ int main(void)
 
     static const struct bt_le_scan_param scan_params = {
         .type     = BT_LE_SCAN_TYPE_ACTIVE,
-        .options  = BT_LE_SCAN_OPT_FILTER_DUPLICATE,
+        // No duplicate filtering: the Thingy keeps advertising from the
+        // same address and only the payload changes
+        .options  = BT_LE_SCAN_OPT_NONE,
         .interval = 0x0060,
         .window   = 0x0030,
     };